@@ -2,6 +2,9 @@
 
 #include "Logger.h"
 #include <sstream>
+#include <algorithm>
+
+#include <unistd.h>
 
 namespace vodeox
 {
@@ -16,51 +19,154 @@ static const unsigned int MAX_PATH_LENGTH = 2048;
 #define snprintf _snprintf
 #endif
 
-std::string DefaultLoggerFormatter::format( const Logger& logger, 
-											const std::string& delim, 
-											const LogEntry& logEntry)
+//group commit defaults, see setFlushPolicy
+static const size_t DEFAULT_FLUSH_BYTES = 64 * 1024;
+static const uint64 DEFAULT_FLUSH_USEC = 100000;
+
+//how long the logger thread sleeps when the rings were empty in deferred mode
+static const unsigned int DEFERRED_POLL_USEC = 1000;
+
+//what a deferred LOG_* call leaves in the ring, the encoded arguments follow
+struct deferred_record
+{
+	uint32				size;	//set by log_ring::commit
+	int					level;
+	int					line;
+	uint32				reserved;
+	const log_format*	format;
+	const char*			file;
+	const char*			component;
+	uint64				ts;
+};
+
+static __thread log_ring* s_thread_ring = NULL;
+
+//eager mode only, deferred records sit in the rings
+static histogram s_queue_wait("logger.queue_wait_ns");
+
+//eager entries dropped on a full queue, callers never wait for the logger
+static counter s_queue_dropped("logger.dropped");
+
+//starts at 1 so zero initialized sites look stale
+volatile uint64 Logger::s_generation = 1;
+
+//level names without building a std::string per entry
+static const char* level_token(int level, bool lower)
+{
+	static const char* upper_names[] = { "SILENT", "VERBOSE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL" };
+	static const char* lower_names[] = { "silent", "verbose", "debug", "info", "warn", "error", "fatal" };
+	if (level < Logger::LOG_LEVEL_SILENT || level > Logger::LOG_LEVEL_FATAL)
+		return lower ? "undefined" : "UNDEFINED_LOG_LEVEL";
+	return lower ? lower_names[level + 1] : upper_names[level + 1];
+}
+
+//structured formats carry one line per entry, the message's own newline goes
+static inline size_t message_length(const std::string& message)
+{
+	size_t len = message.size();
+	return (len && message[len - 1] == '\n') ? len - 1 : len;
+}
+
+std::string LoggerFormatter::format(const Logger& logger,
+									const std::string& delim,
+									const LogEntry& logEntry)
+{
+	std::string s;
+	log_output out(s);
+	append(logger, delim, logEntry, out);
+	return s;
+}
+
+void LoggerFormatter::append(const Logger& logger,
+							 const std::string& delim,
+							 const LogEntry& logEntry,
+							 log_output& out)
+{
+	out.append(format(logger, delim, logEntry));
+}
+
+void DefaultLoggerFormatter::append(const Logger& logger,
+									const std::string& delim,
+									const LogEntry& logEntry,
+									log_output& out)
 {
-	std::ostringstream s(std::ostringstream::out);
-	s << logEntry.ts << delim 
-		<< Logger::getLevelToken(logger.getLevel()) << delim 
-		<< logEntry.component << delim
-		<< logEntry.file << delim
-		<< logEntry.line << delim
-		<< logEntry.message << '\n';
+	out.append_uint(logEntry.ts.usec());
+	out.append(delim);
+	out.append(level_token(logEntry.level, false));
+	out.append(delim);
+	out.append(logEntry.component);
+	out.append(delim);
+	out.append(logEntry.file);
+	out.append(delim);
+	out.append_int(logEntry.line);
+	out.append(delim);
+	out.append(logEntry.message);
+	out.append('\n');
+}
 
-	return s.str();
+void JsonLoggerFormatter::append(const Logger& logger,
+								 const std::string& delim,
+								 const LogEntry& logEntry,
+								 log_output& out)
+{
+	out.append("{\"ts\":\"");
+	out.append_timestamp(logEntry.ts.usec());
+	out.append("\",\"level\":\"");
+	out.append(level_token(logEntry.level, false));
+	out.append("\",\"component\":\"");
+	out.append_json(logEntry.component);
+	out.append("\",\"file\":\"");
+	out.append_json(logEntry.file);
+	out.append("\",\"line\":");
+	out.append_int(logEntry.line);
+	out.append(",\"msg\":\"");
+	out.append_json(logEntry.message.data(), message_length(logEntry.message));
+	out.append("\"}\n");
+}
+
+void LogfmtLoggerFormatter::append(const Logger& logger,
+								   const std::string& delim,
+								   const LogEntry& logEntry,
+								   log_output& out)
+{
+	out.append("ts=");
+	out.append_timestamp(logEntry.ts.usec());
+	out.append(" level=");
+	out.append(level_token(logEntry.level, true));
+	out.append(" component=");
+	out.append_logfmt(logEntry.component);
+	out.append(" file=");
+	out.append_logfmt(logEntry.file);
+	out.append(" line=");
+	out.append_int(logEntry.line);
+	out.append(" msg=");
+	out.append_logfmt(logEntry.message.data(), message_length(logEntry.message));
+	out.append('\n');
 }
 
 //Logger implementation
 Logger::Logger() : 
-	m_stream(NULL), 
 	m_logLevel(LOG_LEVEL_WARN), 
+	m_delim(" "),
 	m_bRunning(false),
-	m_delim(" ")
+	m_rotatepos(0),
+	m_flush_bytes(DEFAULT_FLUSH_BYTES),
+	m_flush_usec(DEFAULT_FLUSH_USEC),
+	m_deferred(false)
 {
+	pthread_key_create(&m_ring_key, closeRing);
+	m_queue.set_wait_histogram(&s_queue_wait);
 }
 
 Logger::~Logger()
 {
 	stopQueue();
-	if (m_stream!=NULL)
-		fclose(m_stream);
+	m_writer.close();
 }
 
 std::string Logger::getLevelToken(Logger::LOGLEVEL level)
 {
-	switch (level)
-	{
-		case LOG_LEVEL_SILENT: return "SILENT"; break;
-		case LOG_LEVEL_FATAL: return "FATAL"; break;
-		case LOG_LEVEL_ERROR: return "ERROR"; break;
-		case LOG_LEVEL_WARN: return "WARN"; break;
-		case LOG_LEVEL_INFO: return "INFO"; break;
-		case LOG_LEVEL_DEBUG: return "DEBUG"; break;
-		case LOG_LEVEL_VERBOSE: return "VERBOSE"; break;
-		default:
-			return "UNDEFINED_LOG_LEVEL";
-	}	
+	return level_token(level, false);
 }
 
 int Logger::log(LOGLEVEL level, 
@@ -72,7 +178,7 @@ int Logger::log(LOGLEVEL level,
 {
 	va_list arglist;
 	va_start(arglist, fmt);
-	int ret = instance()._log(level, file, line, ts, component, fmt,arglist);
+	int ret = instance()._log(level, NULL, file, line, ts, component, fmt,arglist);
 	va_end(arglist);
 	return ret;
 }
@@ -81,17 +187,14 @@ void Logger::_setFileName(const std::string& name)
 {
 	stopQueue();
 
-	if (m_stream != NULL)
-		fclose(m_stream);
-
-	if ((m_stream = fopen(name.c_str(), "w+")) == NULL)
+	if (!m_writer.open(name))
 		fprintf(stderr, "couldn't open file for logging %s \n", name.c_str());
 
 	m_archivefmt = name;
 	m_filepath = name;
     size_t pos = name.rfind('/');
-	const char* logfname = (pos == std::string::npos) ? name.c_str() : name.substr(pos).c_str();
-    const char* logbase = strrchr(logfname,'.');
+	std::string logfname = (pos == std::string::npos) ? name : name.substr(pos);
+    const char* logbase = strrchr(logfname.c_str(),'.');
 
 	if (!logbase)
 		m_archivefmt += "-%s";
@@ -100,17 +203,70 @@ void Logger::_setFileName(const std::string& name)
 		int pos = m_archivefmt.find_last_of('.');
 		m_archivefmt.replace(pos, 1, "-%s.");
 	}
+	m_archiver.configure(m_archivefmt);
 
 	startQueue();
 }
 
 void Logger::_setRotationSize(long sz)
 {
-	scoped_lock lock(m_fop_mutex);
 	m_rotatepos = sz;
 }
 
+void Logger::_setLevel(LOGLEVEL level)
+{
+	scoped_lock lock(m_levels_mutex);
+	m_logLevel = level;
+	atomic_fetch_add(&s_generation, (uint64)1);
+}
+
+void Logger::_setComponentLevel(const std::string& component, LOGLEVEL level, bool set)
+{
+	scoped_lock lock(m_levels_mutex);
+	if (set)
+		m_component_levels[component] = level;
+	else
+		m_component_levels.erase(component);
+	atomic_fetch_add(&s_generation, (uint64)1);
+}
+
+Logger::LOGLEVEL Logger::componentLevel(const char* component)
+{
+	if (!m_component_levels.empty() && component)
+	{
+		std::map<std::string, LOGLEVEL>::const_iterator it = m_component_levels.find(component);
+		if (it != m_component_levels.end())
+			return it->second;
+	}
+	return m_logLevel;
+}
+
+Logger::LOGLEVEL Logger::_siteLevel(log_site* site, const char* component)
+{
+	scoped_lock lock(m_levels_mutex);
+
+	//read under the lock, a change after this bumps it again and the site
+	//comes back here
+	uint64 generation = atomic_load_relaxed(&s_generation);
+	LOGLEVEL level = componentLevel(component);
+
+	site->component = component;
+	atomic_store_relaxed(&site->filter, (generation << 8) | (uint64)(level + 1));
+	return level;
+}
+
+void Logger::_setDeferred(bool deferred)
+{
+	bool running = m_bRunning;
+	if (running)
+		stopQueue();
+	m_deferred = deferred;
+	if (running)
+		startQueue();
+}
+
 int Logger::_log(LOGLEVEL level,  
+				 log_site* site,
 				 const char* file, 
 				 int line, 
 				 const vodeox::time& ts, 
@@ -118,16 +274,49 @@ int Logger::_log(LOGLEVEL level,
 				 const char* fmt, 
 				 va_list arglist)
 {
-	std::string buf;
-	buf.resize(MAX_SNPRINTF_BUF_SIZE);
+	//the macros checked the site already
+	if (!site)
+	{
+		scoped_lock lock(m_levels_mutex);
+		if (level < componentLevel(component))
+			return -1;
+	}
 
-	if (level < m_logLevel) 
-		return -1;
+	log_format* deferred = (site && m_deferred) ? site_format(site, fmt) : NULL;
+	if (deferred)
+	{
+		log_format::capture args;
+		deferred->capture_args(arglist, args);
+
+		log_ring* ring = threadRing();
+		char* rec = ring->reserve(sizeof(deferred_record) + args.size);
+		if (!rec)
+			return -1;
+
+		deferred_record* r = (deferred_record*)rec;
+		r->level = level;
+		r->line = line;
+		r->format = deferred;
+		r->file = file;
+		r->component = component;
+		r->ts = ts.usec();
+		deferred->encode(args, rec + sizeof(deferred_record));
+		ring->commit(sizeof(deferred_record) + args.size);
+		return 0;
+	}
 	else
 	{
+		std::string buf;
+		buf.resize(MAX_SNPRINTF_BUF_SIZE);
+
 		int ret = vsnprintf(&buf[0], MAX_SNPRINTF_BUF_SIZE - 1, fmt, arglist);
-		LogEntry l_entry(file, line, component, ts, buf);
-		m_queue.push(l_entry);
+		buf.resize(ret < 0 ? 0 : std::min<size_t>(ret, MAX_SNPRINTF_BUF_SIZE - 2));
+		LogEntry l_entry(file, line, component, ts, buf, level);
+		if (!m_queue.try_push(l_entry))
+		{
+			s_queue_dropped.add();
+			return -1;
+		}
 		return ret;
 	}
 }
@@ -135,11 +324,17 @@ int Logger::_log(LOGLEVEL level,
 void Logger::startQueue()	
 {
 	m_bRunning = true;
-    vodeox::thread::start(reinterpret_cast<void*>(this));
+	m_queue.restart();
+	m_archiver.start();
+    //thread_function expects the thread base, which isn't at offset 0 here
+    vodeox::thread::start(static_cast<vodeox::thread*>(this));
 }
 
 void Logger::stopQueue()
 {
+	//nothing to join before the first setFileName
+	if (!m_bRunning)
+		return;
 	m_bRunning = false;
 	m_queue.shutdown();
 	join();
@@ -147,53 +342,80 @@ void Logger::stopQueue()
 	//clear the queue
 	std::vector<LogEntry> logEntries;
 	m_queue.pop(logEntries);
+	drainRings(logEntries);
 
 	format(logEntries);
+	m_writer.flush();
+
+	//whatever got rotated is compressed before we return
+	m_archiver.stop();
 }
 
 void Logger::rotateFile()
 {            
-	if (!m_stream)
+	if (!m_writer.is_open())
 		return;
 
 	if (m_rotatepos > 0)
 	{
-		fclose(m_stream);
 		char newname[MAX_PATH_LENGTH+1];
 		{
              struct tm t;
              time_t tt = ::time(NULL);
              localtime_r(&tt, &t);
              char dbuf[300];
-             strftime(dbuf, sizeof(dbuf), "%Y-%m-%d-%H%M%S",&t);
+             size_t len = strftime(dbuf, sizeof(dbuf), "%Y-%m-%d-%H%M%S",&t);
 
 			 snprintf(newname, sizeof(newname), m_archivefmt.c_str(), dbuf);
+
+			 //buffered writes can fill a file within a second, don't rename over
+			 //the previous archive, compressed or not
+			 std::string ext = log_archiver::extension();
+			 for (int seq = 1; access(newname, F_OK) == 0 || access((newname + ext).c_str(), F_OK) == 0; seq++)
+			 {
+				 snprintf(dbuf + len, sizeof(dbuf) - len, ".%d", seq);
+				 snprintf(newname, sizeof(newname), m_archivefmt.c_str(), dbuf);
+			 }
 		}
 
+		//rename under the open descriptor, the buffered tail still lands in the
+		//archive when open() closes it, and the new file is there right away
 		if (0 != rename(m_filepath.c_str(),newname))
+		{
 			fprintf(stderr, "coundn't rotate files from %s to %s, error = %d", m_filepath.c_str(), newname, errno);
-		m_stream = fopen(m_filepath.c_str(), "w+");
+			return;
+		}
+		if (!m_writer.open(m_filepath))
+			fprintf(stderr, "couldn't open file for logging %s \n", m_filepath.c_str());
+
+		//compression and retention happen off the logger thread
+		m_archiver.archive(newname);
 	}
 }
 
 void Logger::format(const std::vector<LogEntry>& entries)
 {
+	if (!m_formatter || !m_writer.is_open())
+		return;
+
 	for (unsigned int i = 0; i < entries.size(); i++)
-		if (m_formatter)
-		{
-			std::string message = m_formatter->format(*this, m_delim, entries[i]);
-			if (m_stream)
-			{
-				fprintf(m_stream, "%s\n", message.c_str());
-				fflush(m_stream);
+	{
+		//the formatter ends the line, and writes it into the buffer itself
+		log_output out(m_writer);
+		m_formatter->append(*this, m_delim, entries[i], out);
 
-				scoped_lock lock(m_fop_mutex);
+		//the writer knows the position, no need to flush to find out
+		if (m_rotatepos > 0 && m_writer.position() >= (uint64)m_rotatepos)
+			rotateFile();
+	}
+}
 
-				long  cur = ftell(m_stream);
-				if (cur >= m_rotatepos)
-					rotateFile();
-			}
-		}
+void Logger::flushIfDue(bool idle)
+{
+	//group commit, entries that arrived together go out with one write
+	if (idle || m_writer.pending() >= m_flush_bytes ||
+		vodeox::time::monotonic_ns() / 1000 - m_writer.last_flush() >= m_flush_usec)
+		m_writer.flush();
 }
 
 void Logger::run()
@@ -201,10 +423,107 @@ void Logger::run()
 	while (m_bRunning)
 	{
 		std::vector<LogEntry> logEntries;
-		m_queue.wait_and_pop(logEntries);
+		if (m_deferred)
+		{
+			//deferred writers never signal, that's the point, so poll
+			m_queue.pop(logEntries);
+			drainRings(logEntries);
+			if (logEntries.empty())
+			{
+				if (m_writer.pending())
+					flushIfDue(false);
+				usleep(DEFERRED_POLL_USEC);
+				continue;
+			}
+			format (logEntries);
+			flushIfDue(false);
+		}
+		else
+		{
+			m_queue.wait_and_pop(logEntries);
+			format (logEntries);
+
+			//nothing wakes us up to flush later, so flush before blocking
+			flushIfDue(m_queue.empty());
+		}
+	}
+}
+
+log_ring* Logger::threadRing()
+{
+	if (!s_thread_ring)
+	{
+		s_thread_ring = new log_ring();
+		pthread_setspecific(m_ring_key, s_thread_ring);
 
-		format (logEntries);
+		scoped_lock lock(m_rings_mutex);
+		m_rings.push_back(s_thread_ring);
 	}
+	return s_thread_ring;
+}
+
+void Logger::closeRing(void* ring)
+{
+	reinterpret_cast<log_ring*>(ring)->close();
+}
+
+/*
+ * Formats the records of one ring into log entries, on the logger thread
+ */
+struct record_reader
+{
+	std::vector<LogEntry>&	entries;
+	std::string				message;
+
+	record_reader(std::vector<LogEntry>& e) : entries(e) {}
+
+	void operator()(const char* rec, size_t len)
+	{
+		const deferred_record* r = (const deferred_record*)rec;
+		message.clear();
+		r->format->render(rec + sizeof(deferred_record), len - sizeof(deferred_record), message);
+		entries.push_back(LogEntry(r->file, r->line, r->component, vodeox::time(r->ts), message, r->level));
+	}
+};
+
+static bool earlier(const LogEntry& a, const LogEntry& b)
+{
+	return a.ts.usec() < b.ts.usec();
+}
+
+void Logger::drainRings(std::vector<LogEntry>& entries)
+{
+	std::vector<log_ring*> rings;
+	{
+		scoped_lock lock(m_rings_mutex);
+		rings = m_rings;
+	}
+
+	record_reader reader(entries);
+	for (size_t i = 0; i < rings.size(); i++)
+	{
+		//closed before draining, so whatever the thread left is read below
+		bool closed = rings[i]->closed();
+		rings[i]->consume(reader);
+
+		uint64 dropped = rings[i]->take_dropped();
+		if (dropped)
+		{
+			char buf[64];
+			snprintf(buf, sizeof(buf), "%llu log records dropped, ring full", (unsigned long long)dropped);
+			entries.push_back(LogEntry(__FILE__, __LINE__, "Logger", vodeox::time::now(), buf, LOG_LEVEL_WARN));
+		}
+
+		if (closed)
+		{
+			scoped_lock lock(m_rings_mutex);
+			m_rings.erase(std::find(m_rings.begin(), m_rings.end(), rings[i]));
+			delete rings[i];
+		}
+	}
+
+	//every ring is in order on its own, merge them by timestamp
+	std::stable_sort(entries.begin(), entries.end(), earlier);
 }
 
 } //namespace vodeox
@@ -1,6 +1,10 @@
 #ifndef __BASE_LOGGER_H
 #define __BASE_LOGGER_H
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <cstdio>
 #include <cstdarg>
 #include <cstring>
@@ -8,13 +12,20 @@
 
 #include <string>
 #include <queue>
+#include <map>
 
 #include <tr1/memory>
 #include <pthread.h>
 
 #include "base/scoped_lock.h"
 #include "base/time.h"
+#include "base/atomic.h"
 #include "base/concurrent_queue.h"
+#include "base/log_format.h"
+#include "base/log_ring.h"
+#include "base/log_writer.h"
+#include "base/log_archiver.h"
+#include "base/log_output.h"
 
 namespace vodeox
 {
@@ -31,15 +42,17 @@ struct LogEntry
 	std::string				 component;
     vodeox::time              ts;
 	std::string				 message;
+	int						 level;		//Logger::LOGLEVEL
 
-	LogEntry() {}
+	LogEntry() : line(0), level(-1) {}
 
 	LogEntry(const std::string& f, 
 			 int l, 
 			 const std::string& c, 
 			 const vodeox::time& t, 
-			 const std::string&  m) :
-	file(f), line(l), component(c), ts(t), message(m) {}
+			 const std::string&  m,
+			 int lv = -1) :
+	file(f), line(l), component(c), ts(t), message(m), level(lv) {}
 };
 
 
@@ -60,14 +73,24 @@ class Singleton
 };
 
 /*
- * An interface for formatting output in a logger
+ * An interface for formatting output in a logger. The logger calls append,
+ * which writes the line straight into the log buffer; format is there for
+ * formatters written before it. Each method defaults to the other one, a
+ * formatter has to implement at least one of them.
  */
 class LoggerFormatter
 {
 	public:
+		virtual ~LoggerFormatter() {}
+
 		virtual std::string  format(const Logger& logger, 
 									 const std::string& delim, 
-									 const LogEntry& logMessage) = 0;
+									 const LogEntry& logMessage);
+
+		virtual void append(const Logger& logger,
+							const std::string& delim,
+							const LogEntry& logMessage,
+							log_output& out);
 };
 
 /*
@@ -77,10 +100,37 @@ class LoggerFormatter
 class DefaultLoggerFormatter : public LoggerFormatter
 {
 	public:
-		virtual std::string  format(const Logger& logger, 
-									 const std::string& delim, 
-									 const LogEntry& logMessage);
+		virtual void append(const Logger& logger,
+							const std::string& delim,
+							const LogEntry& logMessage,
+							log_output& out);
+};
+
+/*
+ * One JSON object per line:
+ * {"ts":"2013-05-01T17:04:12.000345Z","level":"WARN","component":"net","file":"reactor.cpp","line":120,"msg":"..."}
+ * The delimiter is ignored, a trailing newline of the message is dropped.
+ */
+class JsonLoggerFormatter : public LoggerFormatter
+{
+	public:
+		virtual void append(const Logger& logger,
+							const std::string& delim,
+							const LogEntry& logMessage,
+							log_output& out);
+};
 
+/*
+ * logfmt key=value pairs, the same fields as JsonLoggerFormatter:
+ * ts=2013-05-01T17:04:12.000345Z level=warn component=net file=reactor.cpp line=120 msg="..."
+ */
+class LogfmtLoggerFormatter : public LoggerFormatter
+{
+	public:
+		virtual void append(const Logger& logger,
+							const std::string& delim,
+							const LogEntry& logMessage,
+							log_output& out);
 };
 
 
@@ -111,7 +161,33 @@ class Logger :  Singleton<Logger>, public vodeox::thread
 	    /**
 	     * Sets the logging level. All messages with lower priority will be ignored.
 	     */
-	    static void setLevel(LOGLEVEL level) { instance().m_logLevel = level; }
+	    static void setLevel(LOGLEVEL level) { instance()._setLevel(level); }
+
+	    /**
+	     * Overrides the level for one component, the name LOG_* calls pass in.
+	     */
+		static void setComponentLevel(const std::string& component, LOGLEVEL level)
+		{
+			instance()._setComponentLevel(component, level, true);
+		}
+
+		static void clearComponentLevel(const std::string& component)
+		{
+			instance()._setComponentLevel(component, LOG_LEVEL_SILENT, false);
+		}
+
+	    /**
+	     * Effective level for a call site, the LOG_* macros check it before they
+	     * take a timestamp or evaluate any argument. The site caches the result
+	     * until a level changes, so this is two loads and a compare.
+	     */
+		static LOGLEVEL siteLevel(log_site* site, const char* component)
+		{
+			uint64 cached = atomic_load_relaxed(&site->filter);
+			if ((cached >> 8) == atomic_load_relaxed(&s_generation) && site->component == component)
+				return (LOGLEVEL)((int)(cached & 0xff) - 1);
+			return instance()._siteLevel(site, component);
+		}
 
 	    /**
 	     * Gets the defaul logging level.
@@ -128,6 +204,50 @@ class Logger :  Singleton<Logger>, public vodeox::thread
 	     */
 		static void setRotationSize(long sz) { instance()._setRotationSize(sz); }
 
+	    /**
+	     * Rotated files are compressed on a background thread, on by default.
+	     * gzip when built with zlib, the built-in LZ format otherwise.
+	     */
+		static void setCompression(bool compress) { instance().m_archiver.set_compression(compress); }
+
+	    /**
+	     * Keeps at most maxFiles archives taking at most maxBytes, the oldest
+	     * go first. 0 means no limit, which is the default for both.
+	     */
+		static void setRetention(unsigned maxFiles, uint64 maxBytes)
+		{
+			instance().m_archiver.set_retention(maxFiles, maxBytes);
+		}
+
+	    /**
+	     * Deferred formatting: LOG_* calls copy the format pointer and the raw
+	     * arguments into a per-thread ring, vsnprintf runs on the logger thread.
+	     * Formats that can't be deferred and calls without a call site still take
+	     * the formatting path. Records that don't fit a full ring are dropped and
+	     * counted. Restarts the logger thread if it is running.
+	     */
+		static void setDeferred(bool deferred) { instance()._setDeferred(deferred); }
+
+	    /**
+	     * Entries are buffered and written in batches. The buffer is flushed
+	     * when it holds flushBytes, when flushUsec passed since the last flush,
+	     * and whenever the logger thread is about to go to sleep.
+	     */
+		static void setFlushPolicy(size_t flushBytes, uint64 flushUsec)
+		{
+			instance().m_flush_bytes = flushBytes;
+			instance().m_flush_usec = flushUsec;
+		}
+
+	    /**
+	     * fdatasync after every flush or at most once per interval, off by default
+	     */
+		static void setSyncPolicy(log_writer::SYNC_POLICY policy, uint64 intervalUsec = 0)
+		{
+			instance().m_writer.set_sync(policy, intervalUsec);
+		}
+		static bool getDeferred() { return instance().m_deferred; }
+
 	    /**
 	     * Log a message to a log file. The method returns immediately.
 		 * A timestamp of the log message is taken at a time when log method is being called
@@ -163,7 +283,15 @@ class Logger :  Singleton<Logger>, public vodeox::thread
 		{ \
 			va_list ap; \
 			va_start(ap, fmt); \
-			int ret = instance()._log(LEVEL, file, line, ts, component, fmt, ap); \
+			int ret = instance()._log(LEVEL, NULL, file, line, ts, component, fmt, ap); \
+			va_end(ap); \
+			return ret; \
+		} \
+        static int NAME(log_site* site, const char* file, int line, const vodeox::time& ts, const char* component, const char* fmt, ...) \
+		{ \
+			va_list ap; \
+			va_start(ap, fmt); \
+			int ret = instance()._log(LEVEL, site, file, line, ts, component, fmt, ap); \
 			va_end(ap); \
 			return ret; \
 		}
@@ -180,8 +308,14 @@ class Logger :  Singleton<Logger>, public vodeox::thread
 		
 		void _setFileName(const std::string& name);
 		void _setRotationSize(long sz);
+		void _setDeferred(bool deferred);
+		void _setLevel(LOGLEVEL level);
+		void _setComponentLevel(const std::string& component, LOGLEVEL level, bool set);
+		LOGLEVEL _siteLevel(log_site* site, const char* component);
+		LOGLEVEL componentLevel(const char* component);
 
 	    int _log(LOGLEVEL level, 
+				 log_site* site,
 				 const char* file, 
 				 int line, 
 				 const vodeox::time& ts, 
@@ -195,11 +329,17 @@ class Logger :  Singleton<Logger>, public vodeox::thread
 		void stopQueue();
 		void run();
 		void format(const std::vector<LogEntry>& entries);
+		void flushIfDue(bool idle);
+
+		log_ring* threadRing();
+		void drainRings(std::vector<LogEntry>& entries);
+		static void closeRing(void* ring);
 
 		void rotateFile();
 	private:
 
-	    FILE*								m_stream;
+	    log_writer							m_writer;
+	    log_archiver						m_archiver;
 	    LOGLEVEL							m_logLevel;
 		std::string							m_delim;
 
@@ -210,18 +350,95 @@ class Logger :  Singleton<Logger>, public vodeox::thread
 
 		std::string							m_archivefmt;
 		std::string							m_filepath;
-		long								m_rotatepos;
+		volatile long						m_rotatepos;
+		size_t								m_flush_bytes;
+		uint64								m_flush_usec;
+
 
-		mutable mutex				        m_fop_mutex;
+		//per component overrides, changes bump s_generation so sites refresh
+		mutex								m_levels_mutex;
+		std::map<std::string, LOGLEVEL>		m_component_levels;
+		static volatile uint64				s_generation;
+
+		//deferred mode, one ring per logging thread
+		volatile bool						m_deferred;
+		mutex								m_rings_mutex;
+		std::vector<log_ring*>				m_rings;
+		pthread_key_t						m_ring_key;
 };
 
-#define LOG_FATAL(component, ...)	Logger::fatal	(__FILE__,__LINE__, vodeox::time::now(), component, __VA_ARGS__)
-#define LOG_ERROR(component,...)	Logger::error	(__FILE__,__LINE__, vodeox::time::now(), component, __VA_ARGS__)
-#define LOG_WARN(component,...)		Logger::warning	(__FILE__,__LINE__, vodeox::time::now(), component,__VA_ARGS__)
-#define LOG_INFO(component,...)		Logger::info	(__FILE__,__LINE__, vodeox::time::now(), component,__VA_ARGS__)
-#define LOG_DEBUG(component,...)	Logger::debug	(__FILE__,__LINE__, vodeox::time::now(), component, __VA_ARGS__)
-#define LOG_VERBOSE(component,...)	Logger::verbose	(__FILE__,__LINE__, vodeox::time::now(), component, __VA_ARGS__)
-#define LOG_SILENT(component,...)	Logger::silent	(__FILE__,__LINE__, vodeox::time::now(), component, __VA_ARGS__)
+/*
+ * Levels as plain numbers for the preprocessor, they match Logger::LOGLEVEL.
+ * Calls below VODEOX_LOG_MIN_LEVEL compile to nothing, configure sets it with
+ * --with-log-level.
+ */
+#define VODEOX_LOG_LEVEL_VERBOSE	0
+#define VODEOX_LOG_LEVEL_DEBUG		1
+#define VODEOX_LOG_LEVEL_INFO		2
+#define VODEOX_LOG_LEVEL_WARN		3
+#define VODEOX_LOG_LEVEL_ERROR		4
+#define VODEOX_LOG_LEVEL_FATAL		5
+
+#ifndef VODEOX_LOG_MIN_LEVEL
+#define VODEOX_LOG_MIN_LEVEL		VODEOX_LOG_LEVEL_VERBOSE
+#endif
+
+/*
+ * Every call site carries a static log_site. Its cached level is checked
+ * before the timestamp and the arguments are evaluated, the deferred mode
+ * also caches the parsed format there.
+ */
+#define VODEOX_LOG_AT(NAME, LEVEL, component, ...) \
+	do { \
+		static vodeox::log_site vodeox_log_site_; \
+		if (Logger::LEVEL >= Logger::siteLevel(&vodeox_log_site_, component)) \
+			Logger::NAME(&vodeox_log_site_, __FILE__, __LINE__, vodeox::time::fast_now(), component, __VA_ARGS__); \
+	} while (0)
+
+//still type checked, but never called
+#define VODEOX_LOG_ELIDED(component, ...) \
+	do { \
+		if (0) \
+			Logger::silent(__FILE__, __LINE__, vodeox::time(), component, __VA_ARGS__); \
+	} while (0)
+
+#if VODEOX_LOG_MIN_LEVEL <= VODEOX_LOG_LEVEL_FATAL
+#define LOG_FATAL(component, ...)	VODEOX_LOG_AT(fatal, LOG_LEVEL_FATAL, component, __VA_ARGS__)
+#else
+#define LOG_FATAL(component, ...)	VODEOX_LOG_ELIDED(component, __VA_ARGS__)
+#endif
+
+#if VODEOX_LOG_MIN_LEVEL <= VODEOX_LOG_LEVEL_ERROR
+#define LOG_ERROR(component,...)	VODEOX_LOG_AT(error, LOG_LEVEL_ERROR, component, __VA_ARGS__)
+#else
+#define LOG_ERROR(component,...)	VODEOX_LOG_ELIDED(component, __VA_ARGS__)
+#endif
+
+#if VODEOX_LOG_MIN_LEVEL <= VODEOX_LOG_LEVEL_WARN
+#define LOG_WARN(component,...)		VODEOX_LOG_AT(warning, LOG_LEVEL_WARN, component, __VA_ARGS__)
+#else
+#define LOG_WARN(component,...)		VODEOX_LOG_ELIDED(component, __VA_ARGS__)
+#endif
+
+#if VODEOX_LOG_MIN_LEVEL <= VODEOX_LOG_LEVEL_INFO
+#define LOG_INFO(component,...)		VODEOX_LOG_AT(info, LOG_LEVEL_INFO, component, __VA_ARGS__)
+#else
+#define LOG_INFO(component,...)		VODEOX_LOG_ELIDED(component, __VA_ARGS__)
+#endif
+
+#if VODEOX_LOG_MIN_LEVEL <= VODEOX_LOG_LEVEL_DEBUG
+#define LOG_DEBUG(component,...)	VODEOX_LOG_AT(debug, LOG_LEVEL_DEBUG, component, __VA_ARGS__)
+#else
+#define LOG_DEBUG(component,...)	VODEOX_LOG_ELIDED(component, __VA_ARGS__)
+#endif
+
+#if VODEOX_LOG_MIN_LEVEL <= VODEOX_LOG_LEVEL_VERBOSE
+#define LOG_VERBOSE(component,...)	VODEOX_LOG_AT(verbose, LOG_LEVEL_VERBOSE, component, __VA_ARGS__)
+#else
+#define LOG_VERBOSE(component,...)	VODEOX_LOG_ELIDED(component, __VA_ARGS__)
+#endif
+
+#define LOG_SILENT(component,...)	VODEOX_LOG_AT(silent, LOG_LEVEL_SILENT, component, __VA_ARGS__)
 
 } //namespace vodeox
 
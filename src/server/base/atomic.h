@@ -0,0 +1,86 @@
+#ifndef __ATOMIC_H
+#define __ATOMIC_H
+
+#include <sched.h>
+
+namespace vodeox
+{
+
+/*
+ * Thin wrappers over the compiler's atomic builtins, loads acquire and stores
+ * release unless the name says otherwise.
+ */
+
+#define VODEOX_CACHE_LINE 64
+
+template<typename T>
+inline T atomic_load(const volatile T* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template<typename T>
+inline T atomic_load_relaxed(const volatile T* p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+template<typename T>
+inline void atomic_store(volatile T* p, T v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+template<typename T>
+inline void atomic_store_relaxed(volatile T* p, T v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+/*
+ * Weak compare and swap, on failure expected is updated with the current value.
+ */
+template<typename T>
+inline bool atomic_cas(volatile T* p, T& expected, T desired)
+{
+    return __atomic_compare_exchange_n(p, &expected, desired, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+template<typename T>
+inline T atomic_fetch_add(volatile T* p, T v)
+{
+    return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+
+template<typename T>
+inline T atomic_fetch_sub(volatile T* p, T v)
+{
+    return __atomic_fetch_sub(p, v, __ATOMIC_SEQ_CST);
+}
+
+template<typename T>
+inline T atomic_exchange(volatile T* p, T v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+inline void atomic_fence()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * Busy wait hint, lets the sibling hyperthread run while we spin
+ */
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+} //namespace vodeox
+
+#endif
@@ -0,0 +1,138 @@
+#include "config.h"
+
+#include "base/buffer.h"
+#include "base/slab.h"
+
+#include <string.h>
+
+namespace vodeox
+{
+
+static const size_t CHUNK_HEADER = offsetof(buffer_chunk, data);
+
+buffer_chunk* buffer_chunk::create(size_t capacity)
+{
+    //hand out the whole size class, slab_usable_size rounds up
+    size_t size = slab_usable_size(CHUNK_HEADER + capacity);
+    buffer_chunk* c = (buffer_chunk*)slab_allocate(size);
+    if (!c)
+        return NULL;
+    c->refs = 1;
+    c->capacity = size - CHUNK_HEADER;
+    return c;
+}
+
+void buffer_chunk::release()
+{
+    if (atomic_fetch_sub(&refs, 1) == 1)
+        slab_deallocate(this, CHUNK_HEADER + capacity);
+}
+
+buffer buffer::allocate(size_t len)
+{
+    buffer_chunk* c = buffer_chunk::create(len);
+    if (!c)
+        return buffer();
+    return buffer(c, 0, len);
+}
+
+buffer buffer::copy(const char* data, size_t len)
+{
+    buffer b = allocate(len);
+    if (b.m_chunk)
+        memcpy(b.mutable_data(), data, len);
+    return b;
+}
+
+buffer buffer::slice(size_t offset, size_t len) const
+{
+    if (offset > m_length)
+        offset = m_length;
+    if (len > m_length - offset)
+        len = m_length - offset;
+    if (!m_chunk || len == 0)
+        return buffer();
+
+    m_chunk->retain();
+    return buffer(m_chunk, m_offset + offset, len);
+}
+
+buffer buffer::split(size_t at)
+{
+    buffer front = slice(0, at);
+    trim_front(at);
+    return front;
+}
+
+void buffer::trim_front(size_t n)
+{
+    if (n > m_length)
+        n = m_length;
+    m_offset += n;
+    m_length -= n;
+}
+
+bool buffer::append(const char* data, size_t len)
+{
+    if (!unique() || tailroom() < len)
+        return false;
+    memcpy(m_chunk->data + m_offset + m_length, data, len);
+    m_length += len;
+    return true;
+}
+
+void buffer::swap(buffer& other)
+{
+    buffer_chunk* c = m_chunk;
+    size_t o = m_offset;
+    size_t l = m_length;
+    m_chunk = other.m_chunk;
+    m_offset = other.m_offset;
+    m_length = other.m_length;
+    other.m_chunk = c;
+    other.m_offset = o;
+    other.m_length = l;
+}
+
+bool buffer_chain::append(const buffer& b)
+{
+    if (b.empty())
+        return true;
+    if (m_count == MAX_PIECES)
+        return false;
+    m_pieces[m_count++] = b;
+    m_size += b.size();
+    return true;
+}
+
+unsigned int buffer_chain::to_iovec(struct iovec* iov) const
+{
+    for (unsigned int i = 0; i < m_count; i++)
+    {
+        iov[i].iov_base = (void*)m_pieces[i].data();
+        iov[i].iov_len = m_pieces[i].size();
+    }
+    return m_count;
+}
+
+size_t buffer_chain::copy_out(char* dst, size_t room) const
+{
+    size_t n = 0;
+    for (unsigned int i = 0; i < m_count && n < room; i++)
+    {
+        size_t len = m_pieces[i].size() < room - n ? m_pieces[i].size() : room - n;
+        memcpy(dst + n, m_pieces[i].data(), len);
+        n += len;
+    }
+    return n;
+}
+
+void buffer_chain::clear()
+{
+    for (unsigned int i = 0; i < m_count; i++)
+        m_pieces[i].reset();
+    m_count = 0;
+    m_size = 0;
+}
+
+} //namespace vodeox
@@ -0,0 +1,170 @@
+#ifndef __BASE_BUFFER_H
+#define __BASE_BUFFER_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "base/types.h"
+#include "base/atomic.h"
+#include "base/slab.h"
+
+namespace vodeox
+{
+
+/*
+ * Block of bytes shared by the buffers slicing it, allocated from the slab
+ * size classes together with this header
+ */
+struct buffer_chunk
+{
+    volatile int    refs;
+    size_t          capacity;
+    char            data[1];
+
+    static buffer_chunk* create(size_t capacity);
+
+    void retain() { atomic_fetch_add(&refs, 1); }
+    void release();
+};
+
+//largest buffer whose chunk, header included, still comes from a slab class
+static const size_t BUFFER_MAX_POOLED = SLAB_MAX_CLASS_SIZE - offsetof(buffer_chunk, data);
+
+/*
+ * Refcounted slice of a chunk. Copying, slicing and splitting a buffer only
+ * takes another reference, the bytes stay where they were received or built.
+ *
+ * Whoever allocates a chunk fills it through mutable_data() before handing
+ * slices out, from then on the bytes are read only and buffers can be passed
+ * between threads without any locking. A buffer object itself isn't thread
+ * safe, each thread works on its own copies.
+ */
+class buffer
+{
+ public:
+    buffer() : m_chunk(NULL), m_offset(0), m_length(0) {}
+
+    buffer(const buffer& other) :
+        m_chunk(other.m_chunk), m_offset(other.m_offset), m_length(other.m_length)
+    {
+        if (m_chunk)
+            m_chunk->retain();
+    }
+
+    ~buffer() { reset(); }
+
+    buffer& operator=(const buffer& other)
+    {
+        buffer tmp(other);
+        swap(tmp);
+        return *this;
+    }
+
+    /*
+     * Uninitialized bytes in a fresh chunk, empty if the allocation failed.
+     * The chunk may hold more than len, see tailroom().
+     */
+    static buffer allocate(size_t len);
+    static buffer copy(const char* data, size_t len);
+
+    const char* data() const { return m_chunk ? m_chunk->data + m_offset : NULL; }
+    char* mutable_data() { return m_chunk ? m_chunk->data + m_offset : NULL; }
+    size_t size() const { return m_length; }
+    bool empty() const { return m_length == 0; }
+
+    /*
+     * Shares the bytes [offset, offset + len), clamped to this slice
+     */
+    buffer slice(size_t offset, size_t len) const;
+
+    /*
+     * Returns the first at bytes and keeps the rest
+     */
+    buffer split(size_t at);
+
+    void trim_front(size_t n);
+    void truncate(size_t len) { if (len < m_length) m_length = len; }
+
+    /*
+     * No other buffer references the chunk
+     */
+    bool unique() const { return m_chunk && m_chunk->refs == 1; }
+
+    /*
+     * The chunk came from the slab rather than malloc
+     */
+    bool pooled() const { return m_chunk && m_chunk->capacity <= BUFFER_MAX_POOLED; }
+
+    /*
+     * Chunk bytes past the end of this slice
+     */
+    size_t tailroom() const { return m_chunk ? m_chunk->capacity - m_offset - m_length : 0; }
+
+    /*
+     * Grows the slice in place while it is the only reference to its chunk
+     * and the chunk has room, false otherwise
+     */
+    bool append(const char* data, size_t len);
+
+    void reset()
+    {
+        if (m_chunk)
+            m_chunk->release();
+        m_chunk = NULL;
+        m_offset = m_length = 0;
+    }
+
+    void swap(buffer& other);
+
+ private:
+    buffer(buffer_chunk* chunk, size_t offset, size_t len) :
+        m_chunk(chunk), m_offset(offset), m_length(len) {}
+
+ private:
+    buffer_chunk*   m_chunk;
+    size_t          m_offset;
+    size_t          m_length;
+};
+
+/*
+ * Scatter/gather view of up to MAX_PIECES buffers, e.g. a header built for
+ * a reply followed by a body sliced out of the datagram it answers
+ */
+class buffer_chain
+{
+ public:
+    enum { MAX_PIECES = 4 };
+
+    buffer_chain() : m_count(0), m_size(0) {}
+
+    /*
+     * False when the chain is full, empty buffers are skipped
+     */
+    bool append(const buffer& b);
+
+    unsigned int count() const { return m_count; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_count == 0; }
+    const buffer& piece(unsigned int i) const { return m_pieces[i]; }
+
+    /*
+     * Fills count() iovecs, returns the count
+     */
+    unsigned int to_iovec(struct iovec* iov) const;
+
+    /*
+     * Copies up to room bytes out, returns how many
+     */
+    size_t copy_out(char* dst, size_t room) const;
+
+    void clear();
+
+ private:
+    buffer          m_pieces[MAX_PIECES];
+    unsigned int    m_count;
+    size_t          m_size;
+};
+
+} //namespace vodeox
+
+#endif
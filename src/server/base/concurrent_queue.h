@@ -1,70 +1,291 @@
 #ifndef __COUNCURRENT_QUEUE_H
 #define __COUNCURRENT_QUEUE_H
 
+#include <stdlib.h>
+#include <stdio.h>
+#include <new>
 #include <vector>
-#include <queue>
 
+#include "base/atomic.h"
 #include "base/scoped_lock.h"
+#include "base/metrics.h"
+#include "base/time.h"
 
 namespace vodeox {
 
+static const size_t DEFAULT_QUEUE_CAPACITY = 4096;
+
 /*
- * concurrent queue implementation
-*/
+ * Bounded lock-free multi-producer/multi-consumer queue. Every slot carries a
+ * sequence number telling producers and consumers whose turn it is (Vyukov's
+ * bounded MPMC design), slots and the two cursors sit on their own cache lines.
+ *
+ * try_push/try_pop never block. push/wait_and_pop spin for a while and then
+ * park on a condition variable; the spin budget adapts to how often spinning
+ * actually paid off. The mutex is only touched by threads that park and by
+ * the threads waking them up.
+ *
+ * Data has to be default constructible and assignable, popped slots are reset
+ * to Data() so they don't keep references alive.
+ *
+ * With a wait histogram set, every entry is stamped on push and the time it
+ * spent queued is recorded when it is popped.
+ */
 template<typename Data>
 class concurrent_queue
 {
 private:
-    std::queue<Data>			m_queue;
+    struct cell
+    {
+        volatile size_t     sequence;
+        uint64              stamp;      //tsc_ns at push, 0 when not measured
+        Data                data;
+    } __attribute__((aligned(VODEOX_CACHE_LINE)));
+
+    enum
+    {
+        MIN_SPIN = 16,
+        MAX_SPIN = 4096
+    };
+
+    char                        m_pad0[VODEOX_CACHE_LINE];
+    volatile size_t             m_enqueue_pos;
+    char                        m_pad1[VODEOX_CACHE_LINE - sizeof(size_t)];
+    volatile size_t             m_dequeue_pos;
+    char                        m_pad2[VODEOX_CACHE_LINE - sizeof(size_t)];
+
+    cell*                       m_cells;
+    size_t                      m_mask;
+    histogram*                  m_wait;
+
+    volatile int                m_spin;
+    volatile int                m_empty_sleepers;
+    volatile int                m_full_sleepers;
+    volatile bool               m_shutdown;
+
     mutable vodeox::mutex		m_mutex;
-    vodeox::condition_variable	m_condition_variable;
-	bool						m_shutdown;
+    vodeox::condition_variable	m_not_empty;
+    vodeox::condition_variable	m_not_full;
+
 public:
-	
+    concurrent_queue(size_t capacity = DEFAULT_QUEUE_CAPACITY) :
+        m_enqueue_pos(0), m_dequeue_pos(0), m_wait(NULL), m_spin(MIN_SPIN * 4), m_empty_sleepers(0), m_full_sleepers(0), m_shutdown(false)
+    {
+        size_t n = 2;
+        while (n < capacity)
+            n <<= 1;
+
+        void* mem = NULL;
+        if (0 != posix_memalign(&mem, VODEOX_CACHE_LINE, n * sizeof(cell)))
+        {
+            fprintf(stderr, "couldn't allocate concurrent queue, aborting...");
+            abort();
+        }
+
+        m_cells = (cell*)mem;
+        for (size_t i = 0; i < n; i++)
+        {
+            new (&m_cells[i].data) Data();
+            m_cells[i].stamp = 0;
+            m_cells[i].sequence = i;
+        }
+        m_mask = n - 1;
+    }
+
+    ~concurrent_queue()
+    {
+        for (size_t i = 0; i <= m_mask; i++)
+            m_cells[i].data.~Data();
+        free(m_cells);
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    /*
+     * Set before the queue is used, NULL turns measuring off
+     */
+    void set_wait_histogram(histogram* h) { m_wait = h; }
+
+    bool try_push(Data const& data)
+    {
+        size_t pos = atomic_load_relaxed(&m_enqueue_pos);
+        for (;;)
+        {
+            cell& c = m_cells[pos & m_mask];
+            size_t seq = atomic_load(&c.sequence);
+            long diff = (long)seq - (long)pos;
+            if (diff == 0)
+            {
+                if (atomic_cas(&m_enqueue_pos, pos, pos + 1))
+                {
+                    c.data = data;
+                    c.stamp = m_wait ? vodeox::time::tsc_ns() : 0;
+                    atomic_store(&c.sequence, pos + 1);
+                    wake(m_not_empty, m_empty_sleepers);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;   //full
+            else
+                pos = atomic_load_relaxed(&m_enqueue_pos);
+        }
+    }
+
+    bool try_pop(Data& data)
+    {
+        size_t pos = atomic_load_relaxed(&m_dequeue_pos);
+        for (;;)
+        {
+            cell& c = m_cells[pos & m_mask];
+            size_t seq = atomic_load(&c.sequence);
+            long diff = (long)seq - (long)(pos + 1);
+            if (diff == 0)
+            {
+                if (atomic_cas(&m_dequeue_pos, pos, pos + 1))
+                {
+                    data = c.data;
+                    c.data = Data();
+                    if (c.stamp)
+                    {
+                        //stamped on another thread, the clock may have been re-anchored since
+                        uint64 now = vodeox::time::tsc_ns();
+                        m_wait->record(now > c.stamp ? now - c.stamp : 0);
+                    }
+                    atomic_store(&c.sequence, pos + m_mask + 1);
+                    wake(m_not_full, m_full_sleepers);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;   //empty
+            else
+                pos = atomic_load_relaxed(&m_dequeue_pos);
+        }
+    }
+
+    /*
+     * Blocks while the queue is full
+     */
     void push(Data const& data)
     {
-        scoped_lock lock(m_mutex);
-        m_queue.push(data);
-        lock.unlock();
-        m_condition_variable.notify();
+        while (!try_push(data))
+            wait_for(m_not_full, m_full_sleepers, true);
     }
 
     bool empty() const
     {
-        scoped_lock lock(m_mutex);
-        return m_queue.empty();
+        return atomic_load(&m_dequeue_pos) >= atomic_load(&m_enqueue_pos);
     }
 
+    /*
+     * Waits until there is at least one item or the queue is shut down,
+     * then takes everything that is available.
+     */
 	void wait_and_pop(std::vector<Data>& values)
     {
-        scoped_lock lock(m_mutex);
-        while(m_queue.empty())
+        for (;;)
         {
-            m_condition_variable.wait(m_mutex);
+            size_t before = values.size();
+            pop(values);
+            if (values.size() > before || atomic_load(&m_shutdown))
+                return;
+
+            wait_for(m_not_empty, m_empty_sleepers, false);
+        }
+    }
+
+    /*
+     * Waits for a single item, returns false if the queue was shut down
+     * before one showed up.
+     */
+    bool wait_and_pop(Data& value)
+    {
+        for (;;)
+        {
+            if (try_pop(value))
+                return true;
+            if (atomic_load(&m_shutdown))
+                return false;
+
+            wait_for(m_not_empty, m_empty_sleepers, false);
         }
-        
-		while(!m_queue.empty())
-		{
-	        values.push_back(m_queue.front());
-		    m_queue.pop();
-		}
     }
 
 	void pop(std::vector<Data>& values)
     {
-        scoped_lock lock(m_mutex);
-		while(!m_queue.empty())
-		{
-	        values.push_back(m_queue.front());
-		    m_queue.pop();
-		}
+        Data d;
+        while (try_pop(d))
+            values.push_back(d);
     }
 
+    /*
+     * Unblocks every waiting thread, wait_and_pop returns empty handed
+     * from now on until restart() is called.
+     */
 	void shutdown()
 	{
-		//unblock waiting thread
-        m_condition_variable.notify_all();
+        atomic_store(&m_shutdown, true);
+        scoped_lock lock(m_mutex);
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
 	}
+
+    void restart()
+    {
+        atomic_store(&m_shutdown, false);
+    }
+
+private:
+    bool ready(bool for_push) const
+    {
+        if (atomic_load(&m_shutdown))
+            return true;
+        return for_push ? !full() : !empty();
+    }
+
+    bool full() const
+    {
+        return atomic_load(&m_enqueue_pos) - atomic_load(&m_dequeue_pos) > m_mask;
+    }
+
+    /*
+     * Spin then park until the queue looks ready for the caller
+     */
+    void wait_for(vodeox::condition_variable& cond, volatile int& sleepers, bool for_push)
+    {
+        int spin = atomic_load_relaxed(&m_spin);
+        for (int i = 0; i < spin; i++)
+        {
+            if (ready(for_push))
+            {
+                //spinning paid off, allow a little more next time
+                if (spin < MAX_SPIN)
+                    atomic_store_relaxed(&m_spin, spin + spin / 8 + 1);
+                return;
+            }
+            cpu_relax();
+        }
+        if (spin > MIN_SPIN)
+            atomic_store_relaxed(&m_spin, spin - spin / 4);
+
+        scoped_lock lock(m_mutex);
+        //the increment is a full barrier, pairs with the fence in wake()
+        atomic_fetch_add(&sleepers, 1);
+        while (!ready(for_push))
+            cond.wait(m_mutex);
+        atomic_fetch_sub(&sleepers, 1);
+    }
+
+    void wake(vodeox::condition_variable& cond, volatile int& sleepers)
+    {
+        atomic_fence();
+        if (atomic_load_relaxed(&sleepers) > 0)
+        {
+            scoped_lock lock(m_mutex);
+            cond.notify();
+        }
+    }
 };
 
 } //namespace
@@ -0,0 +1,424 @@
+#ifndef __FUTURE_H
+#define __FUTURE_H
+
+#include <vector>
+
+#include "base/scoped_lock.h"
+#include "base/atomic.h"
+#include "base/task.h"
+#include "base/threadpool.h"
+
+namespace vodeox
+{
+
+/*
+ * One-shot value shared by a promise and its futures. Continuations that
+ * arrive before the value are parked on an intrusive task list and run by
+ * whoever fulfils the promise, the ones that arrive later run right away.
+ *
+ * Parked continuations hold futures on this very state, so once the last
+ * promise is gone without a value they are released instead of waiting for
+ * a destructor that their own references would keep from ever running.
+ */
+template<typename T>
+class future_state
+{
+ public:
+    future_state() : m_refs(1), m_promises(1), m_ready(0), m_waiting(NULL) {}
+
+    void retain() { atomic_fetch_add(&m_refs, 1); }
+
+    void add_promise() { atomic_fetch_add(&m_promises, 1); }
+
+    /*
+     * The last promise dropped without a value, its continuations never run
+     */
+    void drop_promise()
+    {
+        if (atomic_fetch_sub(&m_promises, 1) != 1)
+            return;
+
+        task* waiting;
+        {
+            scoped_lock lock(m_mutex);
+            waiting = m_waiting;
+            m_waiting = NULL;
+        }
+        release_tasks(waiting);
+    }
+
+    void release()
+    {
+        if (atomic_fetch_sub(&m_refs, 1) == 1)
+            delete this;
+    }
+
+    bool ready() const { return atomic_load(&m_ready) != 0; }
+
+    /*
+     * Stores the value and runs the parked continuations in the order they
+     * were attached, on the calling thread
+     */
+    void set(const T& value)
+    {
+        task* waiting;
+        {
+            scoped_lock lock(m_mutex);
+            if (ready())
+            {
+                fprintf(stderr, "future value set twice, aborting...");
+                abort();
+            }
+            m_value = value;
+            atomic_store(&m_ready, 1);
+            waiting = m_waiting;
+            m_waiting = NULL;
+            m_cond.notify_all();
+        }
+
+        task* ordered = NULL;
+        while (waiting)
+        {
+            task* t = waiting;
+            waiting = t->next();
+            t->set_next(ordered);
+            ordered = t;
+        }
+        while (ordered)
+        {
+            task* t = ordered;
+            ordered = t->next();
+            t->set_next(NULL);
+            t->run();
+        }
+    }
+
+    void attach(task* t)
+    {
+        if (!ready())
+        {
+            {
+                scoped_lock lock(m_mutex);
+                if (!ready() && atomic_load(&m_promises) != 0)
+                {
+                    t->set_next(m_waiting);
+                    m_waiting = t;
+                    return;
+                }
+            }
+            //nobody is left to fulfil it
+            if (!ready())
+            {
+                t->release();
+                return;
+            }
+        }
+        t->run();
+    }
+
+    const T& wait()
+    {
+        if (!ready())
+        {
+            scoped_lock lock(m_mutex);
+            while (!ready())
+                m_cond.wait(m_mutex);
+        }
+        return m_value;
+    }
+
+ private:
+    ~future_state() {}
+
+    static void release_tasks(task* t)
+    {
+        while (t)
+        {
+            task* next = t->next();
+            t->release();
+            t = next;
+        }
+    }
+
+    future_state(const future_state&);
+    future_state& operator=(const future_state&);
+
+ private:
+    volatile int                m_refs;
+    volatile int                m_promises;
+    volatile int                m_ready;
+    T                           m_value;
+    task*                       m_waiting;
+    vodeox::mutex               m_mutex;
+    vodeox::condition_variable  m_cond;
+};
+
+template<typename T> class promise;
+template<typename T> class future;
+
+template<typename T>
+future<std::vector<T> > when_all(const std::vector<future<T> >& inputs);
+
+/*
+ * Read side of a promise. Futures are cheap refcounted handles, copies share
+ * the same value.
+ *
+ * Continuations are function objects with a "result_type" typedef and a
+ * result_type operator()(const T&), e.g. derived from std::unary_function.
+ * then() returns a future of the continuation's result, so pipelines can be
+ * chained without blocking a worker. T has to be default constructible and
+ * copyable.
+ */
+template<typename T>
+class future
+{
+ public:
+    typedef T value_type;
+
+    future() : m_state(NULL) {}
+    future(const future& other) : m_state(other.m_state) { if (m_state) m_state->retain(); }
+    ~future() { if (m_state) m_state->release(); }
+
+    future& operator=(const future& other)
+    {
+        if (other.m_state)
+            other.m_state->retain();
+        if (m_state)
+            m_state->release();
+        m_state = other.m_state;
+        return *this;
+    }
+
+    bool valid() const { return m_state != NULL; }
+    bool ready() const { return m_state && m_state->ready(); }
+
+    /*
+     * Blocks until the value is there. Calling it on a worker for a value
+     * that the same pool still has to compute can deadlock a small pool,
+     * chain with then() instead.
+     */
+    const T& get() const { return m_state->wait(); }
+
+    /*
+     * Runs f on whatever thread fulfils the promise, or right away when the
+     * value is already there. Meant for short continuations.
+     */
+    template<typename F>
+    future<typename F::result_type> then(const F& f) const;
+
+    /*
+     * Schedules f onto the pool once the value is there. A value that is
+     * already there skips the hop and f runs inline on the caller.
+     */
+    template<typename F>
+    future<typename F::result_type> then(Threadpool& pool, const F& f) const;
+
+ private:
+    explicit future(future_state<T>* state) : m_state(state) {}
+
+    friend class promise<T>;
+    template<typename U> friend class future;
+    template<typename U> friend future<std::vector<U> > when_all(const std::vector<future<U> >&);
+
+    future_state<T>*    m_state;
+};
+
+/*
+ * Write side, set_value() may be called once
+ */
+template<typename T>
+class promise
+{
+ public:
+    promise() : m_state(new future_state<T>()) {}
+    promise(const promise& other) : m_state(other.m_state)
+    {
+        m_state->retain();
+        m_state->add_promise();
+    }
+
+    ~promise()
+    {
+        m_state->drop_promise();
+        m_state->release();
+    }
+
+    promise& operator=(const promise& other)
+    {
+        other.m_state->retain();
+        other.m_state->add_promise();
+        m_state->drop_promise();
+        m_state->release();
+        m_state = other.m_state;
+        return *this;
+    }
+
+    future<T> get_future() const
+    {
+        m_state->retain();
+        return future<T>(m_state);
+    }
+
+    void set_value(const T& value) const { m_state->set(value); }
+
+ private:
+    future_state<T>*    m_state;
+};
+
+template<typename T>
+future<T> make_ready_future(const T& value)
+{
+    promise<T> p;
+    p.set_value(value);
+    return p.get_future();
+}
+
+namespace detail
+{
+
+template<typename T, typename F>
+struct then_call
+{
+    typedef typename F::result_type R;
+
+    future<T>   source;
+    promise<R>  result;
+    F           fn;
+
+    then_call(const future<T>& s, const promise<R>& r, const F& f) : source(s), result(r), fn(f) {}
+    void operator()() { result.set_value(fn(source.get())); }
+};
+
+template<typename F>
+struct async_call
+{
+    typedef typename F::result_type R;
+
+    promise<R>  result;
+    F           fn;
+
+    async_call(const promise<R>& r, const F& f) : result(r), fn(f) {}
+    void operator()() { result.set_value(fn()); }
+};
+
+//first stage of a pool continuation, runs on the fulfilling thread and
+//only moves the real work onto the pool
+template<typename C>
+struct pool_hop
+{
+    Threadpool* pool;
+    C           call;
+
+    pool_hop(Threadpool* p, const C& c) : pool(p), call(c) {}
+    void operator()() { pool->submit(call); }
+};
+
+template<typename T>
+class join_state
+{
+ public:
+    join_state(size_t n) : m_refs(1), m_left((int)n), m_values(n) {}
+
+    void retain() { atomic_fetch_add(&m_refs, 1); }
+
+    void release()
+    {
+        if (atomic_fetch_sub(&m_refs, 1) == 1)
+            delete this;
+    }
+
+    void set(size_t i, const T& value)
+    {
+        m_values[i] = value;
+        //the last one to arrive publishes, the decrement orders the stores
+        if (atomic_fetch_sub(&m_left, 1) == 1)
+            m_result.set_value(m_values);
+    }
+
+    future<std::vector<T> > get_future() const { return m_result.get_future(); }
+
+ private:
+    volatile int                m_refs;
+    volatile int                m_left;
+    std::vector<T>              m_values;
+    promise<std::vector<T> >    m_result;
+};
+
+template<typename T>
+struct join_call
+{
+    future<T>       source;
+    join_state<T>*  state;
+    size_t          index;
+
+    join_call(const future<T>& s, join_state<T>* j, size_t i) : source(s), state(j), index(i) { state->retain(); }
+    join_call(const join_call& o) : source(o.source), state(o.state), index(o.index) { state->retain(); }
+    ~join_call() { state->release(); }
+    void operator()() { state->set(index, source.get()); }
+
+ private:
+    join_call& operator=(const join_call&);
+};
+
+} //namespace detail
+
+template<typename T>
+template<typename F>
+future<typename F::result_type> future<T>::then(const F& f) const
+{
+    typedef typename F::result_type R;
+
+    promise<R> p;
+    m_state->attach(task::create(detail::then_call<T, F>(*this, p, f)));
+    return p.get_future();
+}
+
+template<typename T>
+template<typename F>
+future<typename F::result_type> future<T>::then(Threadpool& pool, const F& f) const
+{
+    typedef typename F::result_type R;
+
+    promise<R> p;
+    detail::then_call<T, F> call(*this, p, f);
+    if (ready())
+        call();
+    else
+        m_state->attach(task::create(detail::pool_hop<detail::then_call<T, F> >(&pool, call)));
+    return p.get_future();
+}
+
+/*
+ * Runs a nullary function object with a "result_type" typedef on the pool
+ */
+template<typename F>
+future<typename F::result_type> async(Threadpool& pool, const F& f)
+{
+    typedef typename F::result_type R;
+
+    promise<R> p;
+    pool.submit(detail::async_call<F>(p, f));
+    return p.get_future();
+}
+
+/*
+ * Fan-in, the returned future holds the values in input order once all of
+ * the inputs are there. Whichever input arrives last fulfils it inline.
+ */
+template<typename T>
+future<std::vector<T> > when_all(const std::vector<future<T> >& inputs)
+{
+    if (inputs.empty())
+        return make_ready_future(std::vector<T>());
+
+    detail::join_state<T>* join = new detail::join_state<T>(inputs.size());
+    future<std::vector<T> > result = join->get_future();
+    for (size_t i = 0; i < inputs.size(); i++)
+        inputs[i].m_state->attach(task::create(detail::join_call<T>(inputs[i], join, i)));
+    join->release();
+    return result;
+}
+
+} //namespace vodeox
+
+#endif
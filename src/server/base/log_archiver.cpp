@@ -0,0 +1,265 @@
+#include "config.h"
+
+#include "base/log_archiver.h"
+#include "base/lz.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+
+#include <vector>
+#include <algorithm>
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#define VODEOX_ARCHIVE_GZIP 1
+#endif
+
+namespace vodeox
+{
+
+static const char* TMP_SUFFIX = ".tmp";
+
+static uint64 mtime_usec(const struct stat& st)
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    return (uint64)st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#else
+    return (uint64)st.st_mtime * 1000000;
+#endif
+}
+
+struct archive_file
+{
+    std::string     path;
+    uint64          mtime;  //usec
+    uint64          size;
+
+    bool operator<(const archive_file& other) const
+    {
+        if (mtime != other.mtime)
+            return mtime < other.mtime;
+        //same tick, rotation numbers .N count up from the bare timestamp
+        if (path.size() != other.path.size())
+            return path.size() < other.path.size();
+        return path < other.path;
+    }
+};
+
+static bool ends_with(const std::string& s, size_t end, const std::string& suffix)
+{
+    return end >= suffix.size() && s.compare(end - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+log_archiver::log_archiver() :
+    m_paths(DEFAULT_ARCHIVE_QUEUE),
+    m_running(false),
+    m_compress(true),
+    m_max_files(0),
+    m_max_bytes(0)
+{
+}
+
+log_archiver::~log_archiver()
+{
+    stop();
+}
+
+const char* log_archiver::extension()
+{
+#ifdef VODEOX_ARCHIVE_GZIP
+    return ".gz";
+#else
+    return ".lz";
+#endif
+}
+
+void log_archiver::configure(const std::string& fmt)
+{
+    size_t slash = fmt.rfind('/');
+    m_dir = (slash == std::string::npos) ? "." : fmt.substr(0, slash ? slash : 1);
+
+    std::string name = (slash == std::string::npos) ? fmt : fmt.substr(slash + 1);
+    size_t pos = name.find("%s");
+    m_prefix = name.substr(0, pos);
+    m_suffix = (pos == std::string::npos) ? std::string() : name.substr(pos + 2);
+}
+
+void log_archiver::start()
+{
+    if (m_running)
+        return;
+    m_running = true;
+    m_paths.restart();
+    vodeox::thread::start(static_cast<vodeox::thread*>(this));
+}
+
+void log_archiver::stop()
+{
+    if (!m_running)
+        return;
+    m_running = false;
+    m_paths.shutdown();
+    join();
+}
+
+bool log_archiver::archive(const std::string& path)
+{
+    if (!m_running || !m_paths.try_push(path))
+    {
+        fprintf(stderr, "log archiver is behind, %s left uncompressed\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void log_archiver::run()
+{
+    //wait_and_pop keeps handing out what's queued after shutdown
+    std::string path;
+    while (m_paths.wait_and_pop(path))
+    {
+        if (m_compress)
+            compress(path);
+        prune();
+    }
+}
+
+bool log_archiver::compress(const std::string& path)
+{
+    std::string target = path + extension();
+    std::string tmp = target + TMP_SUFFIX;
+
+    struct stat st;
+    int in = open(path.c_str(), O_RDONLY);
+    if (in < 0 || fstat(in, &st) != 0)
+    {
+        //retention may have got to it first
+        if (errno != ENOENT)
+            fprintf(stderr, "couldn't open %s for compression, error = %d\n", path.c_str(), errno);
+        if (in >= 0)
+            close(in);
+        return false;
+    }
+
+    bool ok = true;
+#ifdef VODEOX_ARCHIVE_GZIP
+    //level 6 is zlib's default, logs compress well at any level
+    gzFile out = gzopen(tmp.c_str(), "wb6");
+    if (!out)
+        ok = false;
+    else
+    {
+        std::vector<char> buf(LZ_FILE_BLOCK);
+        for (;;)
+        {
+            ssize_t n = read(in, &buf[0], buf.size());
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                ok = (n == 0);
+                break;
+            }
+            if (gzwrite(out, &buf[0], (unsigned)n) != (int)n)
+            {
+                ok = false;
+                break;
+            }
+        }
+        if (gzclose(out) != Z_OK)
+            ok = false;
+    }
+#else
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+        ok = false;
+    else
+    {
+        ok = lz_compress_file(in, out);
+        if (close(out) != 0)
+            ok = false;
+    }
+#endif
+    close(in);
+
+    if (ok)
+    {
+        //keep the archive's time, retention orders by it
+        uint64 mtime = mtime_usec(st);
+        struct timeval times[2];
+        times[0].tv_sec = times[1].tv_sec = mtime / 1000000;
+        times[0].tv_usec = times[1].tv_usec = mtime % 1000000;
+        utimes(tmp.c_str(), times);
+        ok = (rename(tmp.c_str(), target.c_str()) == 0);
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "couldn't compress %s, error = %d\n", path.c_str(), errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    unlink(path.c_str());
+    return true;
+}
+
+void log_archiver::prune()
+{
+    unsigned max_files = m_max_files;
+    uint64 max_bytes = m_max_bytes;
+    if (max_files == 0 && max_bytes == 0)
+        return;
+
+    DIR* dir = opendir(m_dir.c_str());
+    if (!dir)
+        return;
+
+    std::string ext = extension();
+    std::vector<archive_file> files;
+    struct dirent* e;
+    while ((e = readdir(dir)) != NULL)
+    {
+        std::string name = e->d_name;
+        if (name.compare(0, m_prefix.size(), m_prefix) != 0 || ends_with(name, name.size(), TMP_SUFFIX))
+            continue;
+
+        //either compressed or not yet
+        size_t end = name.size();
+        if (ends_with(name, end, ext) && end - ext.size() >= m_prefix.size() + m_suffix.size())
+            end -= ext.size();
+        if (end <= m_prefix.size() + m_suffix.size() || !ends_with(name, end, m_suffix))
+            continue;
+
+        archive_file f;
+        f.path = m_dir + "/" + name;
+        struct stat st;
+        if (stat(f.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        f.mtime = mtime_usec(st);
+        f.size = st.st_size;
+        files.push_back(f);
+    }
+    closedir(dir);
+
+    //newest first, keep them until a limit is hit
+    std::sort(files.begin(), files.end());
+    std::reverse(files.begin(), files.end());
+
+    uint64 total = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        total += files[i].size;
+        bool over = (max_files && i >= max_files) || (max_bytes && total > max_bytes);
+        if (over && unlink(files[i].path.c_str()) != 0)
+            fprintf(stderr, "couldn't remove old log %s, error = %d\n", files[i].path.c_str(), errno);
+    }
+}
+
+} //namespace vodeox
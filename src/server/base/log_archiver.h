@@ -0,0 +1,92 @@
+#ifndef __BASE_LOG_ARCHIVER_H
+#define __BASE_LOG_ARCHIVER_H
+
+#include <string>
+
+#include "base/types.h"
+#include "base/scoped_lock.h"
+#include "base/concurrent_queue.h"
+
+namespace vodeox
+{
+
+static const size_t DEFAULT_ARCHIVE_QUEUE = 64;
+
+/*
+ * Background half of log rotation. The logger thread renames the full file
+ * and hands the archive's path over here, this thread compresses it and
+ * prunes old archives, so rotation costs the logger a rename and an open.
+ *
+ * Archives are gzipped when built with zlib, otherwise packed with the
+ * built-in LZ codec into a .lz file (see lz.h). The compressed copy is
+ * written next to the archive under a .tmp name and renamed when complete,
+ * the original is only removed after that; if anything fails the archive
+ * stays uncompressed.
+ *
+ * Retention looks at every file matching the archive name pattern, with or
+ * without a compression suffix, and deletes the oldest ones once there are
+ * more than max_files of them or they take more than max_bytes; 0 means
+ * no limit.
+ */
+class log_archiver : public vodeox::thread
+{
+ public:
+    log_archiver();
+    virtual ~log_archiver();
+
+    /*
+     * Archive names are made from fmt by replacing its %s with a timestamp
+     */
+    void configure(const std::string& fmt);
+
+    void set_compression(bool compress) { m_compress = compress; }
+    bool compression() const { return m_compress; }
+
+    void set_retention(unsigned max_files, uint64 max_bytes)
+    {
+        m_max_files = max_files;
+        m_max_bytes = max_bytes;
+    }
+
+    void start();
+
+    /*
+     * Finishes the queued archives and joins the thread
+     */
+    void stop();
+
+    /*
+     * Queues a rotated file, false if the queue is full and the file is
+     * left alone
+     */
+    bool archive(const std::string& path);
+
+    /*
+     * Suffix compressed archives get
+     */
+    static const char* extension();
+
+ private:
+    void run();
+    bool compress(const std::string& path);
+    void prune();
+
+    log_archiver(const log_archiver&);
+    log_archiver& operator=(const log_archiver&);
+
+ private:
+    concurrent_queue<std::string>   m_paths;
+    volatile bool                   m_running;
+
+    std::string                     m_dir;
+    std::string                     m_prefix;   //file name up to the %s
+    std::string                     m_suffix;   //and after it
+
+    volatile bool                   m_compress;
+    volatile unsigned               m_max_files;
+    volatile uint64                 m_max_bytes;
+};
+
+} //namespace vodeox
+
+#endif
@@ -0,0 +1,401 @@
+#include "config.h"
+
+#include "base/log_format.h"
+#include "base/atomic.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+namespace vodeox
+{
+
+//longer string arguments are cut, the eager path caps whole messages at 2k
+static const size_t MAX_STRING_ARG = 1024;
+
+static const size_t SLOT_SIZE = 8;
+
+static size_t slot_size(log_format::ARG_KIND kind)
+{
+    return kind == log_format::ARG_LDOUBLE ? 2 * SLOT_SIZE : SLOT_SIZE;
+}
+
+static size_t round_slot(size_t n)
+{
+    return (n + SLOT_SIZE - 1) & ~(SLOT_SIZE - 1);
+}
+
+log_format* log_format::parse(const char* fmt)
+{
+    log_format* f = new log_format(fmt);
+    std::string literal;
+    const char* p = fmt;
+
+    while (*p)
+    {
+        if (*p != '%')
+        {
+            literal += *p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            literal += "%%";
+            p += 2;
+            continue;
+        }
+
+        const char* start = p++;
+        segment s;
+        s.stars = 0;
+        s.precision = -1;
+        bool precision_star = false;
+
+        while (*p && strchr("-+ #0'I", *p))
+            p++;
+        if (*p == '*')
+        {
+            s.stars++;
+            p++;
+        }
+        else
+            while (*p >= '0' && *p <= '9')
+                p++;
+        if (*p == '.')
+        {
+            p++;
+            if (*p == '*')
+            {
+                s.stars++;
+                precision_star = true;
+                p++;
+            }
+            else
+            {
+                s.precision = 0;
+                while (*p >= '0' && *p <= '9')
+                    s.precision = s.precision * 10 + (*p++ - '0');
+            }
+        }
+
+        //length modifier, 0 none, 'H' hh, 'h', 'l', 'q' ll, 'j', 'z', 't', 'L'
+        char length = 0;
+        if (p[0] == 'h' && p[1] == 'h') { length = 'H'; p += 2; }
+        else if (p[0] == 'l' && p[1] == 'l') { length = 'q'; p += 2; }
+        else if (*p && strchr("hlqjztL", *p)) length = *p++;
+
+        bool ok = true;
+        switch (*p)
+        {
+        case 'd': case 'i':
+            switch (length)
+            {
+            case 'l': s.kind = ARG_LONG; break;
+            case 'q': s.kind = ARG_LLONG; break;
+            case 'j': s.kind = ARG_INTMAX; break;
+            case 'z': s.kind = ARG_SIZE; break;
+            case 't': s.kind = ARG_PTRDIFF; break;
+            default:  s.kind = ARG_INT; break;
+            }
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            switch (length)
+            {
+            case 'l': s.kind = ARG_ULONG; break;
+            case 'q': s.kind = ARG_ULLONG; break;
+            case 'j': s.kind = ARG_INTMAX; break;
+            case 'z': s.kind = ARG_SIZE; break;
+            case 't': s.kind = ARG_PTRDIFF; break;
+            default:  s.kind = ARG_UINT; break;
+            }
+            break;
+        case 'c':
+            s.kind = ARG_INT;
+            ok = length != 'l';
+            break;
+        case 'e': case 'E': case 'f': case 'F':
+        case 'g': case 'G': case 'a': case 'A':
+            s.kind = length == 'L' ? ARG_LDOUBLE : ARG_DOUBLE;
+            break;
+        case 's':
+            s.kind = ARG_STRING;
+            ok = length == 0;
+            break;
+        case 'p':
+            s.kind = ARG_POINTER;
+            break;
+        default:
+            //%n, %m, wide characters and anything we don't know about
+            ok = false;
+            break;
+        }
+
+        f->m_args += s.stars + 1;
+        if (!ok || f->m_args > MAX_ARGS)
+        {
+            delete f;
+            return NULL;
+        }
+
+        //a star precision travels as the last star
+        if (precision_star)
+            s.precision = -2;
+
+        p++;
+        s.spec = literal + std::string(start, p - start);
+        literal.clear();
+        f->m_segments.push_back(s);
+    }
+
+    for (size_t i = 0; i < literal.size(); i++)
+    {
+        f->m_tail += literal[i];
+        if (literal[i] == '%')
+            i++;
+    }
+    return f;
+}
+
+void log_format::capture_args(va_list ap, capture& c) const
+{
+    int k = 0;
+    c.size = 0;
+
+    for (size_t i = 0; i < m_segments.size(); i++)
+    {
+        const segment& s = m_segments[i];
+        for (int j = 0; j < s.stars; j++)
+        {
+            c.values[k++].i = va_arg(ap, int);
+            c.size += SLOT_SIZE;
+        }
+
+        capture::slot& v = c.values[k];
+        switch (s.kind)
+        {
+        case ARG_INT:       v.i = va_arg(ap, int); break;
+        case ARG_UINT:      v.i = va_arg(ap, unsigned int); break;
+        case ARG_LONG:      v.i = va_arg(ap, long); break;
+        case ARG_ULONG:     v.i = va_arg(ap, unsigned long); break;
+        case ARG_LLONG:     v.i = va_arg(ap, long long); break;
+        case ARG_ULLONG:    v.i = va_arg(ap, unsigned long long); break;
+        case ARG_SIZE:      v.i = va_arg(ap, size_t); break;
+        case ARG_PTRDIFF:   v.i = va_arg(ap, ptrdiff_t); break;
+        case ARG_INTMAX:    v.i = va_arg(ap, intmax_t); break;
+        case ARG_DOUBLE:    v.d = va_arg(ap, double); break;
+        case ARG_LDOUBLE:   v.ld = va_arg(ap, long double); break;
+        case ARG_POINTER:   v.p = va_arg(ap, void*); break;
+        case ARG_STRING:
+        {
+            const char* str = va_arg(ap, const char*);
+            if (!str)
+                str = "(null)";
+
+            //a precision may be all that keeps us inside the buffer
+            size_t max = MAX_STRING_ARG;
+            if (s.precision >= 0 && (size_t)s.precision < max)
+                max = s.precision;
+            else if (s.precision == -2 && c.values[k - 1].i >= 0 && (size_t)c.values[k - 1].i < max)
+                max = c.values[k - 1].i;
+
+            size_t len = 0;
+            while (len < max && str[len])
+                len++;
+            v.p = str;
+            c.lengths[k] = len;
+            c.size += SLOT_SIZE + round_slot(len);
+            k++;
+            continue;
+        }
+        }
+        c.size += slot_size(s.kind);
+        k++;
+    }
+}
+
+void log_format::encode(const capture& c, char* out) const
+{
+    int k = 0;
+
+    for (size_t i = 0; i < m_segments.size(); i++)
+    {
+        const segment& s = m_segments[i];
+        for (int j = 0; j < s.stars; j++, k++)
+        {
+            memcpy(out, &c.values[k].i, SLOT_SIZE);
+            out += SLOT_SIZE;
+        }
+
+        const capture::slot& v = c.values[k];
+        switch (s.kind)
+        {
+        case ARG_STRING:
+        {
+            uint64 len = c.lengths[k];
+            memcpy(out, &len, SLOT_SIZE);
+            memcpy(out + SLOT_SIZE, v.p, len);
+            out += SLOT_SIZE + round_slot(len);
+            break;
+        }
+        case ARG_LDOUBLE:
+            memcpy(out, &v.ld, sizeof(v.ld));
+            out += slot_size(s.kind);
+            break;
+        case ARG_DOUBLE:
+            memcpy(out, &v.d, SLOT_SIZE);
+            out += SLOT_SIZE;
+            break;
+        case ARG_POINTER:
+            memcpy(out, &v.p, sizeof(v.p));
+            out += SLOT_SIZE;
+            break;
+        default:
+            memcpy(out, &v.i, SLOT_SIZE);
+            out += SLOT_SIZE;
+            break;
+        }
+        k++;
+    }
+}
+
+/*
+ * snprintf with 0, 1 or 2 star ints in front of the value, appends to out
+ */
+template<typename T>
+static int format_one(char* dst, size_t room, const char* spec, int stars, const int* star, T value)
+{
+    switch (stars)
+    {
+    case 0:  return snprintf(dst, room, spec, value);
+    case 1:  return snprintf(dst, room, spec, star[0], value);
+    default: return snprintf(dst, room, spec, star[0], star[1], value);
+    }
+}
+
+template<typename T>
+static void append(std::string& out, const char* spec, int stars, const int* star, T value)
+{
+    char buf[256];
+    int n = format_one(buf, sizeof(buf), spec, stars, star, value);
+    if (n < 0)
+        return;
+    if ((size_t)n < sizeof(buf))
+    {
+        out.append(buf, n);
+        return;
+    }
+
+    //too long for the stack buffer, format straight into the string
+    size_t at = out.size();
+    out.resize(at + n + 1);
+    format_one(&out[at], n + 1, spec, stars, star, value);
+    out.resize(at + n);
+}
+
+void log_format::render(const char* data, size_t len, std::string& out) const
+{
+    const char* end = data + len;
+
+    for (size_t i = 0; i < m_segments.size(); i++)
+    {
+        const segment& s = m_segments[i];
+        const char* spec = s.spec.c_str();
+        int star[2] = { 0, 0 };
+        long long v;
+
+        for (int j = 0; j < s.stars; j++)
+        {
+            memcpy(&v, data, SLOT_SIZE);
+            star[j] = (int)v;
+            data += SLOT_SIZE;
+        }
+        if (data + slot_size(s.kind) > end)
+            return;
+
+        switch (s.kind)
+        {
+        case ARG_STRING:
+        {
+            uint64 n;
+            memcpy(&n, data, SLOT_SIZE);
+            std::string str(data + SLOT_SIZE, n);
+            append(out, spec, s.stars, star, str.c_str());
+            data += SLOT_SIZE + round_slot(n);
+            continue;
+        }
+        case ARG_DOUBLE:
+        {
+            double d;
+            memcpy(&d, data, SLOT_SIZE);
+            append(out, spec, s.stars, star, d);
+            break;
+        }
+        case ARG_LDOUBLE:
+        {
+            long double ld;
+            memcpy(&ld, data, sizeof(ld));
+            append(out, spec, s.stars, star, ld);
+            break;
+        }
+        case ARG_POINTER:
+        {
+            void* p;
+            memcpy(&p, data, sizeof(p));
+            append(out, spec, s.stars, star, p);
+            break;
+        }
+        default:
+            memcpy(&v, data, SLOT_SIZE);
+            switch (s.kind)
+            {
+            case ARG_INT:       append(out, spec, s.stars, star, (int)v); break;
+            case ARG_UINT:      append(out, spec, s.stars, star, (unsigned int)v); break;
+            case ARG_LONG:      append(out, spec, s.stars, star, (long)v); break;
+            case ARG_ULONG:     append(out, spec, s.stars, star, (unsigned long)v); break;
+            case ARG_ULLONG:    append(out, spec, s.stars, star, (unsigned long long)v); break;
+            case ARG_SIZE:      append(out, spec, s.stars, star, (size_t)v); break;
+            case ARG_PTRDIFF:   append(out, spec, s.stars, star, (ptrdiff_t)v); break;
+            case ARG_INTMAX:    append(out, spec, s.stars, star, (intmax_t)v); break;
+            default:            append(out, spec, s.stars, star, v); break;
+            }
+            break;
+        }
+        data += slot_size(s.kind);
+    }
+    out += m_tail;
+}
+
+log_format* site_format(log_site* site, const char* fmt)
+{
+    log_format* f = atomic_load(&site->format);
+    if (!f)
+    {
+        if (atomic_load(&site->unsupported))
+            return NULL;
+
+        log_format* parsed = log_format::parse(fmt);
+        if (!parsed)
+        {
+            atomic_store(&site->unsupported, 1);
+            return NULL;
+        }
+
+        //first thread through publishes its copy
+        log_format* expected = NULL;
+        while (!atomic_cas(&site->format, expected, parsed))
+        {
+            if (expected)
+            {
+                delete parsed;
+                parsed = expected;
+                break;
+            }
+        }
+        f = parsed;
+    }
+
+    //the site was reached with a different, non-literal format
+    return f->fmt() == fmt ? f : NULL;
+}
+
+} //namespace vodeox
@@ -0,0 +1,127 @@
+#ifndef __BASE_LOG_FORMAT_H
+#define __BASE_LOG_FORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "base/types.h"
+
+namespace vodeox
+{
+
+/*
+ * A printf format string taken apart once, so the arguments of a call can be
+ * copied out of a va_list as raw values and formatted later on another thread.
+ * Every conversion becomes a segment holding the literal text in front of it
+ * and the conversion spec; strings are copied, everything else is stored as
+ * is in 8 byte slots.
+ *
+ * parse() returns NULL for formats it can't defer (%n, wide strings, more
+ * than MAX_ARGS arguments), callers format those right away.
+ */
+class log_format
+{
+ public:
+    enum { MAX_ARGS = 16 };
+
+    typedef enum {
+        ARG_INT,
+        ARG_UINT,
+        ARG_LONG,
+        ARG_ULONG,
+        ARG_LLONG,
+        ARG_ULLONG,
+        ARG_SIZE,
+        ARG_PTRDIFF,
+        ARG_INTMAX,
+        ARG_DOUBLE,
+        ARG_LDOUBLE,
+        ARG_STRING,
+        ARG_POINTER
+    } ARG_KIND;
+
+    /*
+     * Arguments of one call, pulled out of the va_list by capture()
+     */
+    struct capture
+    {
+        union slot
+        {
+            long long   i;
+            double      d;
+            long double ld;
+            const void* p;
+        };
+
+        slot        values[MAX_ARGS];
+        size_t      lengths[MAX_ARGS];  //strings only
+        size_t      size;               //encoded bytes
+    };
+
+    static log_format* parse(const char* fmt);
+
+    const char* fmt() const { return m_fmt; }
+
+    /*
+     * Reads the arguments for this format off ap and works out how much room
+     * encode() needs
+     */
+    void capture_args(va_list ap, capture& c) const;
+
+    /*
+     * Writes the captured arguments to out, which has room for c.size bytes
+     */
+    void encode(const capture& c, char* out) const;
+
+    /*
+     * Formats encoded arguments the way vsnprintf would have
+     */
+    void render(const char* data, size_t len, std::string& out) const;
+
+ private:
+    struct segment
+    {
+        std::string     spec;       //literal prefix and the conversion
+        ARG_KIND        kind;
+        int             stars;      //'*' width/precision ints in front of the value
+        int             precision;  //literal precision, -1 if none
+    };
+
+    log_format(const char* fmt) : m_fmt(fmt), m_args(0) {}
+
+    log_format(const log_format&);
+    log_format& operator=(const log_format&);
+
+ private:
+    const char*             m_fmt;
+    std::vector<segment>    m_segments;
+    std::string             m_tail;     //text after the last conversion, %% already folded
+    int                     m_args;
+};
+
+/*
+ * One per LOG_* call site, the parsed format and the effective level of the
+ * site's component are cached on first use. Lives in static storage and
+ * relies on being zero initialized.
+ */
+struct log_site
+{
+    log_format* volatile    format;
+    volatile int            unsupported;
+
+    //level filter generation << 8 | (level + 1), see Logger::siteLevel
+    volatile uint64         filter;
+    const char* volatile    component;
+};
+
+/*
+ * Parsed format for a call site, NULL when fmt can't be deferred
+ */
+log_format* site_format(log_site* site, const char* fmt);
+
+} //namespace vodeox
+
+#endif
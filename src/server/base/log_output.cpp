@@ -0,0 +1,171 @@
+#include "config.h"
+
+#include "base/log_output.h"
+
+#include <time.h>
+
+namespace vodeox
+{
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char HEX[] = "0123456789abcdef";
+
+//the date part only changes once a second, kept per formatting thread
+struct timestamp_cache
+{
+    uint64  sec;
+    char    text[20];   //2013-05-01T17:04:12
+};
+
+static __thread timestamp_cache s_timestamp = { (uint64)-1, { 0 } };
+
+//writes v right aligned so it ends at end, returns where it starts
+static inline char* format_uint(uint64 v, char* end)
+{
+    char* p = end;
+    while (v >= 100)
+    {
+        const char* pair = DIGIT_PAIRS + (v % 100) * 2;
+        v /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    if (v >= 10)
+    {
+        const char* pair = DIGIT_PAIRS + v * 2;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    else
+        *--p = (char)('0' + v);
+    return p;
+}
+
+//fixed width, zero padded
+static inline void format_digits(uint64 v, char* p, int width)
+{
+    for (int i = width - 1; i >= 0; i--)
+    {
+        p[i] = (char)('0' + v % 10);
+        v /= 10;
+    }
+}
+
+void log_output::append_uint(uint64 v)
+{
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* p = format_uint(v, end);
+    append(p, end - p);
+}
+
+void log_output::append_int(int64 v)
+{
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    //negate as unsigned, -INT64_MIN doesn't fit
+    char* p = format_uint(v < 0 ? 0 - (uint64)v : (uint64)v, end);
+    if (v < 0)
+        *--p = '-';
+    append(p, end - p);
+}
+
+void log_output::append_timestamp(uint64 usec)
+{
+    uint64 sec = usec / 1000000;
+    if (sec != s_timestamp.sec)
+    {
+        time_t t = (time_t)sec;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        char* p = s_timestamp.text;
+        format_digits(tm.tm_year + 1900, p, 4);
+        p[4] = '-';
+        format_digits(tm.tm_mon + 1, p + 5, 2);
+        p[7] = '-';
+        format_digits(tm.tm_mday, p + 8, 2);
+        p[10] = 'T';
+        format_digits(tm.tm_hour, p + 11, 2);
+        p[13] = ':';
+        format_digits(tm.tm_min, p + 14, 2);
+        p[16] = ':';
+        format_digits(tm.tm_sec, p + 17, 2);
+        s_timestamp.sec = sec;
+    }
+
+    char buf[28];
+    memcpy(buf, s_timestamp.text, 19);
+    buf[19] = '.';
+    format_digits(usec % 1000000, buf + 20, 6);
+    buf[26] = 'Z';
+    append(buf, 27);
+}
+
+void log_output::append_json(const char* s, size_t len)
+{
+    //plain runs go out in one piece, escapes in between
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        append(s + run, i - run);
+        run = i + 1;
+
+        char esc[6] = { '\\', 0, 0, 0, 0, 0 };
+        size_t n = 2;
+        switch (c)
+        {
+            case '"':  esc[1] = '"'; break;
+            case '\\': esc[1] = '\\'; break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
+            default:
+                esc[1] = 'u';
+                esc[2] = '0';
+                esc[3] = '0';
+                esc[4] = HEX[c >> 4];
+                esc[5] = HEX[c & 15];
+                n = 6;
+        }
+        append(esc, n);
+    }
+    append(s + run, len - run);
+}
+
+void log_output::append_logfmt(const char* s, size_t len)
+{
+    bool quote = (len == 0);
+    for (size_t i = 0; i < len && !quote; i++)
+    {
+        unsigned char c = (unsigned char)s[i];
+        quote = (c <= ' ' || c == '=' || c == '"' || c == '\\');
+    }
+
+    if (!quote)
+    {
+        append(s, len);
+        return;
+    }
+
+    //same escapes as JSON, logfmt readers take those
+    append('"');
+    append_json(s, len);
+    append('"');
+}
+
+} //namespace vodeox
@@ -0,0 +1,68 @@
+#ifndef __BASE_LOG_OUTPUT_H
+#define __BASE_LOG_OUTPUT_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include <string>
+
+#include "base/types.h"
+#include "base/log_writer.h"
+
+namespace vodeox
+{
+
+/*
+ * What formatters write a line through. Bytes go straight into the log
+ * writer's buffer, numbers and timestamps are formatted on the stack first,
+ * so formatting an entry allocates nothing. It can also append to a string,
+ * which is how LoggerFormatter::format is served for formatters that only
+ * implement append.
+ */
+class log_output
+{
+ public:
+    explicit log_output(log_writer& writer) : m_writer(&writer), m_string(NULL) {}
+    explicit log_output(std::string& s) : m_writer(NULL), m_string(&s) {}
+
+    void append(const char* data, size_t len)
+    {
+        if (m_writer)
+            m_writer->append(data, len);
+        else
+            m_string->append(data, len);
+    }
+
+    void append(const std::string& s) { append(s.data(), s.size()); }
+    void append(const char* s) { append(s, strlen(s)); }
+    void append(char c) { append(&c, 1); }
+
+    void append_uint(uint64 v);
+    void append_int(int64 v);
+
+    /*
+     * UTC, ISO 8601 with microseconds: 2013-05-01T17:04:12.000345Z
+     */
+    void append_timestamp(uint64 usec);
+
+    /*
+     * Contents of a JSON string, quotes, backslashes and control characters
+     * escaped; the caller writes the quotes
+     */
+    void append_json(const char* s, size_t len);
+    void append_json(const std::string& s) { append_json(s.data(), s.size()); }
+
+    /*
+     * A logfmt value, quoted when it is empty or holds spaces, '=' or '"'
+     */
+    void append_logfmt(const char* s, size_t len);
+    void append_logfmt(const std::string& s) { append_logfmt(s.data(), s.size()); }
+
+ private:
+    log_writer*     m_writer;
+    std::string*    m_string;
+};
+
+} //namespace vodeox
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef __BASE_LOG_RING_H
+#define __BASE_LOG_RING_H
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "base/types.h"
+#include "base/atomic.h"
+
+namespace vodeox
+{
+
+static const size_t DEFAULT_LOG_RING_SIZE = 1024 * 1024;
+
+/*
+ * Single producer, single consumer byte ring for variable sized records,
+ * one per logging thread with the logger thread on the other end. A record
+ * never wraps: when it doesn't fit in front of the end of the buffer the
+ * producer leaves a zero length marker and starts over at offset 0.
+ *
+ * The producer never waits, a record that doesn't fit is counted as dropped.
+ */
+class log_ring
+{
+ public:
+    //records are 8 byte aligned and start with their size
+    enum { ALIGN = 8 };
+
+    log_ring(size_t size = DEFAULT_LOG_RING_SIZE) :
+        m_head(0), m_published(0), m_dropped(0), m_tail(0), m_closed(0)
+    {
+        m_size = ALIGN;
+        while (m_size < size)
+            m_size <<= 1;
+        m_mask = m_size - 1;
+        if (0 != posix_memalign((void**)&m_buffer, VODEOX_CACHE_LINE, m_size))
+            abort();
+    }
+
+    ~log_ring() { free(m_buffer); }
+
+    /*
+     * Producer: returns room for len bytes or NULL when the ring is full,
+     * a successful reserve is followed by commit() with the same length
+     */
+    char* reserve(size_t len)
+    {
+        len = round(len);
+        uint64 head = m_head;
+        size_t offset = head & m_mask;
+        size_t pad = (offset + len > m_size) ? m_size - offset : 0;
+
+        if (len + pad > m_size - (head - atomic_load(&m_tail)))
+        {
+            atomic_fetch_add(&m_dropped, (uint64)1);
+            return NULL;
+        }
+        if (pad)
+        {
+            *(uint32*)(m_buffer + offset) = 0;
+            m_head = head + pad;
+            offset = 0;
+        }
+        return m_buffer + offset;
+    }
+
+    void commit(size_t len)
+    {
+        len = round(len);
+        *(uint32*)(m_buffer + (m_head & m_mask)) = (uint32)len;
+        m_head += len;
+        atomic_store(&m_published, m_head);
+    }
+
+    /*
+     * Consumer: hands every published record to f(const char* rec, size_t len)
+     * and frees the space, returns how many records there were
+     */
+    template<typename F>
+    size_t consume(F& f)
+    {
+        uint64 tail = m_tail;
+        uint64 head = atomic_load(&m_published);
+        size_t n = 0;
+
+        while (tail < head)
+        {
+            size_t offset = tail & m_mask;
+            uint32 len = *(const uint32*)(m_buffer + offset);
+            if (len == 0)
+            {
+                tail += m_size - offset;
+                continue;
+            }
+            f(m_buffer + offset, len);
+            tail += len;
+            n++;
+        }
+        atomic_store(&m_tail, tail);
+        return n;
+    }
+
+    /*
+     * Consumer side, returns and resets the number of dropped records
+     */
+    uint64 take_dropped()
+    {
+        return atomic_load_relaxed(&m_dropped) ? atomic_exchange(&m_dropped, (uint64)0) : 0;
+    }
+
+    bool empty() const { return atomic_load(&m_tail) == atomic_load(&m_published); }
+
+    /*
+     * The owning thread is gone, the consumer frees the ring once drained
+     */
+    void close() { atomic_store(&m_closed, 1); }
+    bool closed() const { return atomic_load(&m_closed) != 0; }
+
+ private:
+    static size_t round(size_t len) { return (len + ALIGN - 1) & ~(size_t)(ALIGN - 1); }
+
+    log_ring(const log_ring&);
+    log_ring& operator=(const log_ring&);
+
+ private:
+    char*           m_buffer;
+    size_t          m_size;
+    size_t          m_mask;
+
+    //producer line
+    uint64          m_head;
+    volatile uint64 m_published;
+    volatile uint64 m_dropped;
+    char            m_pad0[VODEOX_CACHE_LINE];
+
+    //consumer line
+    volatile uint64 m_tail;
+    volatile int    m_closed;
+    char            m_pad1[VODEOX_CACHE_LINE];
+};
+
+} //namespace vodeox
+
+#endif
@@ -0,0 +1,168 @@
+#include "config.h"
+
+#include "base/log_writer.h"
+#include "base/time.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+//no fdatasync on some BSDs, fsync also flushes the metadata we don't need
+#ifndef HAVE_FDATASYNC
+#define fdatasync fsync
+#endif
+
+namespace vodeox
+{
+
+log_writer::log_writer(size_t buffer_size) :
+    m_fd(-1),
+    m_capacity(buffer_size ? buffer_size : DEFAULT_LOG_BUFFER),
+    m_used(0),
+    m_position(0),
+    m_last_flush(0),
+    m_sync(SYNC_NONE),
+    m_sync_interval(0),
+    m_last_sync(0)
+{
+    m_buffer = new char[m_capacity];
+}
+
+log_writer::~log_writer()
+{
+    close();
+    delete [] m_buffer;
+}
+
+bool log_writer::open(const std::string& path)
+{
+    close();
+
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (m_fd < 0)
+        return false;
+
+    m_position = 0;
+    m_last_flush = m_last_sync = vodeox::time::monotonic_ns() / 1000;
+    return true;
+}
+
+void log_writer::close()
+{
+    if (m_fd < 0)
+        return;
+
+    flush();
+    if (m_sync != SYNC_NONE)
+        fdatasync(m_fd);
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+void log_writer::append(const char* data, size_t len)
+{
+    if (len <= m_capacity - m_used)
+    {
+        memcpy(m_buffer + m_used, data, len);
+        m_used += len;
+        return;
+    }
+
+    //doesn't fit, whatever is buffered and the entry leave in one go
+    if (m_fd >= 0)
+    {
+        write_out(data, len);
+        return;
+    }
+
+    //nowhere to write it, keep the newest
+    m_used = 0;
+    if (len > m_capacity)
+        return;
+    memcpy(m_buffer, data, len);
+    m_used = len;
+}
+
+bool log_writer::flush()
+{
+    if (m_fd < 0)
+        return false;
+    if (m_used == 0)
+        return true;
+    return write_out(NULL, 0);
+}
+
+void log_writer::set_sync(SYNC_POLICY policy, uint64 interval_usec)
+{
+    m_sync = policy;
+    m_sync_interval = interval_usec;
+}
+
+bool log_writer::write_out(const char* extra, size_t extra_len)
+{
+    struct iovec iov[2];
+    int iovcnt = 0;
+    if (m_used)
+    {
+        iov[iovcnt].iov_base = m_buffer;
+        iov[iovcnt].iov_len = m_used;
+        iovcnt++;
+    }
+    if (extra_len)
+    {
+        iov[iovcnt].iov_base = (void*)extra;
+        iov[iovcnt].iov_len = extra_len;
+        iovcnt++;
+    }
+
+    bool ok = true;
+    struct iovec* v = iov;
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(m_fd, v, iovcnt);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "couldn't write log file, error = %d\n", errno);
+            ok = false;
+            break;
+        }
+        m_position += n;
+
+        //partial write, skip what went out
+        while (iovcnt > 0 && (size_t)n >= v->iov_len)
+        {
+            n -= v->iov_len;
+            v++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            v->iov_base = (char*)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+
+    m_used = 0;
+    uint64 now = vodeox::time::monotonic_ns() / 1000;
+    m_last_flush = now;
+    sync(now);
+    return ok;
+}
+
+void log_writer::sync(uint64 now)
+{
+    if (m_sync == SYNC_ON_FLUSH ||
+        (m_sync == SYNC_PERIODIC && now - m_last_sync >= m_sync_interval))
+    {
+        fdatasync(m_fd);
+        m_last_sync = now;
+    }
+}
+
+} //namespace vodeox
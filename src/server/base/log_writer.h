@@ -0,0 +1,91 @@
+#ifndef __BASE_LOG_WRITER_H
+#define __BASE_LOG_WRITER_H
+
+#include <stddef.h>
+
+#include <string>
+
+#include "base/types.h"
+
+namespace vodeox
+{
+
+static const size_t DEFAULT_LOG_BUFFER = 256 * 1024;
+
+/*
+ * Append-only log file behind a large write buffer. Entries are copied into
+ * the buffer and go out with one write per flush; an entry that doesn't fit
+ * the space left is sent together with the buffered bytes in a single writev.
+ * The file position is tracked here so rotation doesn't need ftell.
+ *
+ * Not thread safe, it belongs to the logger thread.
+ */
+class log_writer
+{
+ public:
+    typedef enum {
+        SYNC_NONE = 0,      //leave it to the page cache
+        SYNC_ON_FLUSH,      //fdatasync after every flush
+        SYNC_PERIODIC       //fdatasync at most once per sync interval
+    } SYNC_POLICY;
+
+    log_writer(size_t buffer_size = DEFAULT_LOG_BUFFER);
+    virtual ~log_writer();
+
+    /*
+     * Opens path for writing, truncating it like fopen("w+") did
+     */
+    bool open(const std::string& path);
+
+    /*
+     * Flushes and closes the file
+     */
+    void close();
+
+    bool is_open() const { return m_fd >= 0; }
+
+    void append(const char* data, size_t len);
+    void append(const std::string& s) { append(s.data(), s.size()); }
+
+    /*
+     * Writes out the buffer, false if the write failed. Failed bytes are
+     * dropped rather than kept around to grow without bound.
+     */
+    bool flush();
+
+    void set_sync(SYNC_POLICY policy, uint64 interval_usec = 0);
+
+    size_t pending() const { return m_used; }
+    size_t capacity() const { return m_capacity; }
+
+    /*
+     * Bytes in the file once the buffer is flushed
+     */
+    uint64 position() const { return m_position + m_used; }
+
+    uint64 last_flush() const { return m_last_flush; }
+
+ private:
+    bool write_out(const char* extra, size_t extra_len);
+    void sync(uint64 now);
+
+    log_writer(const log_writer&);
+    log_writer& operator=(const log_writer&);
+
+ private:
+    int             m_fd;
+    char*           m_buffer;
+    size_t          m_capacity;
+    size_t          m_used;
+
+    uint64          m_position;     //bytes written to the file
+    uint64          m_last_flush;   //monotonic usec
+
+    SYNC_POLICY     m_sync;
+    uint64          m_sync_interval;
+    uint64          m_last_sync;
+};
+
+} //namespace vodeox
+
+#endif
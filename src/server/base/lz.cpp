@@ -0,0 +1,303 @@
+#include "config.h"
+
+#include "base/lz.h"
+#include "base/types.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <vector>
+
+namespace vodeox
+{
+
+static const int HASH_BITS = 12;
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 65535;
+
+//matches stop this far from the end, the tail always goes out as literals
+static const size_t END_LITERALS = 8;
+
+static inline uint32 read32(const unsigned char* p)
+{
+    uint32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32 hash4(uint32 v)
+{
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static inline bool put_length(unsigned char*& op, const unsigned char* end, size_t len)
+{
+    while (len >= 255)
+    {
+        if (op >= end)
+            return false;
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= end)
+        return false;
+    *op++ = (unsigned char)len;
+    return true;
+}
+
+static bool put_sequence(unsigned char*& op, const unsigned char* end,
+                         const unsigned char* literals, size_t lit_len,
+                         size_t offset, size_t match_len)
+{
+    if (op >= end)
+        return false;
+
+    unsigned char* token = op++;
+    size_t ml = match_len ? match_len - MIN_MATCH : 0;
+    *token = (unsigned char)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+
+    if (lit_len >= 15 && !put_length(op, end, lit_len - 15))
+        return false;
+    if ((size_t)(end - op) < lit_len)
+        return false;
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+
+    if (!match_len)
+        return true;
+    if (end - op < 2)
+        return false;
+    *op++ = (unsigned char)(offset & 0xff);
+    *op++ = (unsigned char)(offset >> 8);
+    if (ml >= 15 && !put_length(op, end, ml - 15))
+        return false;
+    return true;
+}
+
+size_t lz_compress(const char* in, size_t len, char* out, size_t room)
+{
+    const unsigned char* base = (const unsigned char*)in;
+    const unsigned char* ip = base;
+    const unsigned char* anchor = base;
+    const unsigned char* iend = base + len;
+    const unsigned char* mlimit = len > END_LITERALS + MIN_MATCH ? iend - END_LITERALS : base;
+    unsigned char* op = (unsigned char*)out;
+    const unsigned char* oend = op + room;
+
+    uint32 table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    while (ip + MIN_MATCH <= mlimit)
+    {
+        uint32 h = hash4(read32(ip));
+        const unsigned char* ref = base + table[h];
+        table[h] = (uint32)(ip - base);
+
+        if (ref >= ip || (size_t)(ip - ref) > MAX_OFFSET || read32(ref) != read32(ip))
+        {
+            ip++;
+            continue;
+        }
+
+        size_t match = MIN_MATCH;
+        while (ip + match < mlimit && ref[match] == ip[match])
+            match++;
+
+        if (!put_sequence(op, oend, anchor, ip - anchor, ip - ref, match))
+            return 0;
+        ip += match;
+        anchor = ip;
+    }
+
+    if (!put_sequence(op, oend, anchor, iend - anchor, 0, 0))
+        return 0;
+    return op - (unsigned char*)out;
+}
+
+static inline bool get_length(const unsigned char*& ip, const unsigned char* end, size_t& len)
+{
+    unsigned char b;
+    do {
+        if (ip >= end)
+            return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+size_t lz_decompress(const char* in, size_t len, char* out, size_t room)
+{
+    const unsigned char* ip = (const unsigned char*)in;
+    const unsigned char* iend = ip + len;
+    unsigned char* op = (unsigned char*)out;
+    unsigned char* oend = op + room;
+    const size_t CORRUPT = (size_t)-1;
+
+    while (ip < iend)
+    {
+        unsigned char token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !get_length(ip, iend, lit_len))
+            return CORRUPT;
+        if ((size_t)(iend - ip) < lit_len || (size_t)(oend - op) < lit_len)
+            return CORRUPT;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        //a sequence without an offset ends the block
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return CORRUPT;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t match = (token & 15);
+        if (match == 15 && !get_length(ip, iend, match))
+            return CORRUPT;
+        match += MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t)(op - (unsigned char*)out) || (size_t)(oend - op) < match)
+            return CORRUPT;
+
+        //byte by byte, matches may overlap what they produce
+        const unsigned char* ref = op - offset;
+        for (size_t i = 0; i < match; i++)
+            op[i] = ref[i];
+        op += match;
+    }
+    return op - (unsigned char*)out;
+}
+
+static const char LZ_MAGIC[4] = { 'V', 'L', 'Z', '1' };
+static const uint32 LZ_STORED = 0x80000000U;
+
+static bool read_full(int fd, char* buf, size_t len, size_t& got)
+{
+    got = 0;
+    while (got < len)
+    {
+        ssize_t n = ::read(fd, buf + got, len - got);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (n == 0)
+            break;
+        got += n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const char* buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static inline void put32(char* p, uint32 v)
+{
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)((v >> 8) & 0xff);
+    p[2] = (char)((v >> 16) & 0xff);
+    p[3] = (char)(v >> 24);
+}
+
+static inline uint32 get32(const char* p)
+{
+    const unsigned char* u = (const unsigned char*)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32)u[3] << 24);
+}
+
+bool lz_compress_file(int in_fd, int out_fd)
+{
+    std::vector<char> in(LZ_FILE_BLOCK);
+    std::vector<char> out(8 + lz_bound(LZ_FILE_BLOCK));
+
+    if (!write_full(out_fd, LZ_MAGIC, sizeof(LZ_MAGIC)))
+        return false;
+
+    for (;;)
+    {
+        size_t len;
+        if (!read_full(in_fd, &in[0], in.size(), len))
+            return false;
+        if (len == 0)
+            return true;
+
+        size_t packed = lz_compress(&in[0], len, &out[8], out.size() - 8);
+        put32(&out[0], (uint32)len);
+        if (packed == 0 || packed >= len)
+        {
+            put32(&out[4], (uint32)len | LZ_STORED);
+            if (!write_full(out_fd, &out[0], 8) || !write_full(out_fd, &in[0], len))
+                return false;
+        }
+        else
+        {
+            put32(&out[4], (uint32)packed);
+            if (!write_full(out_fd, &out[0], 8 + packed))
+                return false;
+        }
+    }
+}
+
+bool lz_decompress_file(int in_fd, int out_fd)
+{
+    std::vector<char> in(lz_bound(LZ_FILE_BLOCK));
+    std::vector<char> out(LZ_FILE_BLOCK);
+
+    char header[8];
+    size_t got;
+    if (!read_full(in_fd, header, sizeof(LZ_MAGIC), got) || got != sizeof(LZ_MAGIC) ||
+        memcmp(header, LZ_MAGIC, sizeof(LZ_MAGIC)) != 0)
+        return false;
+
+    for (;;)
+    {
+        if (!read_full(in_fd, header, sizeof(header), got))
+            return false;
+        if (got == 0)
+            return true;
+        if (got != sizeof(header))
+            return false;
+
+        size_t raw = get32(header);
+        uint32 stored = get32(header + 4);
+        bool verbatim = (stored & LZ_STORED) != 0;
+        size_t len = stored & ~LZ_STORED;
+        if (raw > out.size() || len > in.size() || (verbatim && len != raw))
+            return false;
+
+        if (!read_full(in_fd, &in[0], len, got) || got != len)
+            return false;
+
+        if (verbatim)
+        {
+            if (!write_full(out_fd, &in[0], len))
+                return false;
+        }
+        else if (lz_decompress(&in[0], len, &out[0], out.size()) != raw ||
+                 !write_full(out_fd, &out[0], raw))
+            return false;
+    }
+}
+
+} //namespace vodeox
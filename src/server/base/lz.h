@@ -0,0 +1,55 @@
+#ifndef __BASE_LZ_H
+#define __BASE_LZ_H
+
+#include <stddef.h>
+
+namespace vodeox
+{
+
+/*
+ * Small LZ77 block codec in the spirit of LZ4, used to compress rotated logs
+ * when zlib isn't available. Fast rather than tight: greedy matching through
+ * a 4k entry hash of 4 byte sequences, 64k window.
+ *
+ * A block is a series of sequences: a token byte (literal count in the high
+ * nibble, match length - 4 in the low one, 15 meaning more length bytes
+ * follow), the literals, a 16 bit little endian offset and the extra match
+ * length bytes. The last sequence carries only literals.
+ */
+
+/*
+ * Worst case size of a compressed block of len bytes
+ */
+inline size_t lz_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+/*
+ * Returns the compressed size, 0 if it doesn't fit into room
+ */
+size_t lz_compress(const char* in, size_t len, char* out, size_t room);
+
+/*
+ * Returns the decompressed size, (size_t)-1 for a corrupt block or one that
+ * doesn't fit into room
+ */
+size_t lz_decompress(const char* in, size_t len, char* out, size_t room);
+
+/*
+ * Stream format for whole files: the "VLZ1" magic, then blocks of up to
+ * LZ_FILE_BLOCK input bytes, each behind its raw and stored size (32 bit
+ * little endian). Blocks that don't shrink are stored as is, flagged by the
+ * top bit of the stored size.
+ *
+ * Both return false on a read/write error or, when unpacking, a corrupt file.
+ * tools/unlz unpacks such archives from the command line.
+ */
+static const size_t LZ_FILE_BLOCK = 256 * 1024;
+
+bool lz_compress_file(int in_fd, int out_fd);
+bool lz_decompress_file(int in_fd, int out_fd);
+
+} //namespace vodeox
+
+#endif
@@ -0,0 +1,340 @@
+#include "config.h"
+
+#include "base/metrics.h"
+#include "base/time.h"
+
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <algorithm>
+
+namespace vodeox
+{
+
+__thread metrics_shard* t_metrics_shard = NULL;
+
+/*
+ * Names and shards, only touched when a metric or a thread shows up and when
+ * metrics are read
+ */
+class metrics_registry
+{
+ public:
+    static metrics_registry& instance()
+    {
+        static metrics_registry s_instance;
+        return s_instance;
+    }
+
+    unsigned add_name(std::vector<std::string>& names, const char* name, unsigned max)
+    {
+        scoped_lock lock(m_mutex);
+        for (unsigned i = 0; i < names.size(); i++)
+            if (names[i] == name)
+                return i;
+        if (names.size() >= max)
+        {
+            fprintf(stderr, "too many metrics, %s isn't reported\n", name);
+            return max;
+        }
+        names.push_back(name);
+        return names.size() - 1;
+    }
+
+    mutex                           m_mutex;
+    std::vector<std::string>        m_counters;
+    std::vector<std::string>        m_histograms;
+    std::vector<gauge*>             m_gauges;
+    std::vector<metrics_shard*>     m_shards;
+};
+
+metrics_shard* create_metrics_shard()
+{
+    metrics_shard* s = new metrics_shard;
+    memset((void*)s, 0, sizeof(*s));
+
+    metrics_registry& r = metrics_registry::instance();
+    scoped_lock lock(r.m_mutex);
+    r.m_shards.push_back(s);
+    t_metrics_shard = s;
+    return s;
+}
+
+histogram_shard* create_histogram_shard(metrics_shard* shard, unsigned index)
+{
+    histogram_shard* h = new histogram_shard;
+    memset((void*)h, 0, sizeof(*h));
+    //readers pick it up with an acquire load
+    __atomic_store_n(&shard->histograms[index], h, __ATOMIC_RELEASE);
+    return h;
+}
+
+counter::counter(const char* name)
+{
+    metrics_registry& r = metrics_registry::instance();
+    m_index = r.add_name(r.m_counters, name, METRICS_MAX_COUNTERS);
+}
+
+uint64 counter::value() const
+{
+    metrics_registry& r = metrics_registry::instance();
+    scoped_lock lock(r.m_mutex);
+    uint64 total = 0;
+    for (size_t i = 0; i < r.m_shards.size(); i++)
+        total += atomic_load_relaxed(&r.m_shards[i]->counters[m_index]);
+    return total;
+}
+
+gauge::gauge(const char* name) : m_name(name), m_value(0)
+{
+    metrics_registry& r = metrics_registry::instance();
+    scoped_lock lock(r.m_mutex);
+    r.m_gauges.push_back(this);
+}
+
+gauge::~gauge()
+{
+    metrics_registry& r = metrics_registry::instance();
+    scoped_lock lock(r.m_mutex);
+    r.m_gauges.erase(std::find(r.m_gauges.begin(), r.m_gauges.end(), this));
+}
+
+histogram::histogram(const char* name)
+{
+    metrics_registry& r = metrics_registry::instance();
+    m_index = r.add_name(r.m_histograms, name, METRICS_MAX_HISTOGRAMS);
+}
+
+uint64 histogram::bucket_limit(unsigned i)
+{
+    if (i < (2U << HISTOGRAM_SUB_BITS))
+        return i;
+    unsigned shift = (i >> HISTOGRAM_SUB_BITS) - 1;
+    uint64 m = (i & ((1U << HISTOGRAM_SUB_BITS) - 1)) + (1U << HISTOGRAM_SUB_BITS);
+    return ((m + 1) << shift) - 1;
+}
+
+static void merge_histogram(const std::vector<metrics_shard*>& shards, unsigned index,
+                            histogram_snapshot& out)
+{
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        histogram_shard* h = __atomic_load_n(&shards[s]->histograms[index], __ATOMIC_ACQUIRE);
+        if (!h)
+            continue;
+        out.count += atomic_load_relaxed(&h->count);
+        out.sum += atomic_load_relaxed(&h->sum);
+        out.max = std::max(out.max, (uint64)atomic_load_relaxed(&h->max));
+        for (unsigned b = 0; b < HISTOGRAM_BUCKETS; b++)
+            out.buckets[b] += atomic_load_relaxed(&h->buckets[b]);
+    }
+}
+
+void histogram::snapshot(histogram_snapshot& out) const
+{
+    metrics_registry& r = metrics_registry::instance();
+    scoped_lock lock(r.m_mutex);
+    merge_histogram(r.m_shards, m_index, out);
+}
+
+uint64 histogram_snapshot::quantile(double q) const
+{
+    //the shards are read one slot at a time, go by what the buckets hold
+    uint64 total = 0;
+    for (unsigned b = 0; b < buckets.size(); b++)
+        total += buckets[b];
+    if (total == 0)
+        return 0;
+
+    uint64 rank = (uint64)(q * total);
+    if (rank >= total)
+        rank = total - 1;
+
+    uint64 seen = 0;
+    for (unsigned b = 0; b < buckets.size(); b++)
+    {
+        seen += buckets[b];
+        if (seen > rank)
+            return std::min(histogram::bucket_limit(b), max);
+    }
+    return max;
+}
+
+static void append_line(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void append_line(std::string& out, const char* fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        out.append(buf, std::min((size_t)n, sizeof(buf) - 1));
+    out += '\n';
+}
+
+void dump_metrics(std::string& out)
+{
+    metrics_registry& r = metrics_registry::instance();
+    scoped_lock lock(r.m_mutex);
+
+    for (unsigned i = 0; i < r.m_counters.size(); i++)
+    {
+        uint64 total = 0;
+        for (size_t s = 0; s < r.m_shards.size(); s++)
+            total += atomic_load_relaxed(&r.m_shards[s]->counters[i]);
+        append_line(out, "counter %s %llu", r.m_counters[i].c_str(), (unsigned long long)total);
+    }
+
+    //gauges sharing a name are summed, first registration decides the order
+    std::vector<std::string> names;
+    std::vector<int64> values;
+    for (size_t g = 0; g < r.m_gauges.size(); g++)
+    {
+        size_t i = std::find(names.begin(), names.end(), r.m_gauges[g]->name()) - names.begin();
+        if (i == names.size())
+        {
+            names.push_back(r.m_gauges[g]->name());
+            values.push_back(0);
+        }
+        values[i] += r.m_gauges[g]->value();
+    }
+    for (size_t i = 0; i < names.size(); i++)
+        append_line(out, "gauge %s %lld", names[i].c_str(), (long long)values[i]);
+
+    for (unsigned i = 0; i < r.m_histograms.size(); i++)
+    {
+        histogram_snapshot h;
+        merge_histogram(r.m_shards, i, h);
+        append_line(out, "histogram %s count=%llu mean=%.0f p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu",
+                    r.m_histograms[i].c_str(), (unsigned long long)h.count, h.mean(),
+                    (unsigned long long)h.quantile(0.5), (unsigned long long)h.quantile(0.9),
+                    (unsigned long long)h.quantile(0.99), (unsigned long long)h.quantile(0.999),
+                    (unsigned long long)h.max);
+    }
+}
+
+//the reporter the signal handler wakes up, one per process
+static int s_signal_fd = -1;
+
+metrics_reporter::metrics_reporter(FILE* out) :
+    m_out(out),
+    m_interval(0),
+    m_signo(0),
+    m_running(false)
+{
+    m_pipe[0] = m_pipe[1] = -1;
+}
+
+metrics_reporter::~metrics_reporter()
+{
+    stop();
+}
+
+bool metrics_reporter::start(unsigned interval_sec, int signo)
+{
+    if (m_running)
+        return true;
+    if (pipe(m_pipe) != 0)
+        return false;
+    fcntl(m_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(m_pipe[1], F_SETFL, O_NONBLOCK);
+
+    m_interval = interval_sec;
+    m_signo = signo;
+    if (signo)
+    {
+        s_signal_fd = m_pipe[1];
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_signal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(signo, &sa, NULL);
+    }
+
+    m_running = true;
+    vodeox::thread::start(static_cast<vodeox::thread*>(this));
+    return true;
+}
+
+void metrics_reporter::stop()
+{
+    if (!m_running)
+        return;
+    if (m_signo)
+    {
+        signal(m_signo, SIG_DFL);
+        s_signal_fd = -1;
+    }
+    m_running = false;
+    char c = 0;
+    if (write(m_pipe[1], &c, 1) < 0)
+        perror("write");
+    join();
+    close(m_pipe[0]);
+    close(m_pipe[1]);
+    m_pipe[0] = m_pipe[1] = -1;
+}
+
+void metrics_reporter::on_signal(int signo)
+{
+    int saved = errno;
+    char c = 1;
+    if (s_signal_fd >= 0 && write(s_signal_fd, &c, 1) < 0)
+    {
+        //pipe full, a report is pending anyway
+    }
+    errno = saved;
+}
+
+void metrics_reporter::report()
+{
+    std::string out;
+    append_line(out, "metrics at %llu", (unsigned long long)vodeox::time::now().usec());
+    dump_metrics(out);
+    fwrite(out.data(), 1, out.size(), m_out);
+    fflush(m_out);
+}
+
+void metrics_reporter::run()
+{
+    uint64 next = vodeox::time::monotonic_ns() + m_interval * 1000000000ULL;
+    while (m_running)
+    {
+        int timeout = -1;
+        if (m_interval)
+        {
+            uint64 now = vodeox::time::monotonic_ns();
+            timeout = next > now ? (int)((next - now) / 1000000) : 0;
+        }
+
+        struct pollfd p;
+        p.fd = m_pipe[0];
+        p.events = POLLIN;
+        int n = poll(&p, 1, timeout);
+        if (!m_running)
+            break;
+
+        if (n > 0)
+        {
+            char buf[64];
+            while (read(m_pipe[0], buf, sizeof(buf)) > 0)
+                ;
+            report();
+        }
+        else if (n == 0)
+        {
+            report();
+            next += m_interval * 1000000000ULL;
+        }
+    }
+}
+
+} //namespace vodeox
@@ -0,0 +1,213 @@
+#ifndef __BASE_METRICS_H
+#define __BASE_METRICS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "base/types.h"
+#include "base/atomic.h"
+#include "base/scoped_lock.h"
+
+namespace vodeox
+{
+
+/*
+ * Process wide counters, gauges and latency histograms.
+ *
+ * Counters and histograms are written to a per-thread shard, each slot has a
+ * single writer so an update is a plain load and store, no lock prefix and no
+ * shared cache line. Readers sum the shards. Shards outlive their threads, a
+ * thread's counts stay in the totals after it exits.
+ *
+ * Gauges are one shared atomic per gauge object, gauges registered under the
+ * same name are added up when read.
+ *
+ * Metrics are meant to be static objects: counters and histograms registered
+ * under the same name share their slots, and there are at most
+ * MAX_COUNTERS/MAX_HISTOGRAMS distinct names; registrations beyond that go to
+ * a slot nobody reads.
+ */
+
+enum
+{
+    METRICS_MAX_COUNTERS = 128,
+    METRICS_MAX_HISTOGRAMS = 32,
+
+    //log-linear buckets: values below 64 exact, above that 32 buckets per
+    //power of two (3% relative error), up to 2^45
+    HISTOGRAM_SUB_BITS = 5,
+    HISTOGRAM_MAX_BITS = 45,
+    HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS
+};
+
+struct histogram_shard
+{
+    volatile uint64     count;
+    volatile uint64     sum;
+    volatile uint64     max;
+    volatile uint64     buckets[HISTOGRAM_BUCKETS];
+};
+
+struct metrics_shard
+{
+    volatile uint64                 counters[METRICS_MAX_COUNTERS + 1];
+    histogram_shard* volatile       histograms[METRICS_MAX_HISTOGRAMS + 1];
+};
+
+extern __thread metrics_shard* t_metrics_shard;
+
+metrics_shard* create_metrics_shard();
+histogram_shard* create_histogram_shard(metrics_shard* shard, unsigned index);
+
+inline metrics_shard* thread_metrics()
+{
+    metrics_shard* s = t_metrics_shard;
+    return s ? s : create_metrics_shard();
+}
+
+//single writer, no need for an atomic add
+inline void shard_add(volatile uint64* slot, uint64 n)
+{
+    atomic_store_relaxed(slot, atomic_load_relaxed(slot) + n);
+}
+
+class counter
+{
+ public:
+    explicit counter(const char* name);
+
+    void add(uint64 n = 1) { shard_add(&thread_metrics()->counters[m_index], n); }
+
+    uint64 value() const;
+
+ private:
+    unsigned    m_index;
+};
+
+class gauge
+{
+ public:
+    explicit gauge(const char* name);
+    virtual ~gauge();
+
+    void set(int64 v) { atomic_store_relaxed(&m_value, v); }
+    void add(int64 d) { atomic_fetch_add(&m_value, d); }
+
+    int64 value() const { return atomic_load_relaxed(&m_value); }
+    const std::string& name() const { return m_name; }
+
+ private:
+    gauge(const gauge&);
+    gauge& operator=(const gauge&);
+
+ private:
+    std::string         m_name;
+    volatile int64      m_value;
+};
+
+/*
+ * Merged view of a histogram, values are in whatever unit was recorded
+ */
+class histogram_snapshot
+{
+ public:
+    histogram_snapshot() : count(0), sum(0), max(0), buckets(HISTOGRAM_BUCKETS, 0) {}
+
+    /*
+     * Upper bound of the bucket holding the q-th quantile, 0 <= q <= 1
+     */
+    uint64 quantile(double q) const;
+    double mean() const { return count ? (double)sum / count : 0; }
+
+    uint64                  count;
+    uint64                  sum;
+    uint64                  max;
+    std::vector<uint64>     buckets;
+};
+
+class histogram
+{
+ public:
+    explicit histogram(const char* name);
+
+    void record(uint64 v)
+    {
+        metrics_shard* s = thread_metrics();
+        histogram_shard* h = s->histograms[m_index];
+        if (!h)
+            h = create_histogram_shard(s, m_index);
+        shard_add(&h->count, 1);
+        shard_add(&h->sum, v);
+        if (v > atomic_load_relaxed(&h->max))
+            atomic_store_relaxed(&h->max, v);
+        shard_add(&h->buckets[bucket(v)], 1);
+    }
+
+    void snapshot(histogram_snapshot& out) const;
+
+    static unsigned bucket(uint64 v)
+    {
+        if (v < (2ULL << HISTOGRAM_SUB_BITS))
+            return (unsigned)v;
+        unsigned shift = 63 - __builtin_clzll(v) - HISTOGRAM_SUB_BITS;
+        unsigned i = (shift << HISTOGRAM_SUB_BITS) + (unsigned)(v >> shift);
+        return i < HISTOGRAM_BUCKETS ? i : HISTOGRAM_BUCKETS - 1;
+    }
+
+    /*
+     * Largest value that lands in bucket i
+     */
+    static uint64 bucket_limit(unsigned i);
+
+ private:
+    unsigned    m_index;
+};
+
+/*
+ * Dumps every metric, one per line:
+ *   counter name value
+ *   gauge name value
+ *   histogram name count= mean= p50= p90= p99= p99.9= max=
+ */
+void dump_metrics(std::string& out);
+
+/*
+ * Writes dump_metrics() to a stream every interval seconds and whenever the
+ * installed signal arrives. The signal handler only writes a byte to a pipe
+ * the reporter thread polls.
+ */
+class metrics_reporter : public vodeox::thread
+{
+ public:
+    metrics_reporter(FILE* out = stderr);
+    virtual ~metrics_reporter();
+
+    /*
+     * interval_sec 0 reports on the signal only
+     */
+    bool start(unsigned interval_sec, int signo);
+    void stop();
+
+    void report();
+
+ private:
+    void run();
+    static void on_signal(int signo);
+
+    metrics_reporter(const metrics_reporter&);
+    metrics_reporter& operator=(const metrics_reporter&);
+
+ private:
+    FILE*           m_out;
+    unsigned        m_interval;
+    int             m_signo;
+    int             m_pipe[2];
+    volatile bool   m_running;
+};
+
+} //namespace vodeox
+
+#endif
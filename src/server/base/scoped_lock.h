@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 namespace vodeox
 {
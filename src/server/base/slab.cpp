@@ -0,0 +1,334 @@
+#include "config.h"
+
+#include "base/slab.h"
+#include "base/atomic.h"
+
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+namespace vodeox
+{
+
+static volatile unsigned s_pool_count = 0;
+static slab_pool* s_pools[SLAB_MAX_POOLS];
+
+//per thread caches, indexed by pool
+static __thread slab_block* t_cache[SLAB_MAX_POOLS];
+static __thread size_t t_cache_count[SLAB_MAX_POOLS];
+
+//set once the exit hook is armed for this thread
+static __thread bool t_registered = false;
+
+static pthread_key_t s_thread_key;
+static pthread_once_t s_thread_once = PTHREAD_ONCE_INIT;
+
+slab_pool::slab_pool(size_t size) : m_shared(NULL)
+{
+    //blocks double as free list links and hold anything up to a long double
+    size = size < sizeof(slab_block) ? sizeof(slab_block) : size;
+    m_size = (size + 15) & ~(size_t)15;
+
+    m_batch = SLAB_BATCH_BYTES / m_size;
+    if (m_batch > SLAB_BATCH)
+        m_batch = SLAB_BATCH;
+    if (m_batch < 4)
+        m_batch = 4;
+
+    m_index = atomic_fetch_add(&s_pool_count, 1U);
+    if (m_index < SLAB_MAX_POOLS)
+        s_pools[m_index] = this;
+    else
+        fprintf(stderr, "too many slab pools, %zu byte blocks aren't cached per thread\n", m_size);
+}
+
+void slab_pool::flush_thread(void*)
+{
+    unsigned count = atomic_load(&s_pool_count);
+    if (count > SLAB_MAX_POOLS)
+        count = SLAB_MAX_POOLS;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        slab_block* head = t_cache[i];
+        if (!head)
+            continue;
+        slab_block* tail = head;
+        while (tail->next)
+            tail = tail->next;
+        t_cache[i] = NULL;
+        t_cache_count[i] = 0;
+        s_pools[i]->give_batch(head, tail);
+    }
+
+    //a later destructor may free into the caches again, that arms it anew
+    t_registered = false;
+}
+
+static void make_thread_key()
+{
+    pthread_key_create(&s_thread_key, slab_pool::flush_thread);
+}
+
+//the key's value only has to be non null for the destructor to run
+static void register_thread()
+{
+    pthread_once(&s_thread_once, make_thread_key);
+    pthread_setspecific(s_thread_key, &s_thread_key);
+    t_registered = true;
+}
+
+//a fresh batch from the arena, linked up
+slab_block* slab_pool::carve()
+{
+    char* chunk = (char*)slab_arena::allocate(m_size * m_batch);
+    for (size_t i = 0; i < m_batch; i++)
+        ((slab_block*)(chunk + i * m_size))->next = (i + 1 < m_batch) ? (slab_block*)(chunk + (i + 1) * m_size) : NULL;
+    return (slab_block*)chunk;
+}
+
+//takes up to a batch from the shared list, carving new blocks if it's empty
+slab_block* slab_pool::take_batch(size_t& count)
+{
+    {
+        scoped_lock lock(m_mutex);
+        if (m_shared)
+        {
+            slab_block* head = m_shared;
+            slab_block* tail = head;
+            count = 1;
+            while (count < m_batch && tail->next)
+            {
+                tail = tail->next;
+                count++;
+            }
+            m_shared = tail->next;
+            tail->next = NULL;
+            return head;
+        }
+    }
+
+    count = m_batch;
+    return carve();
+}
+
+void slab_pool::give_batch(slab_block* head, slab_block* tail)
+{
+    scoped_lock lock(m_mutex);
+    tail->next = m_shared;
+    m_shared = head;
+}
+
+void* slab_pool::allocate()
+{
+    if (m_index >= SLAB_MAX_POOLS)
+    {
+        scoped_lock lock(m_mutex);
+        if (!m_shared)
+            m_shared = carve();
+        slab_block* b = m_shared;
+        m_shared = b->next;
+        return b;
+    }
+
+    slab_block* b = t_cache[m_index];
+    if (!b)
+    {
+        if (!t_registered)
+            register_thread();
+        b = take_batch(t_cache_count[m_index]);
+    }
+
+    t_cache[m_index] = b->next;
+    t_cache_count[m_index]--;
+    return b;
+}
+
+void slab_pool::deallocate(void* p)
+{
+    slab_block* b = (slab_block*)p;
+    if (m_index >= SLAB_MAX_POOLS)
+    {
+        give_batch(b, b);
+        return;
+    }
+
+    if (!t_registered)
+        register_thread();
+
+    b->next = t_cache[m_index];
+    t_cache[m_index] = b;
+
+    //keep at most two batches around, hand one back to the shared list
+    if (++t_cache_count[m_index] >= 2 * m_batch)
+    {
+        slab_block* tail = b;
+        for (size_t i = 1; i < m_batch; i++)
+            tail = tail->next;
+        t_cache[m_index] = tail->next;
+        t_cache_count[m_index] -= m_batch;
+        give_batch(b, tail);
+    }
+}
+
+/*
+ * Size classes: 32, then 48 and 64, 96 and 128, ... up to SLAB_MAX_CLASS_SIZE
+ */
+static const size_t SLAB_MIN_CLASS_SIZE = 32;
+static const unsigned SLAB_MIN_CLASS_BITS = 5;
+static const unsigned SLAB_CLASSES = 27;
+
+static unsigned size_class(size_t size)
+{
+    if (size <= SLAB_MIN_CLASS_SIZE)
+        return 0;
+    size_t n = size - 1;
+    unsigned b = 63 - __builtin_clzll(n);
+    unsigned upper = (n >> (b - 1)) & 1;
+    return (b - SLAB_MIN_CLASS_BITS) * 2 + upper + 1;
+}
+
+static size_t class_size(unsigned c)
+{
+    if (c == 0)
+        return SLAB_MIN_CLASS_SIZE;
+    unsigned b = (c - 1) / 2 + SLAB_MIN_CLASS_BITS;
+    return ((c - 1) & 1) ? (size_t)1 << (b + 1) : (size_t)3 << (b - 1);
+}
+
+class size_classes
+{
+ public:
+    size_classes()
+    {
+        for (unsigned c = 0; c < SLAB_CLASSES; c++)
+            m_pools[c] = new slab_pool(class_size(c));
+    }
+
+    slab_pool* m_pools[SLAB_CLASSES];
+};
+
+static slab_pool& class_pool(unsigned c)
+{
+    static size_classes s_classes;
+    return *s_classes.m_pools[c];
+}
+
+void* slab_allocate(size_t size)
+{
+    if (size > SLAB_MAX_CLASS_SIZE)
+        return malloc(size);
+    return class_pool(size_class(size)).allocate();
+}
+
+size_t slab_usable_size(size_t size)
+{
+    if (size > SLAB_MAX_CLASS_SIZE)
+        return size;
+    return class_size(size_class(size));
+}
+
+void slab_deallocate(void* p, size_t size)
+{
+    if (!p)
+        return;
+    if (size > SLAB_MAX_CLASS_SIZE)
+        free(p);
+    else
+        class_pool(size_class(size)).deallocate(p);
+}
+
+//plain pthread mutex, usable before any constructor has run
+static pthread_mutex_t s_arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool s_hugepages = false;
+static volatile size_t s_mapped = 0;
+static char* s_region_pos = NULL;
+static char* s_region_end = NULL;
+
+void slab_arena::set_hugepages(bool on)
+{
+    atomic_store(&s_hugepages, on);
+}
+
+bool slab_arena::hugepages()
+{
+    return atomic_load(&s_hugepages);
+}
+
+size_t slab_arena::mapped()
+{
+    return atomic_load_relaxed(&s_mapped);
+}
+
+static void* map_region(size_t size)
+{
+    void* p;
+    if (atomic_load(&s_hugepages))
+    {
+#if HAVE_DECL_MAP_HUGETLB
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            return p;
+#endif
+        //no reserved huge pages, align the region so the kernel can back it
+        //with transparent ones
+        char* raw = (char*)mmap(NULL, size + SLAB_REGION_SIZE, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            return NULL;
+        char* aligned = (char*)(((uintptr_t)raw + SLAB_REGION_SIZE - 1) & ~(uintptr_t)(SLAB_REGION_SIZE - 1));
+        if (aligned > raw)
+            munmap(raw, aligned - raw);
+        if (aligned + size < raw + size + SLAB_REGION_SIZE)
+            munmap(aligned + size, raw + SLAB_REGION_SIZE - aligned);
+#if HAVE_DECL_MADV_HUGEPAGE
+        madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+        return aligned;
+    }
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void* slab_arena::allocate(size_t size)
+{
+    size = (size + VODEOX_CACHE_LINE - 1) & ~(size_t)(VODEOX_CACHE_LINE - 1);
+
+    pthread_mutex_lock(&s_arena_mutex);
+    void* p;
+    if (size > SLAB_REGION_SIZE / 2)
+    {
+        //a mapping of its own instead of wasting most of a region
+        size_t mapping = (size + SLAB_REGION_SIZE - 1) & ~(SLAB_REGION_SIZE - 1);
+        p = map_region(mapping);
+        if (p)
+            atomic_fetch_add(&s_mapped, mapping);
+    }
+    else
+    {
+        //the tail of the old region is left unused
+        if ((size_t)(s_region_end - s_region_pos) < size)
+        {
+            s_region_pos = (char*)map_region(SLAB_REGION_SIZE);
+            s_region_end = s_region_pos ? s_region_pos + SLAB_REGION_SIZE : NULL;
+            if (s_region_pos)
+                atomic_fetch_add(&s_mapped, SLAB_REGION_SIZE);
+        }
+        p = s_region_pos;
+        if (p)
+            s_region_pos += size;
+    }
+    pthread_mutex_unlock(&s_arena_mutex);
+
+    if (!p)
+    {
+        fprintf(stderr, "couldn't map slab arena, aborting...");
+        abort();
+    }
+    return p;
+}
+
+} //namespace vodeox
@@ -0,0 +1,174 @@
+#ifndef __BASE_SLAB_H
+#define __BASE_SLAB_H
+
+#include <stddef.h>
+#include <new>
+
+#include "base/types.h"
+#include "base/scoped_lock.h"
+
+namespace vodeox
+{
+
+static const size_t SLAB_MAX_POOLS = 64;
+
+//blocks moved between a thread cache and the shared list at once, at most
+static const size_t SLAB_BATCH = 64;
+static const size_t SLAB_BATCH_BYTES = 64 * 1024;
+
+//arena regions, one huge page
+static const size_t SLAB_REGION_SIZE = 2 * 1024 * 1024;
+
+//slab_allocate serves sizes up to this, larger ones go to malloc
+static const size_t SLAB_MAX_CLASS_SIZE = 256 * 1024;
+
+struct slab_block
+{
+    slab_block* next;
+};
+
+/*
+ * Fixed size block pool. Every thread keeps a private free list and trades
+ * blocks with a shared list in batches, so a thread that only frees (a worker)
+ * hands its surplus back to threads that only allocate (a reactor) and neither
+ * of them calls into malloc once the pool is warm. New blocks are carved from
+ * the arena, nothing is returned to the system.
+ *
+ * Pools are meant to be static objects, the first SLAB_MAX_POOLS get a
+ * per-thread cache, any beyond that take the shared lock on every call.
+ * A thread's cached blocks go back to the shared lists when it exits.
+ */
+class slab_pool
+{
+ public:
+    explicit slab_pool(size_t size);
+
+    void* allocate();
+    void deallocate(void* p);
+
+    size_t block_size() const { return m_size; }
+
+    /*
+     * Hands the calling thread's cached blocks of every pool back to the
+     * shared lists, registered as a thread exit destructor
+     */
+    static void flush_thread(void*);
+
+ private:
+    slab_block* carve();
+    slab_block* take_batch(size_t& count);
+    void give_batch(slab_block* head, slab_block* tail);
+
+    slab_pool(const slab_pool&);
+    slab_pool& operator=(const slab_pool&);
+
+ private:
+    size_t          m_size;
+    size_t          m_batch;
+    unsigned        m_index;
+    mutex           m_mutex;
+    slab_block*     m_shared;
+};
+
+/*
+ * Typed front end for a pool of T, default constructed
+ */
+template<typename T>
+class object_pool
+{
+ public:
+    object_pool() : m_slab(sizeof(T)) {}
+
+    T* create() { return new (m_slab.allocate()) T(); }
+
+    void destroy(T* p)
+    {
+        p->~T();
+        m_slab.deallocate(p);
+    }
+
+ private:
+    slab_pool   m_slab;
+};
+
+/*
+ * Variable sized blocks from size classes spaced half a power of two apart
+ * (32, 48, 64, 96, ... 256K), so at most a third of a block goes unused. The
+ * caller passes the size it allocated with back to slab_deallocate.
+ */
+void* slab_allocate(size_t size);
+void slab_deallocate(void* p, size_t size);
+
+/*
+ * Size of the block slab_allocate(size) returns, all of it usable
+ */
+size_t slab_usable_size(size_t size);
+
+/*
+ * Backing store for the pools: 2MB regions handed out in chunks. With huge
+ * pages on, regions are mapped with MAP_HUGETLB or, failing that, aligned and
+ * advised for transparent huge pages. Call before the first allocation, it
+ * only affects regions mapped later.
+ */
+class slab_arena
+{
+ public:
+    static void set_hugepages(bool on);
+    static bool hugepages();
+
+    static void* allocate(size_t size);
+
+    /*
+     * Bytes mapped so far
+     */
+    static size_t mapped();
+};
+
+/*
+ * Standard allocator over slab_allocate, for containers on the packet path
+ */
+template<typename T>
+class slab_allocator
+{
+ public:
+    typedef T               value_type;
+    typedef T*              pointer;
+    typedef const T*        const_pointer;
+    typedef T&              reference;
+    typedef const T&        const_reference;
+    typedef size_t          size_type;
+    typedef ptrdiff_t       difference_type;
+
+    template<typename U> struct rebind { typedef slab_allocator<U> other; };
+
+    slab_allocator() {}
+    template<typename U> slab_allocator(const slab_allocator<U>&) {}
+
+    pointer address(reference x) const { return &x; }
+    const_pointer address(const_reference x) const { return &x; }
+
+    pointer allocate(size_type n, const void* = 0)
+    {
+        void* p = slab_allocate(n * sizeof(T));
+        if (!p)
+            throw std::bad_alloc();
+        return (pointer)p;
+    }
+
+    void deallocate(pointer p, size_type n) { slab_deallocate(p, n * sizeof(T)); }
+
+    size_type max_size() const { return (size_type)-1 / sizeof(T); }
+
+    void construct(pointer p, const T& v) { new ((void*)p) T(v); }
+    void destroy(pointer p) { p->~T(); }
+};
+
+template<typename T, typename U>
+inline bool operator==(const slab_allocator<T>&, const slab_allocator<U>&) { return true; }
+
+template<typename T, typename U>
+inline bool operator!=(const slab_allocator<T>&, const slab_allocator<U>&) { return false; }
+
+} //namespace vodeox
+
+#endif
@@ -0,0 +1,23 @@
+#include "config.h"
+
+#include "base/task.h"
+#include "base/slab.h"
+
+namespace vodeox
+{
+
+//tasks move from the submitting thread to a worker, the slab caches balance that
+static slab_pool s_task_pool(sizeof(task));
+static slab_pool s_large_pool(task::LARGE_SIZE);
+
+void* task::allocate(pool_class c)
+{
+    return (c == POOL_TASK ? s_task_pool : s_large_pool).allocate();
+}
+
+void task::deallocate(pool_class c, void* p)
+{
+    (c == POOL_TASK ? s_task_pool : s_large_pool).deallocate(p);
+}
+
+} //namespace vodeox
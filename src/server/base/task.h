@@ -0,0 +1,115 @@
+#ifndef __TASK_H
+#define __TASK_H
+
+#include <stddef.h>
+#include <new>
+
+#include "base/types.h"
+
+namespace vodeox
+{
+
+/*
+ * Type erased, move-only unit of work for the Threadpool. Tasks are carved out
+ * of per-thread pools instead of the heap: a callable that fits INLINE_SIZE
+ * lives right inside the task, a bigger one gets a block from a second pool,
+ * and only callables larger than LARGE_SIZE fall back to new. Queues pass
+ * task pointers around, the task gives its memory back once it has run.
+ *
+ * Callables are plain function objects with a void operator()().
+ */
+class task
+{
+ public:
+    enum
+    {
+        INLINE_SIZE = 88,
+        LARGE_SIZE = 480
+    };
+
+    template<typename F>
+    static task* create(const F& f)
+    {
+        task* t = new (allocate(POOL_TASK)) task();
+
+        if (sizeof(F) <= INLINE_SIZE)
+        {
+            t->m_fn = new (t->m_storage) F(f);
+            t->m_destroy = &destroy_inline<F>;
+        }
+        else if (sizeof(F) <= LARGE_SIZE)
+        {
+            t->m_fn = new (allocate(POOL_LARGE)) F(f);
+            t->m_destroy = &destroy_large<F>;
+        }
+        else
+        {
+            t->m_fn = new F(f);
+            t->m_destroy = &destroy_heap<F>;
+        }
+        t->m_invoke = &invoke<F>;
+        return t;
+    }
+
+    /*
+     * Runs the callable and releases the task, the pointer is dead afterwards
+     */
+    void run()
+    {
+        m_invoke(m_fn);
+        release();
+    }
+
+    /*
+     * Intrusive link for code that parks tasks on its own lists, a queued
+     * task is never on such a list at the same time
+     */
+    task* next() const { return m_next; }
+    void set_next(task* t) { m_next = t; }
+
+    /*
+     * Releases the task without running it
+     */
+    void release()
+    {
+        m_destroy(m_fn);
+        deallocate(POOL_TASK, this);
+    }
+
+ private:
+    enum pool_class
+    {
+        POOL_TASK = 0,
+        POOL_LARGE
+    };
+
+    static void* allocate(pool_class c);
+    static void deallocate(pool_class c, void* p);
+
+    template<typename F> static void invoke(void* p) { (*(F*)p)(); }
+    template<typename F> static void destroy_inline(void* p) { ((F*)p)->~F(); }
+    template<typename F> static void destroy_large(void* p) { ((F*)p)->~F(); deallocate(POOL_LARGE, p); }
+    template<typename F> static void destroy_heap(void* p) { delete (F*)p; }
+
+    task() : m_next(NULL) {}
+    ~task() {}
+    task(const task&);
+    task& operator=(const task&);
+
+ private:
+    void    (*m_invoke)(void*);
+    void    (*m_destroy)(void*);
+    void*   m_fn;
+    task*   m_next;
+
+    union
+    {
+        char        m_storage[INLINE_SIZE];
+        long double m_align;
+        void*       m_align_ptr;
+    };
+};
+
+} //namespace vodeox
+
+#endif
@@ -1,13 +1,37 @@
 #include "base/threadpool.h"
 #include "base/Logger.h"
+#include "base/metrics.h"
 
 namespace vodeox
 {
 
 static const char* component = "Threadpool";
 
-Worker::Worker(WorkQueue& wi_queue)
-               : m_items_queue(wi_queue), m_bIsRunning(false)
+//how many rounds an idle work stealing worker polls before it parks
+static const int IDLE_SPINS = 64;
+
+//the worker running on this thread, if any
+static __thread Worker* s_current_worker = NULL;
+
+//shared by every pool in the process
+static histogram s_queue_wait("threadpool.queue_wait_ns");
+static histogram s_task_run("threadpool.task_run_ns");
+static counter s_tasks("threadpool.tasks");
+static counter s_overflow("threadpool.overflow_inline");
+
+static inline void run_task(task* t)
+{
+    uint64 start = vodeox::time::tsc_ns();
+    t->run();
+    //tsc_ns can step back when it re-anchors
+    uint64 end = vodeox::time::tsc_ns();
+    s_task_run.record(end > start ? end - start : 0);
+    s_tasks.add();
+}
+
+Worker::Worker(Threadpool& pool, int index)
+               : m_pool(pool), m_index(index), m_bIsRunning(false),
+                 m_seed(2654435761u * (index + 1))
 {
     LOG_INFO(component, "Worker created.");
 }
@@ -15,34 +39,107 @@ Worker::Worker(WorkQueue& wi_queue)
 Worker::~Worker()
 {
     LOG_INFO(component, "Worker destroyed.");
+
+    task* t;
+    while (m_deque.take(t))
+        t->release();
 }
 
 void Worker::run()
 {
     LOG_INFO(component, "Worker run.");
 
+    s_current_worker = this;
+    if (m_pool.m_schedule == Threadpool::SCHEDULE_WORK_STEALING)
+        run_stealing();
+    else
+        run_shared();
+    s_current_worker = NULL;
+}
+
+void Worker::run_shared()
+{
+    while (m_bIsRunning)
+    {
+        //one item at a time, so a burst of submissions spreads over the workers
+        task* t;
+        if (m_pool.m_witems.wait_and_pop(t))
+            run_task(t);
+    }
+}
+
+void Worker::run_stealing()
+{
+    int idle = 0;
     while (m_bIsRunning)
     {
-        std::vector<std::tr1::shared_ptr<WorkItem> > items;
-        m_items_queue.wait_and_pop(items);
+        task* t;
+        if (find_work(t))
+        {
+            run_task(t);
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < IDLE_SPINS)
+        {
+            cpu_relax();
+            continue;
+        }
 
-        for (int i = 0; i < items.size(); i++)
-            items[i]->execute();
+        m_pool.park(*this);
+        idle = 0;
     }
 }
 
+bool Worker::find_work(task*& t)
+{
+    //own deque first (LIFO keeps it cache warm), then outside submissions,
+    //then everybody else's deques (FIFO end)
+    if (m_deque.take(t))
+        return true;
+    if (m_pool.m_witems.try_pop(t))
+        return true;
+    return steal(t);
+}
+
+bool Worker::steal(task*& t)
+{
+    int n = m_pool.size();
+    if (n <= 1)
+        return false;
+
+    //xorshift, start at a random victim and sweep the rest
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+
+    int start = m_seed % n;
+    for (int i = 0; i < n; i++)
+    {
+        Worker& victim = *m_pool.m_workers[(start + i) % n];
+        if (&victim != this && victim.m_deque.steal(t))
+            return true;
+    }
+    return false;
+}
+
 void Worker::shutdown()
 {
-    m_bIsRunning = true;
+    m_bIsRunning = false;
 }
 
-Threadpool::Threadpool(int numThreads)
+Threadpool::Threadpool(int numThreads, SCHEDULE schedule)
+    : m_schedule(schedule), m_bStarted(false), m_idle_workers(0)
 {
     LOG_INFO(component, "Threadpool created");
 
+    //work stealing deques aren't measured, only the shared queue
+    m_witems.set_wait_histogram(&s_queue_wait);
+
     for (int i = 0; i < numThreads; i++)
     {
-        std::tr1::shared_ptr<Worker> w(new Worker(m_witems));
+        std::tr1::shared_ptr<Worker> w(new Worker(*this, i));
         m_workers.push_back(w);
     }
 }
@@ -57,23 +154,132 @@ void Threadpool::start()
 {
     LOG_INFO(component, "Threadpool start");
 
-    for (int i = 0; i < m_workers.size(); i++)
+    if (m_bStarted)
+        return;
+    m_bStarted = true;
+
+    m_witems.restart();
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        m_workers[i]->m_bIsRunning = true;
         m_workers[i]->start(m_workers[i].get());
+    }
 }
 
 void Threadpool::stop()
 {
     LOG_INFO(component, "Threadpool stop");
 
-    for (int i = 0; i < m_workers.size(); i++)
+    if (!m_bStarted)
+        return;
+
+    for (size_t i = 0; i < m_workers.size(); i++)
         m_workers[i]->shutdown();
+
+    m_witems.shutdown();
+    {
+        scoped_lock lock(mutex);
+        m_idle.notify_all();
+    }
+
+    for (size_t i = 0; i < m_workers.size(); i++)
+        m_workers[i]->join();
+
+    std::vector<task*> pending;
+    m_witems.pop(pending);
+    for (size_t i = 0; i < pending.size(); i++)
+        pending[i]->release();
+
+    m_bStarted = false;
 }
 
+/*
+ * Adapts the WorkItem interface to a task
+ */
+struct work_item_call
+{
+    WorkItemPtr item;
+
+    work_item_call(const WorkItemPtr& wi) : item(wi) {}
+    void operator()() { item->execute(); }
+};
+
 void Threadpool::add(std::tr1::shared_ptr<WorkItem>& wi)
 {
-    LOG_INFO(component, "Threadpool got new item");
+    submit(work_item_call(wi));
+}
+
+Worker* Threadpool::current_worker() const
+{
+    Worker* w = s_current_worker;
+    return (w && &w->m_pool == this) ? w : NULL;
+}
+
+void Threadpool::enqueue(task* t, Worker* w)
+{
+    if (m_schedule == SCHEDULE_WORK_STEALING && w)
+        w->m_deque.push(t);
+    else if (!m_witems.try_push(t))
+    {
+        //the shared queue is bounded, a worker blocking on it could end up
+        //waiting for itself, so workers run the overflow inline
+        if (w)
+        {
+            s_overflow.add();
+            run_task(t);
+        }
+        else
+            m_witems.push(t);
+    }
+}
+
+void Threadpool::submit(task* t)
+{
+    enqueue(t, current_worker());
+    if (m_schedule == SCHEDULE_WORK_STEALING)
+        wake_idle();
+}
+
+void Threadpool::submit_batch(task* const* tasks, size_t n)
+{
+    Worker* w = current_worker();
+    for (size_t i = 0; i < n; i++)
+        enqueue(tasks[i], w);
+    if (m_schedule == SCHEDULE_WORK_STEALING && n > 0)
+        wake_idle(n > 1);
+}
+
+bool Threadpool::has_work() const
+{
+    if (!m_witems.empty())
+        return true;
+    for (size_t i = 0; i < m_workers.size(); i++)
+        if (m_workers[i]->m_deque.size() > 0)
+            return true;
+    return false;
+}
+
+void Threadpool::wake_idle(bool all)
+{
+    //pairs with the increment in park(), one side always sees the other
+    atomic_fence();
+    if (atomic_load_relaxed(&m_idle_workers) > 0)
+    {
+        scoped_lock lock(mutex);
+        if (all)
+            m_idle.notify_all();
+        else
+            m_idle.notify();
+    }
+}
 
-    m_witems.push(wi);
+void Threadpool::park(Worker& w)
+{
+    scoped_lock lock(mutex);
+    atomic_fetch_add(&m_idle_workers, 1);
+    while (w.m_bIsRunning && !has_work())
+        m_idle.wait(mutex);
+    atomic_fetch_sub(&m_idle_workers, 1);
 }
 
 } //namespace vodeox
@@ -6,6 +6,8 @@
 
 #include "base/scoped_lock.h"
 #include "base/concurrent_queue.h"
+#include "base/work_stealing_deque.h"
+#include "base/task.h"
 
 namespace vodeox
 {
@@ -13,39 +15,115 @@ namespace vodeox
 class WorkItem
 {
  public:
+    virtual ~WorkItem() {}
     virtual void execute() {}
 };
 
-typedef vodeox::concurrent_queue<std::tr1::shared_ptr<WorkItem> >  WorkQueue;
+typedef std::tr1::shared_ptr<WorkItem> WorkItemPtr;
+typedef vodeox::concurrent_queue<task*>  WorkQueue;
+
+class Threadpool;
 
 class Worker : public vodeox::thread
 {
  protected:
-    WorkQueue&                  m_items_queue;
-    bool                        m_bIsRunning;
+    Threadpool&                         m_pool;
+    int                                 m_index;
+    volatile bool                       m_bIsRunning;
+
+    //work stealing mode only, owned by this worker
+    work_stealing_deque<task*>          m_deque;
+    unsigned int                        m_seed;
+
+    friend class Threadpool;
  public:
-    Worker(WorkQueue& wi_queue);
+    Worker(Threadpool& pool, int index);
     virtual ~Worker();
 
     void run();
     void shutdown();
+
+ private:
+    void run_shared();
+    void run_stealing();
+
+    bool find_work(task*& t);
+    bool steal(task*& t);
 };
 
 class Threadpool
 {
+ public:
+    typedef enum {
+        /*
+         * every worker takes items one at a time from the shared queue
+         */
+        SCHEDULE_SHARED = 0,
+        /*
+         * every worker has its own deque, items submitted from a worker go to
+         * its deque, idle workers steal from random victims and from the shared
+         * queue that takes submissions from outside the pool
+         */
+        SCHEDULE_WORK_STEALING
+    } SCHEDULE;
+
  protected:
     vodeox::mutex                               mutex;
     std::vector<std::tr1::shared_ptr<Worker> >  m_workers;
     WorkQueue                                   m_witems;
 
+    SCHEDULE                                    m_schedule;
+    bool                                        m_bStarted;
+
+    //parking lot for idle work stealing workers
+    vodeox::condition_variable                  m_idle;
+    volatile int                                m_idle_workers;
+
+    friend class Worker;
  public:
-    Threadpool(int numThreads=10);
+    Threadpool(int numThreads=10, SCHEDULE schedule=SCHEDULE_SHARED);
     virtual ~Threadpool();
 
     void start();
+
+    /*
+     * Stops and joins the workers, items that haven't started yet are dropped
+     */
     void stop();
 
+    /*
+     * Runs a function object with a void operator()() on the pool. Small
+     * callables are stored inline in a pooled task, so this doesn't touch
+     * the allocator, take a lock or log anything.
+     */
+    template<typename F>
+    void submit(const F& f)
+    {
+        submit(task::create(f));
+    }
+
+    /*
+     * The pool takes ownership of the task
+     */
+    void submit(task* t);
+
+    /*
+     * Submits n tasks and wakes idle workers once for the whole batch
+     */
+    void submit_batch(task* const* tasks, size_t n);
+
     void add(std::tr1::shared_ptr<WorkItem>& wi); 
+
+    SCHEDULE schedule() const { return m_schedule; }
+    int size() const { return (int)m_workers.size(); }
+
+ protected:
+    Worker* current_worker() const;
+    void enqueue(task* t, Worker* w);
+
+    bool has_work() const;
+    void wake_idle(bool all = false);
+    void park(Worker& w);
 };
 
 } //namespace 
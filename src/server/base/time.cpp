@@ -1,4 +1,12 @@
+#include "config.h"
+
 #include "base/time.h"
+#include "base/atomic.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#define VODEOX_HAVE_TSC 1
+#endif
 
 namespace vodeox
 {
@@ -10,4 +18,214 @@ std::ostream &
      return ostr;
  }
 
+static volatile int s_calibrated = 0;
+
+//per thread loop time, see tick()
+static __thread uint64 s_loop_ns = 0;
+static __thread uint64 s_loop_usec = 0;
+
+#ifdef VODEOX_HAVE_TSC
+static const uint64 CALIBRATION_NS = 10000000ULL;
+static const uint64 RESYNC_NS = 1000000000ULL;
+
+/*
+ * tsc_ns() = mono_base + (tsc - tsc_base) * mult >> 32. Readers copy the
+ * parameters under a sequence lock, whoever notices they are a second old
+ * re-anchors them. The rate is taken from the first calibration sample to the
+ * latest anchor, so it gets more precise the longer the process runs.
+ */
+struct tsc_params
+{
+    uint64  tsc_base;
+    uint64  mono_base;
+    uint64  mult;
+    uint64  resync_ticks;
+    int64   wall_offset;    //CLOCK_REALTIME - CLOCK_MONOTONIC, ns
+};
+
+static volatile uint32 s_seq = 0;
+static volatile uint64 s_tsc_base = 0;
+static volatile uint64 s_mono_base = 0;
+static volatile uint64 s_mult = 0;
+static volatile uint64 s_resync_ticks = 0;
+static volatile int64 s_wall_offset = 0;
+
+static volatile int s_resyncing = 0;
+static uint64 s_tsc_origin = 0;
+static uint64 s_mono_origin = 0;
+
+static int64 realtime_offset(uint64 mono)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64)((uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec) - (int64)mono;
+}
+
+static inline uint64 read_tsc()
+{
+    uint32 lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64)hi << 32) | lo;
+}
+
+//the counter ticks at a constant rate through frequency and power state changes
+static bool invariant_tsc()
+{
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007)
+        return false;
+    __get_cpuid(0x80000007, &a, &b, &c, &d);
+    return (d & (1 << 8)) != 0;
+}
+
+static void read_params(tsc_params& p)
+{
+    for (;;)
+    {
+        uint32 seq = atomic_load(&s_seq);
+        if (seq & 1)
+        {
+            cpu_relax();
+            continue;
+        }
+        p.tsc_base = atomic_load_relaxed(&s_tsc_base);
+        p.mono_base = atomic_load_relaxed(&s_mono_base);
+        p.mult = atomic_load_relaxed(&s_mult);
+        p.resync_ticks = atomic_load_relaxed(&s_resync_ticks);
+        p.wall_offset = atomic_load_relaxed(&s_wall_offset);
+        atomic_fence();
+        if (atomic_load_relaxed(&s_seq) == seq)
+            return;
+    }
+}
+
+//sample both clocks and publish new parameters, the caller owns s_resyncing
+static uint64 anchor()
+{
+    uint64 mono = time::monotonic_ns();
+    uint64 tsc = read_tsc();
+    uint64 mult = (uint64)(((unsigned __int128)(mono - s_mono_origin) << 32) / (tsc - s_tsc_origin));
+    int64 offset = realtime_offset(mono);
+
+    atomic_store_relaxed(&s_seq, s_seq + 1);
+    atomic_fence();
+    atomic_store_relaxed(&s_tsc_base, tsc);
+    atomic_store_relaxed(&s_mono_base, mono);
+    atomic_store_relaxed(&s_mult, mult);
+    atomic_store_relaxed(&s_resync_ticks, (uint64)(((unsigned __int128)RESYNC_NS << 32) / mult));
+    atomic_store_relaxed(&s_wall_offset, offset);
+    atomic_store(&s_seq, s_seq + 1);
+    return mono;
+}
+
+static uint64 tsc_clock(int64& wall_offset)
+{
+    tsc_params p;
+    read_params(p);
+    uint64 tsc = read_tsc();
+
+    //another cpu's counter may be a few ticks behind the base
+    uint64 delta = tsc > p.tsc_base ? tsc - p.tsc_base : 0;
+    if (delta > p.resync_ticks)
+    {
+        int expected = 0;
+        if (atomic_cas(&s_resyncing, expected, 1))
+        {
+            uint64 mono = anchor();
+            wall_offset = atomic_load_relaxed(&s_wall_offset);
+            atomic_store(&s_resyncing, 0);
+            return mono;
+        }
+    }
+
+    wall_offset = p.wall_offset;
+    return p.mono_base + (uint64)(((unsigned __int128)delta * p.mult) >> 32);
+}
+#endif
+
+bool time::calibrate()
+{
+#ifdef VODEOX_HAVE_TSC
+    if (atomic_load(&s_calibrated))
+        return true;
+    if (!invariant_tsc())
+        return false;
+
+    int expected = 0;
+    if (!atomic_cas(&s_resyncing, expected, 1))
+        return false;
+
+    s_mono_origin = monotonic_ns();
+    s_tsc_origin = read_tsc();
+    while (monotonic_ns() - s_mono_origin < CALIBRATION_NS)
+        cpu_relax();
+    anchor();
+
+    atomic_store(&s_calibrated, 1);
+    atomic_store(&s_resyncing, 0);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool time::tsc_calibrated()
+{
+    return atomic_load(&s_calibrated) != 0;
+}
+
+uint64 time::tsc_ns()
+{
+#ifdef VODEOX_HAVE_TSC
+    if (atomic_load(&s_calibrated))
+    {
+        int64 offset;
+        return tsc_clock(offset);
+    }
+#endif
+    return monotonic_ns();
+}
+
+time time::fast_now()
+{
+#ifdef VODEOX_HAVE_TSC
+    if (atomic_load(&s_calibrated))
+    {
+        int64 offset;
+        uint64 mono = tsc_clock(offset);
+        return time((uint64)((int64)mono + offset) / 1000);
+    }
+#endif
+    return now();
+}
+
+void time::tick()
+{
+#ifdef VODEOX_HAVE_TSC
+    if (atomic_load(&s_calibrated))
+    {
+        int64 offset;
+        s_loop_ns = tsc_clock(offset);
+        s_loop_usec = (uint64)((int64)s_loop_ns + offset) / 1000;
+        return;
+    }
+#endif
+    s_loop_ns = monotonic_ns();
+    s_loop_usec = now().usec();
+}
+
+time time::loop_now()
+{
+    if (!s_loop_usec)
+        tick();
+    return time(s_loop_usec);
+}
+
+uint64 time::loop_ns()
+{
+    if (!s_loop_ns)
+        tick();
+    return s_loop_ns;
+}
+
 }//namespace
@@ -2,6 +2,7 @@
 #define __TIME_H
 
 #include <sys/time.h>
+#include <time.h>
 #include <stdio.h>
 
 #include <ostream>
@@ -11,6 +12,20 @@
 namespace vodeox
 {
 
+/*
+ * A wall clock timestamp in microseconds, plus the process' clocks:
+ *
+ *  now()           wall clock, gettimeofday
+ *  monotonic_ns()  CLOCK_MONOTONIC, for anything measuring intervals
+ *  tsc_ns()        CLOCK_MONOTONIC extrapolated from the cycle counter once
+ *                  calibrate() ran on a cpu with an invariant TSC, a multiply
+ *                  instead of a vDSO call. Re-anchored to CLOCK_MONOTONIC once
+ *                  a second, so it tracks it within microseconds but may step
+ *                  by that much. Same as monotonic_ns() without a usable TSC.
+ *  fast_now()      wall clock derived from tsc_ns(), what log calls stamp with
+ *  loop_now()      wall clock as of the calling thread's last tick(), event
+ *  loop_ns()       loops tick once per iteration so callbacks read it for free
+ */
 class time
 {
     //this has a number of miscroseconds since 1970
@@ -86,6 +101,34 @@ class time
         return m_time / 1000000;
     }
 
+    static uint64 monotonic_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    /*
+     * Measures the TSC rate against CLOCK_MONOTONIC, spins for a few
+     * milliseconds. Call once at startup, false if there is no invariant
+     * TSC to use.
+     */
+    static bool calibrate();
+
+    static bool tsc_calibrated();
+
+    static uint64 tsc_ns();
+
+    static time fast_now();
+
+    /*
+     * Refreshes the calling thread's loop time
+     */
+    static void tick();
+
+    static time loop_now();
+    static uint64 loop_ns();
+
 };
 
 std::ostream &
@@ -0,0 +1,140 @@
+#include "config.h"
+
+#include "base/timer_wheel.h"
+
+namespace vodeox
+{
+
+static const uint64 MAX_DELAY_TICKS = (1ULL << (timer_wheel::LEVEL_BITS * timer_wheel::LEVELS)) - 1;
+
+timer_wheel::timer_wheel(uint64 now_usec, uint64 tick_usec) :
+    m_tick(tick_usec ? tick_usec : DEFAULT_TIMER_TICK_USEC),
+    m_size(0)
+{
+    m_current = now_usec / m_tick;
+    for (int l = 0; l < LEVELS; l++)
+        for (int s = 0; s < SLOTS; s++)
+            m_slots[l][s].next = m_slots[l][s].prev = &m_slots[l][s];
+    m_expired.next = m_expired.prev = &m_expired;
+}
+
+timer_wheel::~timer_wheel()
+{
+    //the nodes belong to their owners, just leave them unlinked
+    for (int l = 0; l < LEVELS; l++)
+        for (int s = 0; s < SLOTS; s++)
+            while (m_slots[l][s].next != &m_slots[l][s])
+                unlink(m_slots[l][s].next);
+    while (m_expired.next != &m_expired)
+        unlink(m_expired.next);
+}
+
+void timer_wheel::link(timer_node* head, timer_node* node)
+{
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void timer_wheel::unlink(timer_node* node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node->prev = NULL;
+}
+
+void timer_wheel::schedule(timer_node* node, uint64 delay_usec, timer_callback callback, void* arg)
+{
+    node->callback = callback;
+    node->arg = arg;
+    schedule(node, delay_usec);
+}
+
+void timer_wheel::schedule(timer_node* node, uint64 delay_usec)
+{
+    if (node->pending())
+        cancel(node);
+
+    //m_current is the next tick to run, a zero delay fires with it
+    uint64 ticks = (delay_usec + m_tick - 1) / m_tick;
+    if (ticks > MAX_DELAY_TICKS)
+        ticks = MAX_DELAY_TICKS;
+    node->expires = m_current + ticks;
+    add(node);
+    m_size++;
+}
+
+void timer_wheel::cancel(timer_node* node)
+{
+    if (!node->pending())
+        return;
+    unlink(node);
+    m_size--;
+}
+
+void timer_wheel::add(timer_node* node)
+{
+    uint64 distance = node->expires > m_current ? node->expires - m_current : 0;
+    int level = 0;
+    while (level < LEVELS - 1 && distance >= (1ULL << (LEVEL_BITS * (level + 1))))
+        level++;
+
+    //overdue timers go into the slot that runs next
+    uint64 at = distance ? node->expires : m_current;
+    link(&m_slots[level][(at >> (LEVEL_BITS * level)) & (SLOTS - 1)], node);
+}
+
+void timer_wheel::cascade(int level, size_t index)
+{
+    timer_node* head = &m_slots[level][index];
+    while (head->next != head)
+    {
+        timer_node* node = head->next;
+        unlink(node);
+        add(node);
+    }
+}
+
+size_t timer_wheel::advance(uint64 now_usec)
+{
+    uint64 target = now_usec / m_tick;
+    size_t fired = 0;
+
+    while (m_current <= target)
+    {
+        size_t index = m_current & (SLOTS - 1);
+
+        //level 0 wrapped, pull the next slot of each wrapped level down
+        for (int l = 1; l < LEVELS && index == 0; l++)
+        {
+            index = (m_current >> (LEVEL_BITS * l)) & (SLOTS - 1);
+            cascade(l, index);
+        }
+        index = m_current & (SLOTS - 1);
+
+        //splice the slot out, the callbacks may touch the wheel
+        timer_node* head = &m_slots[0][index];
+        if (head->next != head)
+        {
+            m_expired.next = head->next;
+            m_expired.prev = head->prev;
+            head->next->prev = &m_expired;
+            head->prev->next = &m_expired;
+            head->next = head->prev = head;
+        }
+        m_current++;
+
+        while (m_expired.next != &m_expired)
+        {
+            timer_node* node = m_expired.next;
+            unlink(node);
+            m_size--;
+            fired++;
+            node->callback(node, node->arg);
+        }
+    }
+    return fired;
+}
+
+} //namespace vodeox
@@ -0,0 +1,96 @@
+#ifndef __BASE_TIMER_WHEEL_H
+#define __BASE_TIMER_WHEEL_H
+
+#include <stddef.h>
+
+#include "base/types.h"
+
+namespace vodeox
+{
+
+static const uint64 DEFAULT_TIMER_TICK_USEC = 10000;
+
+struct timer_node;
+
+typedef void (*timer_callback)(timer_node* node, void* arg);
+
+/*
+ * Intrusive timer, embedded in whatever it times out. The wheel only links
+ * it into its slot lists, the owner keeps the memory alive while it is
+ * pending and may reschedule or cancel it from any callback.
+ */
+struct timer_node
+{
+    timer_node*     next;
+    timer_node*     prev;
+    uint64          expires;    //tick
+    timer_callback  callback;
+    void*           arg;
+
+    timer_node() : next(NULL), prev(NULL), expires(0), callback(NULL), arg(NULL) {}
+
+    bool pending() const { return next != NULL; }
+};
+
+/*
+ * Hashed hierarchical timing wheel, four levels of 256 slots covering 2^32
+ * ticks. A timer goes into the level whose span holds its distance from now;
+ * whenever a level wraps, the next slot of the level above is cascaded down.
+ * schedule and cancel are a list insert/unlink, advance costs one slot per
+ * elapsed tick plus the timers that fire or cascade.
+ *
+ * Expired timers are moved to a separate list first and then fired one by
+ * one, so callbacks can freely schedule and cancel timers, including ones
+ * expiring in the same tick. Not thread safe, every event loop owns its own.
+ */
+class timer_wheel
+{
+ public:
+    enum
+    {
+        LEVEL_BITS = 8,
+        SLOTS = 1 << LEVEL_BITS,
+        LEVELS = 4
+    };
+
+    timer_wheel(uint64 now_usec, uint64 tick_usec = DEFAULT_TIMER_TICK_USEC);
+    virtual ~timer_wheel();
+
+    /*
+     * Arms node to fire delay_usec from the wheel's current time, rounded up
+     * to whole ticks; a pending node is moved
+     */
+    void schedule(timer_node* node, uint64 delay_usec, timer_callback callback, void* arg);
+    void schedule(timer_node* node, uint64 delay_usec);
+
+    void cancel(timer_node* node);
+
+    /*
+     * Runs every timer due by now_usec, returns how many fired
+     */
+    size_t advance(uint64 now_usec);
+
+    size_t size() const { return m_size; }
+    uint64 tick_usec() const { return m_tick; }
+
+ private:
+    void add(timer_node* node);
+    void cascade(int level, size_t index);
+
+    static void link(timer_node* head, timer_node* node);
+    static void unlink(timer_node* node);
+
+    timer_wheel(const timer_wheel&);
+    timer_wheel& operator=(const timer_wheel&);
+
+ private:
+    timer_node      m_slots[LEVELS][SLOTS];     //list heads
+    timer_node      m_expired;
+    uint64          m_tick;
+    uint64          m_current;                  //next tick to run
+    size_t          m_size;
+};
+
+} //namespace vodeox
+
+#endif
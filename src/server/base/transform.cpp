@@ -0,0 +1,410 @@
+#include "config.h"
+
+#include "base/transform.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VODEOX_X86_KERNELS 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace vodeox
+{
+
+// scalar kernels, also used for the tails of the vector loops
+
+static inline char rot13_char(char c)
+{
+    /* We don't want to use isalpha here; setting the locale would change
+     * which characters are considered alphabetical. */
+    if ((c >= 'a' && c <= 'm') || (c >= 'A' && c <= 'M'))
+        return c + 13;
+    else if ((c >= 'n' && c <= 'z') || (c >= 'N' && c <= 'Z'))
+        return c - 13;
+    else
+        return c;
+}
+
+static void rot13_scalar(char* dst, const char* src, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        dst[i] = rot13_char(src[i]);
+}
+
+static void fold_case_scalar(char* dst, const char* src, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = src[i];
+        dst[i] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+}
+
+/*
+ * pattern holds the key repeated to key_len + vector width bytes, so the key
+ * stream for any offset i is the contiguous run starting at i % key_len.
+ */
+static void xor_scalar(char* dst, const char* src, size_t len, const uint8* pattern, size_t key_len, size_t offset)
+{
+    size_t k = offset % key_len;
+    for (size_t i = 0; i < len; i++)
+    {
+        dst[i] = src[i] ^ pattern[k];
+        if (++k == key_len)
+            k = 0;
+    }
+}
+
+static uint64 sum16_scalar(const char* data, size_t len)
+{
+    uint64 sum = 0;
+    size_t i = 0;
+    for (; i + 1 < len; i += 2)
+    {
+        uint16 w;
+        memcpy(&w, data + i, 2);
+        sum += w;
+    }
+    if (i < len)
+    {
+        //pad the odd byte with a zero in memory order
+        uint8 tail[2] = { (uint8)data[i], 0 };
+        uint16 w;
+        memcpy(&w, tail, 2);
+        sum += w;
+    }
+    return sum;
+}
+
+#ifdef VODEOX_X86_KERNELS
+
+// SSE2 is part of the x86_64 baseline, AVX2 versions are compiled for
+// their own target and only called after a cpuid check.
+
+static void rot13_sse2(char* dst, const char* src, size_t len)
+{
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i a = _mm_set1_epi8('a');
+    const __m128i n25 = _mm_set1_epi8(25);
+    const __m128i n12 = _mm_set1_epi8(12);
+    const __m128i plus = _mm_set1_epi8(13);
+    const __m128i minus = _mm_set1_epi8(-13);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        //offset into the alphabet, letters end up in [0, 25] regardless of case
+        __m128i x = _mm_sub_epi8(_mm_or_si128(v, lower), a);
+        __m128i alpha = _mm_cmpeq_epi8(_mm_min_epu8(x, n25), x);
+        __m128i first = _mm_cmpeq_epi8(_mm_min_epu8(x, n12), x);
+        __m128i delta = _mm_or_si128(_mm_and_si128(first, plus), _mm_andnot_si128(first, minus));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(v, _mm_and_si128(delta, alpha)));
+    }
+    rot13_scalar(dst + i, src + i, len - i);
+}
+
+static void fold_case_sse2(char* dst, const char* src, size_t len)
+{
+    const __m128i A = _mm_set1_epi8('A');
+    const __m128i n25 = _mm_set1_epi8(25);
+    const __m128i lower = _mm_set1_epi8(0x20);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i x = _mm_sub_epi8(v, A);
+        __m128i upper = _mm_cmpeq_epi8(_mm_min_epu8(x, n25), x);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(v, _mm_and_si128(upper, lower)));
+    }
+    fold_case_scalar(dst + i, src + i, len - i);
+}
+
+static void xor_sse2(char* dst, const char* src, size_t len, const uint8* pattern, size_t key_len)
+{
+    size_t i = 0;
+    size_t k = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i key = _mm_loadu_si128((const __m128i*)(pattern + k));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(v, key));
+        k = (k + 16) % key_len;
+    }
+    xor_scalar(dst + i, src + i, len - i, pattern, key_len, i);
+}
+
+static uint64 sum16_sse2(const char* data, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint64 sum = 0;
+    size_t i = 0;
+
+    while (i + 16 <= len)
+    {
+        //32 bit lanes take 2 * 0xffff per round, fold well before they overflow
+        __m128i acc = _mm_setzero_si128();
+        for (int rounds = 0; rounds < 16384 && i + 16 <= len; rounds++, i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(v, zero),
+                                                   _mm_unpackhi_epi16(v, zero)));
+        }
+        uint32 lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        sum += (uint64)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return sum + sum16_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void rot13_avx2(char* dst, const char* src, size_t len)
+{
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    const __m256i a = _mm256_set1_epi8('a');
+    const __m256i n25 = _mm256_set1_epi8(25);
+    const __m256i n12 = _mm256_set1_epi8(12);
+    const __m256i plus = _mm256_set1_epi8(13);
+    const __m256i minus = _mm256_set1_epi8(-13);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i x = _mm256_sub_epi8(_mm256_or_si256(v, lower), a);
+        __m256i alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(x, n25), x);
+        __m256i first = _mm256_cmpeq_epi8(_mm256_min_epu8(x, n12), x);
+        __m256i delta = _mm256_blendv_epi8(minus, plus, first);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi8(v, _mm256_and_si256(delta, alpha)));
+    }
+    rot13_sse2(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void fold_case_avx2(char* dst, const char* src, size_t len)
+{
+    const __m256i A = _mm256_set1_epi8('A');
+    const __m256i n25 = _mm256_set1_epi8(25);
+    const __m256i lower = _mm256_set1_epi8(0x20);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i x = _mm256_sub_epi8(v, A);
+        __m256i upper = _mm256_cmpeq_epi8(_mm256_min_epu8(x, n25), x);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi8(v, _mm256_and_si256(upper, lower)));
+    }
+    fold_case_sse2(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(char* dst, const char* src, size_t len, const uint8* pattern, size_t key_len)
+{
+    size_t i = 0;
+    size_t k = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i key = _mm256_loadu_si256((const __m256i*)(pattern + k));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(v, key));
+        k = (k + 32) % key_len;
+    }
+    xor_scalar(dst + i, src + i, len - i, pattern, key_len, i);
+}
+
+__attribute__((target("avx2")))
+static uint64 sum16_avx2(const char* data, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint64 sum = 0;
+    size_t i = 0;
+
+    while (i + 32 <= len)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        for (int rounds = 0; rounds < 16384 && i + 32 <= len; rounds++, i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+            acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_unpacklo_epi16(v, zero),
+                                                         _mm256_unpackhi_epi16(v, zero)));
+        }
+        uint32 lanes[8];
+        _mm256_storeu_si256((__m256i*)lanes, acc);
+        for (int l = 0; l < 8; l++)
+            sum += lanes[l];
+    }
+    return sum + sum16_sse2(data + i, len - i);
+}
+
+#endif //VODEOX_X86_KERNELS
+
+static void xor_scalar_kernel(char* dst, const char* src, size_t len, const uint8* pattern, size_t key_len)
+{
+    xor_scalar(dst, src, len, pattern, key_len, 0);
+}
+
+/*
+ * Kernel table, filled in with the widest set once before main() runs
+ */
+struct transform_kernels
+{
+    void (*rot13)(char*, const char*, size_t);
+    void (*fold_case)(char*, const char*, size_t);
+    void (*xor_pattern)(char*, const char*, size_t, const uint8*, size_t);
+    uint64 (*sum16)(const char*, size_t);
+    const char* isa;
+
+    transform_kernels()
+    {
+        if (!select("avx2") && !select("sse2"))
+            select("scalar");
+    }
+
+    bool select(const char* name)
+    {
+        if (strcmp(name, "scalar") == 0)
+        {
+            rot13 = rot13_scalar;
+            fold_case = fold_case_scalar;
+            xor_pattern = xor_scalar_kernel;
+            sum16 = sum16_scalar;
+            isa = "scalar";
+            return true;
+        }
+
+#ifdef VODEOX_X86_KERNELS
+        __builtin_cpu_init();
+        if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        {
+            rot13 = rot13_avx2;
+            fold_case = fold_case_avx2;
+            xor_pattern = xor_avx2;
+            sum16 = sum16_avx2;
+            isa = "avx2";
+            return true;
+        }
+        if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+        {
+            rot13 = rot13_sse2;
+            fold_case = fold_case_sse2;
+            xor_pattern = xor_sse2;
+            sum16 = sum16_sse2;
+            isa = "sse2";
+            return true;
+        }
+#endif
+        return false;
+    }
+};
+
+static transform_kernels s_kernels;
+
+void rot13_bytes(char* dst, const char* src, size_t len)
+{
+    s_kernels.rot13(dst, src, len);
+}
+
+void fold_case_bytes(char* dst, const char* src, size_t len)
+{
+    s_kernels.fold_case(dst, src, len);
+}
+
+void xor_bytes(char* dst, const char* src, size_t len, const uint8* key, size_t key_len)
+{
+    if (key_len == 0 || key_len > MAX_XOR_KEY)
+    {
+        if (dst != src)
+            memmove(dst, src, len);
+        return;
+    }
+
+    //room for the widest vector load starting at any key offset
+    uint8 pattern[MAX_XOR_KEY + 32];
+    for (size_t i = 0; i < sizeof(pattern); i++)
+        pattern[i] = key[i % key_len];
+
+    s_kernels.xor_pattern(dst, src, len, pattern, key_len);
+}
+
+uint16 internet_checksum(const char* data, size_t len)
+{
+    //the one's complement sum doesn't care about byte order (RFC 1071 1.2.B),
+    //summing native words gives a value that is already in memory order
+    uint64 sum = s_kernels.sum16(data, len);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16)~sum;
+}
+
+const char* transform_isa()
+{
+    return s_kernels.isa;
+}
+
+bool set_transform_isa(const char* isa)
+{
+    return s_kernels.select(isa);
+}
+
+size_t rot13_filter::apply(char* dst, const char* src, size_t len, size_t room) const
+{
+    rot13_bytes(dst, src, len);
+    return len;
+}
+
+size_t fold_case_filter::apply(char* dst, const char* src, size_t len, size_t room) const
+{
+    fold_case_bytes(dst, src, len);
+    return len;
+}
+
+xor_filter::xor_filter(const uint8* key, size_t key_len) :
+    m_key_len(key_len < MAX_XOR_KEY ? key_len : MAX_XOR_KEY)
+{
+    memcpy(m_key, key, m_key_len);
+}
+
+size_t xor_filter::apply(char* dst, const char* src, size_t len, size_t room) const
+{
+    xor_bytes(dst, src, len, m_key, m_key_len);
+    return len;
+}
+
+size_t checksum_filter::apply(char* dst, const char* src, size_t len, size_t room) const
+{
+    //not even room for the checksum
+    if (room < 2)
+        return 0;
+    if (len + 2 > room)
+        len = room - 2;
+    if (dst != src)
+        memmove(dst, src, len);
+
+    uint16 sum = internet_checksum(dst, len);
+    memcpy(dst + len, &sum, 2);
+    return len + 2;
+}
+
+payload_filter* create_payload_filter(const std::string& spec, bool& ok)
+{
+    ok = true;
+    if (spec == "rot13")
+        return new rot13_filter();
+    if (spec == "lower")
+        return new fold_case_filter();
+    if (spec == "checksum")
+        return new checksum_filter();
+    if (spec.compare(0, 4, "xor:") == 0 && spec.size() > 4 && spec.size() - 4 <= MAX_XOR_KEY)
+        return new xor_filter((const uint8*)spec.c_str() + 4, spec.size() - 4);
+    if (spec == "none")
+        return NULL;
+
+    ok = false;
+    return NULL;
+}
+
+} //namespace vodeox
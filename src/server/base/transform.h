@@ -0,0 +1,98 @@
+#ifndef __TRANSFORM_H
+#define __TRANSFORM_H
+
+#include <stddef.h>
+
+#include <string>
+
+#include "base/types.h"
+
+namespace vodeox
+{
+
+/*
+ * Whole-buffer byte kernels. Each one has a scalar, an SSE2 and an AVX2
+ * version; the widest one the CPU supports is picked once at startup.
+ * dst may be equal to src for in place operation but the buffers must not
+ * otherwise overlap.
+ */
+void rot13_bytes(char* dst, const char* src, size_t len);
+void fold_case_bytes(char* dst, const char* src, size_t len);
+
+/*
+ * XORs src with key repeated over the whole buffer, keys up to
+ * MAX_XOR_KEY bytes long.
+ */
+static const size_t MAX_XOR_KEY = 64;
+void xor_bytes(char* dst, const char* src, size_t len, const uint8* key, size_t key_len);
+
+/*
+ * RFC 1071 internet checksum of the buffer, returned in network byte order.
+ */
+uint16 internet_checksum(const char* data, size_t len);
+
+/*
+ * Name of the kernel set picked at startup: "avx2", "sse2" or "scalar".
+ */
+const char* transform_isa();
+
+/*
+ * Switches to the named kernel set, false if this CPU or build doesn't have
+ * it. Meant for tests and benchmarks, no kernel may be running meanwhile.
+ */
+bool set_transform_isa(const char* isa);
+
+/*
+ * Per-payload filter hook. apply() writes the filtered form of src into dst
+ * (possibly the same buffer) and returns its length, which may be up to room
+ * bytes so filters can append trailers.
+ */
+class payload_filter
+{
+ public:
+    virtual ~payload_filter() {}
+    virtual size_t apply(char* dst, const char* src, size_t len, size_t room) const = 0;
+};
+
+class rot13_filter : public payload_filter
+{
+ public:
+    size_t apply(char* dst, const char* src, size_t len, size_t room) const;
+};
+
+class fold_case_filter : public payload_filter
+{
+ public:
+    size_t apply(char* dst, const char* src, size_t len, size_t room) const;
+};
+
+class xor_filter : public payload_filter
+{
+ public:
+    xor_filter(const uint8* key, size_t key_len);
+    size_t apply(char* dst, const char* src, size_t len, size_t room) const;
+
+ private:
+    uint8   m_key[MAX_XOR_KEY];
+    size_t  m_key_len;
+};
+
+/*
+ * Copies the payload and appends its 2 byte internet checksum.
+ */
+class checksum_filter : public payload_filter
+{
+ public:
+    size_t apply(char* dst, const char* src, size_t len, size_t room) const;
+};
+
+/*
+ * Builds a filter from a name: rot13, lower, checksum, xor:<key> or none
+ * (returns NULL for none and for unknown names or keys longer than
+ * MAX_XOR_KEY, see ok).
+ */
+payload_filter* create_payload_filter(const std::string& spec, bool& ok);
+
+} //namespace vodeox
+
+#endif
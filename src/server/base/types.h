@@ -8,6 +8,11 @@
     /// A 64-bit unsigned integer.
     typedef unsigned long long uint64;
 
+    /// Fixed width unsigned integers for wire formats and packed records.
+    typedef unsigned int uint32;
+    typedef unsigned short uint16;
+    typedef unsigned char uint8;
+
 #else
 #error "Unknown architecture"
 #endif
@@ -0,0 +1,150 @@
+#ifndef __WORK_STEALING_DEQUE_H
+#define __WORK_STEALING_DEQUE_H
+
+#include <stdlib.h>
+#include <vector>
+
+#include "base/atomic.h"
+
+namespace vodeox
+{
+
+/*
+ * Chase-Lev work stealing deque (with the memory orderings from Le et al.,
+ * "Correct and Efficient Work-Stealing for Weak Memory Models"). The owner
+ * thread pushes and takes at the bottom without any atomic read-modify-write
+ * except when racing for the last item, any other thread may steal from the
+ * top. The buffer grows on demand, retired buffers are kept until the deque
+ * is destroyed since a thief may still be reading from them.
+ *
+ * T has to be trivially copyable and small, it's meant for pointers.
+ */
+template<typename T>
+class work_stealing_deque
+{
+ private:
+    struct ring
+    {
+        long        size;
+        long        mask;
+        T*          items;
+
+        ring(long n) : size(n), mask(n - 1), items(new T[n]) {}
+        ~ring() { delete [] items; }
+
+        T get(long i) const { return __atomic_load_n(&items[i & mask], __ATOMIC_RELAXED); }
+        void put(long i, T x) { __atomic_store_n(&items[i & mask], x, __ATOMIC_RELAXED); }
+    };
+
+    char                m_pad0[VODEOX_CACHE_LINE];
+    volatile long       m_top;
+    char                m_pad1[VODEOX_CACHE_LINE - sizeof(long)];
+    volatile long       m_bottom;
+    ring* volatile      m_ring;
+    char                m_pad2[VODEOX_CACHE_LINE - sizeof(long) - sizeof(ring*)];
+
+    std::vector<ring*>  m_retired;
+
+ public:
+    work_stealing_deque(long capacity = 256) : m_top(0), m_bottom(0)
+    {
+        long n = 2;
+        while (n < capacity)
+            n <<= 1;
+        m_ring = new ring(n);
+    }
+
+    ~work_stealing_deque()
+    {
+        delete m_ring;
+        for (size_t i = 0; i < m_retired.size(); i++)
+            delete m_retired[i];
+    }
+
+    /*
+     * Owner only
+     */
+    void push(T x)
+    {
+        long b = atomic_load_relaxed(&m_bottom);
+        long t = atomic_load(&m_top);
+        ring* r = atomic_load_relaxed(&m_ring);
+        if (b - t > r->size - 1)
+            r = grow(r, t, b);
+        r->put(b, x);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        atomic_store_relaxed(&m_bottom, b + 1);
+    }
+
+    /*
+     * Owner only, LIFO end
+     */
+    bool take(T& x)
+    {
+        long b = atomic_load_relaxed(&m_bottom) - 1;
+        ring* r = atomic_load_relaxed(&m_ring);
+        atomic_store_relaxed(&m_bottom, b);
+        atomic_fence();
+        long t = atomic_load_relaxed(&m_top);
+
+        if (t > b)
+        {
+            atomic_store_relaxed(&m_bottom, b + 1);
+            return false;
+        }
+
+        x = r->get(b);
+        if (t == b)
+        {
+            //last item, race the thieves for it
+            bool won = __atomic_compare_exchange_n(&m_top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            atomic_store_relaxed(&m_bottom, b + 1);
+            return won;
+        }
+        return true;
+    }
+
+    /*
+     * Any thread, FIFO end. Returns false when empty or when another
+     * thread won the race for the item.
+     */
+    bool steal(T& x)
+    {
+        long t = atomic_load(&m_top);
+        atomic_fence();
+        long b = atomic_load(&m_bottom);
+        if (t >= b)
+            return false;
+
+        ring* r = atomic_load(&m_ring);
+        x = r->get(t);
+        return __atomic_compare_exchange_n(&m_top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+
+    /*
+     * Racy estimate, good enough to decide whether to go to sleep
+     */
+    long size() const
+    {
+        long n = atomic_load(&m_bottom) - atomic_load(&m_top);
+        return n > 0 ? n : 0;
+    }
+
+ private:
+    ring* grow(ring* r, long t, long b)
+    {
+        ring* bigger = new ring(r->size * 2);
+        for (long i = t; i < b; i++)
+            bigger->put(i, r->get(i));
+        m_retired.push_back(r);
+        atomic_store(&m_ring, bigger);
+        return bigger;
+    }
+
+    work_stealing_deque(const work_stealing_deque&);
+    work_stealing_deque& operator=(const work_stealing_deque&);
+};
+
+} //namespace vodeox
+
+#endif
@@ -0,0 +1,398 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "base/time.h"
+#include "base/atomic.h"
+#include "base/metrics.h"
+#include "base/scoped_lock.h"
+#include "base/concurrent_queue.h"
+#include "base/threadpool.h"
+#include "base/transform.h"
+#include "base/Logger.h"
+
+using vodeox::Logger;
+
+/*
+ * Microbenchmarks for the base library: queue handoff under varying producer
+ * and consumer counts, threadpool submit-to-run latency and throughput, log
+ * call cost on the calling thread, clock reads and the payload filters.
+ *
+ * Every result is one line, a benchmark name followed by key=value pairs, so
+ * runs can be collected and compared with a line of awk. The optional first
+ * argument only runs benchmarks whose name contains it, the second scales the
+ * iteration counts.
+ */
+
+static double s_scale = 1.0;
+static const char* s_filter = NULL;
+
+static bool selected(const char* name)
+{
+    return !s_filter || strstr(name, s_filter) != NULL;
+}
+
+static uint64 iterations(uint64 n)
+{
+    uint64 scaled = (uint64)(n * s_scale);
+    return scaled ? scaled : 1;
+}
+
+static void print_latency(const vodeox::histogram& h)
+{
+    vodeox::histogram_snapshot s;
+    h.snapshot(s);
+    printf(" mean_ns=%.0f p50_ns=%llu p90_ns=%llu p99_ns=%llu p99.9_ns=%llu max_ns=%llu",
+           s.mean(), (unsigned long long)s.quantile(0.5), (unsigned long long)s.quantile(0.9),
+           (unsigned long long)s.quantile(0.99), (unsigned long long)s.quantile(0.999),
+           (unsigned long long)s.max);
+}
+
+/*
+ * concurrent_queue: producers push their share of the items, consumers pop
+ * until they see a zero, which goes in once every producer is done
+ */
+typedef vodeox::concurrent_queue<uint64> bench_queue;
+
+class queue_producer : public vodeox::thread
+{
+ public:
+    queue_producer(bench_queue& q, uint64 n) : m_queue(q), m_n(n) {}
+    virtual ~queue_producer() {}
+
+    void run()
+    {
+        for (uint64 i = 1; i <= m_n; i++)
+            m_queue.push(i);
+    }
+
+ private:
+    bench_queue&    m_queue;
+    uint64          m_n;
+};
+
+class queue_consumer : public vodeox::thread
+{
+ public:
+    queue_consumer(bench_queue& q) : m_queue(q), m_popped(0) {}
+    virtual ~queue_consumer() {}
+
+    void run()
+    {
+        uint64 v;
+        while (m_queue.wait_and_pop(v) && v != 0)
+            m_popped++;
+    }
+
+    uint64 popped() const { return m_popped; }
+
+ private:
+    bench_queue&    m_queue;
+    uint64          m_popped;
+};
+
+static void bench_queue_uncontended()
+{
+    bench_queue q;
+    const uint64 n = iterations(10000000);
+
+    uint64 start = vodeox::time::monotonic_ns();
+    uint64 v;
+    for (uint64 i = 0; i < n; i++)
+    {
+        q.try_push(i);
+        q.try_pop(v);
+    }
+    double elapsed = (vodeox::time::monotonic_ns() - start) / 1e9;
+
+    printf("queue_push_pop threads=1 ops=%llu ns_per_op=%.2f\n",
+           (unsigned long long)n, elapsed * 1e9 / n);
+}
+
+static void bench_queue_threads(unsigned producers, unsigned consumers)
+{
+    bench_queue q;
+    const uint64 per_producer = iterations(2000000) / producers + 1;
+
+    std::vector<queue_producer*> p;
+    std::vector<queue_consumer*> c;
+    for (unsigned i = 0; i < consumers; i++)
+        c.push_back(new queue_consumer(q));
+    for (unsigned i = 0; i < producers; i++)
+        p.push_back(new queue_producer(q, per_producer));
+
+    uint64 start = vodeox::time::monotonic_ns();
+    for (unsigned i = 0; i < consumers; i++)
+        c[i]->start(static_cast<vodeox::thread*>(c[i]));
+    for (unsigned i = 0; i < producers; i++)
+        p[i]->start(static_cast<vodeox::thread*>(p[i]));
+
+    for (unsigned i = 0; i < producers; i++)
+        p[i]->join();
+    for (unsigned i = 0; i < consumers; i++)
+        q.push(0);
+
+    uint64 popped = 0;
+    for (unsigned i = 0; i < consumers; i++)
+    {
+        c[i]->join();
+        popped += c[i]->popped();
+    }
+    double elapsed = (vodeox::time::monotonic_ns() - start) / 1e9;
+
+    for (unsigned i = 0; i < producers; i++)
+        delete p[i];
+    for (unsigned i = 0; i < consumers; i++)
+        delete c[i];
+
+    printf("queue_mpmc producers=%u consumers=%u items=%llu items_per_sec=%.0f ns_per_item=%.2f\n",
+           producers, consumers, (unsigned long long)popped,
+           popped / elapsed, elapsed * 1e9 / popped);
+}
+
+/*
+ * Threadpool: ping-pong measures how long an idle pool takes to pick a task
+ * up, the burst how fast it drains a full queue
+ */
+struct timed_task
+{
+    timed_task(vodeox::histogram* h, volatile uint64* done) :
+        stamp(vodeox::time::tsc_ns()), latency(h), done(done) {}
+
+    void operator()()
+    {
+        uint64 now = vodeox::time::tsc_ns();
+        latency->record(now > stamp ? now - stamp : 0);
+        vodeox::atomic_fetch_add(done, (uint64)1);
+    }
+
+    uint64              stamp;
+    vodeox::histogram*  latency;
+    volatile uint64*    done;
+};
+
+static const char* schedule_name(vodeox::Threadpool::SCHEDULE schedule)
+{
+    return schedule == vodeox::Threadpool::SCHEDULE_SHARED ? "shared" : "stealing";
+}
+
+static void wait_for(volatile uint64* done, uint64 n)
+{
+    while (vodeox::atomic_load(done) < n)
+        vodeox::cpu_relax();
+}
+
+static void bench_pool_latency(int workers, vodeox::Threadpool::SCHEDULE schedule)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "bench.task_latency.%s.%d", schedule_name(schedule), workers);
+    vodeox::histogram latency(name);
+
+    vodeox::Threadpool pool(workers, schedule);
+    pool.start();
+
+    const uint64 n = iterations(20000);
+    volatile uint64 done = 0;
+    for (uint64 i = 0; i < n; i++)
+    {
+        pool.submit(timed_task(&latency, &done));
+        wait_for(&done, i + 1);
+    }
+    pool.stop();
+
+    printf("pool_submit_to_run schedule=%s workers=%d tasks=%llu",
+           schedule_name(schedule), workers, (unsigned long long)n);
+    print_latency(latency);
+    printf("\n");
+}
+
+static void bench_pool_burst(int workers, vodeox::Threadpool::SCHEDULE schedule)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "bench.task_burst.%s.%d", schedule_name(schedule), workers);
+    vodeox::histogram latency(name);
+
+    vodeox::Threadpool pool(workers, schedule);
+    pool.start();
+
+    const uint64 n = iterations(1000000);
+    volatile uint64 done = 0;
+    uint64 start = vodeox::time::monotonic_ns();
+    for (uint64 i = 0; i < n; i++)
+        pool.submit(timed_task(&latency, &done));
+    wait_for(&done, n);
+    double elapsed = (vodeox::time::monotonic_ns() - start) / 1e9;
+    pool.stop();
+
+    printf("pool_burst schedule=%s workers=%d tasks=%llu tasks_per_sec=%.0f",
+           schedule_name(schedule), workers, (unsigned long long)n, n / elapsed);
+    print_latency(latency);
+    printf("\n");
+}
+
+/*
+ * Logger: time spent in the LOG_* call, the logger thread does the rest.
+ * Filtered calls only check the call site.
+ */
+static void bench_log(const char* mode, bool deferred, bool filtered)
+{
+    Logger::setDeferred(deferred);
+
+    const uint64 n = iterations(500000);
+    uint64 start = vodeox::time::monotonic_ns();
+    for (uint64 i = 0; i < n; i++)
+    {
+        if (filtered)
+            LOG_DEBUG("bench", "filtered %llu %s", (unsigned long long)i, mode);
+        else
+            LOG_WARN("bench", "message %llu %s %.3f", (unsigned long long)i, mode, i * 0.5);
+    }
+    double elapsed = (vodeox::time::monotonic_ns() - start) / 1e9;
+
+    printf("log_call mode=%s calls=%llu ns_per_call=%.2f\n", mode, (unsigned long long)n, elapsed * 1e9 / n);
+}
+
+static void bench_logger()
+{
+    char path[] = "/tmp/vodeox_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        return;
+    }
+    close(fd);
+
+    Logger::setLevel(Logger::LOG_LEVEL_WARN);
+    Logger::setFileName(path);
+
+    bench_log("filtered", false, true);
+    bench_log("immediate", false, false);
+    bench_log("deferred", true, false);
+
+    Logger::stop();
+    unlink(path);
+}
+
+/*
+ * Clocks, ns per read
+ */
+//keeps the reads from being optimized away
+static volatile uint64 s_sink;
+
+template<typename F>
+static void bench_clock(const char* name, F read)
+{
+    const uint64 n = iterations(5000000);
+    uint64 sink = 0;
+    uint64 start = vodeox::time::monotonic_ns();
+    for (uint64 i = 0; i < n; i++)
+        sink += read();
+    double elapsed = (vodeox::time::monotonic_ns() - start) / 1e9;
+    s_sink = sink;
+
+    printf("clock_read clock=%s reads=%llu ns_per_read=%.2f\n",
+           name, (unsigned long long)n, elapsed * 1e9 / n);
+}
+
+static uint64 read_now() { return vodeox::time::now().usec(); }
+static uint64 read_fast_now() { return vodeox::time::fast_now().usec(); }
+static uint64 read_monotonic() { return vodeox::time::monotonic_ns(); }
+static uint64 read_tsc() { return vodeox::time::tsc_ns(); }
+static uint64 read_loop() { return vodeox::time::loop_ns(); }
+
+static void bench_clocks()
+{
+    bench_clock("now", read_now);
+    bench_clock("monotonic", read_monotonic);
+    if (vodeox::time::tsc_calibrated())
+    {
+        bench_clock("fast_now", read_fast_now);
+        bench_clock("tsc_ns", read_tsc);
+    }
+    bench_clock("loop_ns", read_loop);
+}
+
+/*
+ * Payload filters, bytes per second over a buffer of each size
+ */
+static void bench_filter(const char* spec, size_t len)
+{
+    bool ok;
+    vodeox::payload_filter* f = vodeox::create_payload_filter(spec, ok);
+    if (!ok)
+        return;
+
+    std::vector<char> in(len), out(len + 64);
+    for (size_t i = 0; i < len; i++)
+        in[i] = (char)(' ' + i % 95);
+
+    const uint64 n = iterations(200000000ULL / (len + 64));
+    uint64 start = vodeox::time::monotonic_ns();
+    for (uint64 i = 0; i < n; i++)
+        f->apply(&out[0], &in[0], len, out.size());
+    double elapsed = (vodeox::time::monotonic_ns() - start) / 1e9;
+    delete f;
+
+    printf("payload_filter filter=%s isa=%s size=%zu ns_per_call=%.2f mbytes_per_sec=%.1f\n",
+           spec, vodeox::transform_isa(), len, elapsed * 1e9 / n, (double)n * len / elapsed / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && argv[1][0])
+        s_filter = argv[1];
+    if (argc > 2)
+        s_scale = atof(argv[2]);
+    if (s_scale <= 0)
+        s_scale = 1.0;
+
+    vodeox::time::calibrate();
+
+    if (selected("queue"))
+    {
+        bench_queue_uncontended();
+        bench_queue_threads(1, 1);
+        bench_queue_threads(2, 2);
+        bench_queue_threads(4, 1);
+        bench_queue_threads(1, 4);
+    }
+
+    if (selected("pool"))
+    {
+        vodeox::Threadpool::SCHEDULE schedules[] = {
+            vodeox::Threadpool::SCHEDULE_SHARED,
+            vodeox::Threadpool::SCHEDULE_WORK_STEALING
+        };
+        for (int s = 0; s < 2; s++)
+        {
+            bench_pool_latency(1, schedules[s]);
+            bench_pool_latency(4, schedules[s]);
+            bench_pool_burst(4, schedules[s]);
+        }
+    }
+
+    if (selected("log"))
+        bench_logger();
+
+    if (selected("clock"))
+        bench_clocks();
+
+    if (selected("payload"))
+    {
+        const char* specs[] = { "rot13", "lower", "checksum", "xor:5a17" };
+        for (size_t s = 0; s < sizeof(specs) / sizeof(specs[0]); s++)
+        {
+            bench_filter(specs[s], 64);
+            bench_filter(specs[s], 1400);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,463 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "base/time.h"
+#include "base/atomic.h"
+#include "base/metrics.h"
+#include "base/scoped_lock.h"
+
+/*
+ * Load generator for the datagram path.
+ *
+ * Every thread owns a share of the peers, one connected UDP socket each, so
+ * the server sees them as distinct sources. A request starts with its send
+ * time as 20 decimal digits, which the rot13, lower, checksum and none filters
+ * echo back unchanged, and the round trip is taken from the reply.
+ *
+ * Closed loop (default) keeps up to window requests outstanding per peer and
+ * sends the next one as each reply arrives; a peer that hears nothing for the
+ * timeout gets its window back. Open loop (-r) sends at a fixed aggregate rate
+ * no matter how the replies keep up, so server queueing shows up as latency
+ * instead of slowing the sender down.
+ *
+ * Whatever hasn't come back within the timeout after the last request went
+ * out counts as lost.
+ */
+
+static const size_t STAMP_DIGITS = 20;
+static const size_t MAX_DATAGRAM = 65507;
+
+struct bench_options
+{
+    const char*     host;
+    const char*     port;
+    unsigned        threads;
+    unsigned        peers;
+    unsigned        window;
+    uint64          rate;           //requests per second, 0 = closed loop
+    unsigned        duration;       //seconds
+    size_t          size;
+    unsigned        timeout_ms;
+    unsigned        interval;       //seconds between progress lines, 0 = none
+    int             socket_buffer;
+
+    bench_options() :
+        host("127.0.0.1"),
+        port("40713"),
+        threads(1),
+        peers(16),
+        window(1),
+        rate(0),
+        duration(10),
+        size(64),
+        timeout_ms(1000),
+        interval(1),
+        socket_buffer(4 * 1024 * 1024) {}
+};
+
+static vodeox::counter s_sent("bench.sent");
+static vodeox::counter s_received("bench.received");
+static vodeox::counter s_send_errors("bench.send_errors");
+static vodeox::counter s_bad_replies("bench.bad_replies");
+static vodeox::counter s_timeouts("bench.timeouts");
+static vodeox::histogram s_rtt("bench.rtt_ns");
+
+//set once the duration is up, then once the stragglers had their timeout
+static volatile int s_stop_sending = 0;
+static volatile int s_stop = 0;
+static volatile sig_atomic_t s_interrupted = 0;
+
+static void on_interrupt(int)
+{
+    s_interrupted = 1;
+}
+
+struct peer
+{
+    int         fd;
+    unsigned    outstanding;
+    uint64      last_reply;     //ns
+};
+
+class load_thread : public vodeox::thread
+{
+ public:
+    load_thread(const bench_options& opts, const struct addrinfo* server, unsigned peers, uint64 rate) :
+        m_opts(opts),
+        m_rate(rate),
+        m_request(opts.size, 'x'),
+        m_reply(MAX_DATAGRAM)
+    {
+        for (unsigned i = 0; i < peers; i++)
+        {
+            int fd = socket(server->ai_family, SOCK_DGRAM, 0);
+            if (fd < 0)
+            {
+                perror("socket");
+                continue;
+            }
+            if (opts.socket_buffer > 0)
+            {
+                setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opts.socket_buffer, sizeof(opts.socket_buffer));
+                setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opts.socket_buffer, sizeof(opts.socket_buffer));
+            }
+            if (connect(fd, server->ai_addr, server->ai_addrlen) != 0)
+            {
+                perror("connect");
+                close(fd);
+                continue;
+            }
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+
+            peer p;
+            p.fd = fd;
+            p.outstanding = 0;
+            p.last_reply = 0;
+            m_peers.push_back(p);
+
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            m_pollfds.push_back(pfd);
+        }
+    }
+
+    virtual ~load_thread()
+    {
+        for (size_t i = 0; i < m_peers.size(); i++)
+            close(m_peers[i].fd);
+    }
+
+    void run()
+    {
+        if (m_peers.empty())
+            return;
+        if (m_rate)
+            run_open();
+        else
+            run_closed();
+    }
+
+ private:
+    bool send_request(peer& p, uint64 now)
+    {
+        //fixed width so the stamp can be parsed back without a terminator
+        char stamp[STAMP_DIGITS + 1];
+        snprintf(stamp, sizeof(stamp), "%020llu", (unsigned long long)now);
+        memcpy(&m_request[0], stamp, STAMP_DIGITS);
+
+        if (send(p.fd, &m_request[0], m_request.size(), 0) < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+                perror("send");
+            s_send_errors.add();
+            return false;
+        }
+        s_sent.add();
+        return true;
+    }
+
+    void drain(peer& p)
+    {
+        for (;;)
+        {
+            ssize_t n = recv(p.fd, &m_reply[0], m_reply.size(), MSG_DONTWAIT);
+            if (n < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+                    perror("recv");
+                return;
+            }
+
+            uint64 now = vodeox::time::monotonic_ns();
+            uint64 sent = 0;
+            bool ok = (size_t)n >= STAMP_DIGITS;
+            for (size_t i = 0; ok && i < STAMP_DIGITS; i++)
+            {
+                if (m_reply[i] < '0' || m_reply[i] > '9')
+                    ok = false;
+                else
+                    sent = sent * 10 + (m_reply[i] - '0');
+            }
+            if (!ok || sent > now)
+            {
+                s_bad_replies.add();
+                continue;
+            }
+
+            s_received.add();
+            s_rtt.record(now - sent);
+            if (p.outstanding)
+                p.outstanding--;
+            p.last_reply = now;
+        }
+    }
+
+    //waits at most timeout_ns for replies and reads whatever arrived
+    void poll_replies(uint64 timeout_ns)
+    {
+        struct timespec ts;
+        ts.tv_sec = timeout_ns / 1000000000ULL;
+        ts.tv_nsec = timeout_ns % 1000000000ULL;
+        int n = ppoll(&m_pollfds[0], m_pollfds.size(), &ts, NULL);
+        if (n <= 0)
+            return;
+        for (size_t i = 0; i < m_pollfds.size() && n > 0; i++)
+        {
+            if (!m_pollfds[i].revents)
+                continue;
+            n--;
+            drain(m_peers[i]);
+        }
+    }
+
+    void run_closed()
+    {
+        const uint64 timeout = m_opts.timeout_ms * 1000000ULL;
+
+        while (!vodeox::atomic_load_relaxed(&s_stop))
+        {
+            if (!vodeox::atomic_load_relaxed(&s_stop_sending))
+            {
+                uint64 now = vodeox::time::monotonic_ns();
+                for (size_t i = 0; i < m_peers.size(); i++)
+                {
+                    peer& p = m_peers[i];
+                    if (p.outstanding && now - p.last_reply > timeout)
+                    {
+                        s_timeouts.add(p.outstanding);
+                        p.outstanding = 0;
+                    }
+                    if (!p.outstanding)
+                        p.last_reply = now;
+                    while (p.outstanding < m_opts.window && send_request(p, now))
+                        p.outstanding++;
+                }
+            }
+            poll_replies(10000000ULL);
+        }
+    }
+
+    void run_open()
+    {
+        const uint64 gap = 1000000000ULL / m_rate;
+        uint64 next = vodeox::time::monotonic_ns();
+        size_t rr = 0;
+
+        while (!vodeox::atomic_load_relaxed(&s_stop))
+        {
+            uint64 now = vodeox::time::monotonic_ns();
+            uint64 wait = 10000000ULL;
+            if (!vodeox::atomic_load_relaxed(&s_stop_sending))
+            {
+                //fell behind by more than a second, don't make it up in one burst
+                if (now > next + 1000000000ULL)
+                    next = now;
+                while (next <= now)
+                {
+                    send_request(m_peers[rr++ % m_peers.size()], next);
+                    next += gap;
+                }
+                wait = next - now;
+            }
+            poll_replies(wait);
+        }
+    }
+
+    load_thread(const load_thread&);
+    load_thread& operator=(const load_thread&);
+
+ private:
+    const bench_options&    m_opts;
+    uint64                  m_rate;
+    std::vector<peer>       m_peers;
+    std::vector<struct pollfd> m_pollfds;
+    std::vector<char>       m_request;
+    std::vector<char>       m_reply;
+};
+
+static void report(const bench_options& opts, double elapsed)
+{
+    uint64 sent = s_sent.value();
+    uint64 received = s_received.value();
+    uint64 lost = sent > received ? sent - received : 0;
+
+    vodeox::histogram_snapshot rtt;
+    s_rtt.snapshot(rtt);
+
+    printf("load mode=%s threads=%u peers=%u window=%u rate=%llu size=%zu duration=%.2f\n",
+           opts.rate ? "open" : "closed", opts.threads, opts.peers, opts.window,
+           (unsigned long long)opts.rate, opts.size, elapsed);
+    printf("packets sent=%llu received=%llu lost=%llu loss_pct=%.3f send_errors=%llu bad_replies=%llu timeouts=%llu\n",
+           (unsigned long long)sent, (unsigned long long)received, (unsigned long long)lost,
+           sent ? 100.0 * lost / sent : 0.0,
+           (unsigned long long)s_send_errors.value(), (unsigned long long)s_bad_replies.value(),
+           (unsigned long long)s_timeouts.value());
+    printf("throughput tx_pps=%.0f rx_pps=%.0f rx_mbit=%.1f\n",
+           sent / elapsed, received / elapsed, received * opts.size * 8 / elapsed / 1e6);
+    printf("rtt_us mean=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+           rtt.mean() / 1000.0, rtt.quantile(0.5) / 1000.0, rtt.quantile(0.9) / 1000.0,
+           rtt.quantile(0.99) / 1000.0, rtt.quantile(0.999) / 1000.0, rtt.max / 1000.0);
+}
+
+static void sleep_ns(uint64 ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    nanosleep(&ts, NULL);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-H host] [-p port] [-t threads] [-n peers] [-w window per peer]\n"
+            "          [-r requests per second, 0 = closed loop] [-d duration, sec] [-l datagram size]\n"
+            "          [-T reply timeout, ms] [-i progress interval, sec, 0 = none] [-b socket buffer size, bytes]\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_options opts;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:t:n:w:r:d:l:T:i:b:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'H':
+            opts.host = optarg;
+            break;
+        case 'p':
+            opts.port = optarg;
+            break;
+        case 't':
+            opts.threads = atoi(optarg);
+            break;
+        case 'n':
+            opts.peers = atoi(optarg);
+            break;
+        case 'w':
+            opts.window = atoi(optarg);
+            break;
+        case 'r':
+            opts.rate = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            opts.duration = atoi(optarg);
+            break;
+        case 'l':
+            opts.size = atoi(optarg);
+            break;
+        case 'T':
+            opts.timeout_ms = atoi(optarg);
+            break;
+        case 'i':
+            opts.interval = atoi(optarg);
+            break;
+        case 'b':
+            opts.socket_buffer = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (opts.threads == 0)
+        opts.threads = 1;
+    if (opts.peers < opts.threads)
+        opts.peers = opts.threads;
+    if (opts.window == 0)
+        opts.window = 1;
+    if (opts.size < STAMP_DIGITS || opts.size > MAX_DATAGRAM)
+    {
+        fprintf(stderr, "datagram size must be between %zu and %zu\n", STAMP_DIGITS, MAX_DATAGRAM);
+        return 1;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo *server = NULL;
+    int err = getaddrinfo(opts.host, opts.port, &hints, &server);
+    if (err != 0)
+    {
+        fprintf(stderr, "%s:%s: %s\n", opts.host, opts.port, gai_strerror(err));
+        return 1;
+    }
+
+    std::vector<load_thread*> threads;
+    for (unsigned i = 0; i < opts.threads; i++)
+    {
+        unsigned peers = opts.peers / opts.threads + (i < opts.peers % opts.threads ? 1 : 0);
+        uint64 rate = opts.rate / opts.threads + (i < opts.rate % opts.threads ? 1 : 0);
+        if (opts.rate && rate == 0)
+            continue;
+        threads.push_back(new load_thread(opts, server, peers, rate));
+    }
+    freeaddrinfo(server);
+
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
+
+    uint64 start = vodeox::time::monotonic_ns();
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i]->start(static_cast<vodeox::thread*>(threads[i]));
+
+    const uint64 end = start + opts.duration * 1000000000ULL;
+    uint64 next_report = start + opts.interval * 1000000000ULL;
+    uint64 last_sent = 0, last_received = 0;
+    for (;;)
+    {
+        uint64 now = vodeox::time::monotonic_ns();
+        if (now >= end || s_interrupted)
+            break;
+        uint64 wake = end;
+        if (opts.interval && next_report <= now)
+        {
+            uint64 sent = s_sent.value(), received = s_received.value();
+            fprintf(stderr, "t=%.0f sent/s=%llu received/s=%llu\n", (now - start) / 1e9,
+                    (unsigned long long)((sent - last_sent) / opts.interval),
+                    (unsigned long long)((received - last_received) / opts.interval));
+            last_sent = sent;
+            last_received = received;
+            next_report += opts.interval * 1000000000ULL;
+        }
+        if (opts.interval && next_report < wake)
+            wake = next_report;
+        //wake up now and then to notice an interrupt
+        sleep_ns(std::min(wake - now, (uint64)100000000ULL));
+    }
+    double elapsed = (vodeox::time::monotonic_ns() - start) / 1e9;
+
+    //give the last replies their timeout before calling them lost
+    vodeox::atomic_store(&s_stop_sending, 1);
+    sleep_ns(opts.timeout_ms * 1000000ULL);
+    vodeox::atomic_store(&s_stop, 1);
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    report(opts, elapsed);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "net/protocol.h"
+
+/*
+ * Parse throughput of the signaling protocol: decodes datagrams holding
+ * back to back messages of a fixed body size and reports messages and
+ * bytes per second.
+ */
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class counting_handler : public vodeox::message_handler
+{
+ public:
+    counting_handler() : messages(0), bytes(0), errors(0) {}
+
+    void on_message(const vodeox::message& msg)
+    {
+        messages++;
+        bytes += msg.body_len;
+    }
+
+    void on_error(vodeox::decode_status status)
+    {
+        errors++;
+    }
+
+    uint64 messages;
+    uint64 bytes;
+    uint64 errors;
+};
+
+static void run(size_t body_len, size_t per_datagram, int iterations)
+{
+    std::vector<char> datagram;
+    std::vector<char> body(body_len, 'x');
+
+    for (size_t i = 0; i < per_datagram; i++)
+    {
+        char header[vodeox::MESSAGE_HEADER_SIZE];
+        vodeox::encode_header(header, vodeox::MSG_PUBLISH, 42, i, body_len);
+        datagram.insert(datagram.end(), header, header + sizeof(header));
+        datagram.insert(datagram.end(), body.begin(), body.end());
+    }
+
+    counting_handler h;
+    double start = now_sec();
+    for (int i = 0; i < iterations; i++)
+        vodeox::dispatch_messages(&datagram[0], datagram.size(), h);
+    double elapsed = now_sec() - start;
+
+    if (h.errors)
+        fprintf(stderr, "unexpected decode errors: %llu\n", h.errors);
+
+    printf("protocol_parse body=%zu per_datagram=%zu msgs_per_sec=%.0f mbytes_per_sec=%.1f ns_per_msg=%.2f\n",
+           body_len, per_datagram,
+           h.messages / elapsed,
+           (double)iterations * datagram.size() / elapsed / 1e6,
+           elapsed * 1e9 / h.messages);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    run(0, 1, iterations);
+    run(32, 1, iterations);
+    run(32, 16, iterations / 16);
+    run(256, 4, iterations / 4);
+    run(1024, 1, iterations);
+    return 0;
+}
@@ -1,242 +1,179 @@
-/* For sockaddr_in */
-#include <netinet/in.h>
-/* For socket functions */
-#include <sys/socket.h>
-/* For fcntl */
-#include <fcntl.h>
-#include <arpa/inet.h>
+#include "config.h"
 
 #include <event2/event.h>
 
-#include <assert.h>
+#include "main/reactor.h"
+#include "base/transform.h"
+#include "base/threadpool.h"
+#include "base/time.h"
+#include "base/metrics.h"
+#include "base/slab.h"
+
+#include <vector>
+
 #include <unistd.h>
-#include <string.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <errno.h>
-
-#define MAX_LINE 16384
-
-void do_read(evutil_socket_t fd, short events, void *arg);
-void do_write(evutil_socket_t fd, short events, void *arg);
-
-void print_ip(struct sockaddr_in& saddr)
-{
-    fprintf(stderr, "cli addr: %d.%d.%d.%d\n", (ntohl(saddr.sin_addr.s_addr) & 0xff000000) >> 24, 
-            (ntohl(saddr.sin_addr.s_addr) & 0x00ff0000) >> 16, 
-            (ntohl(saddr.sin_addr.s_addr) & 0x0000ff00) >> 8,
-            (ntohl(saddr.sin_addr.s_addr) & 0x000000ff));
-}
-
-char
-rot13_char(char c)
-{
-    /* We don't want to use isalpha here; setting the locale would change
-     * which characters are considered alphabetical. */
-    if ((c >= 'a' && c <= 'm') || (c >= 'A' && c <= 'M'))
-        return c + 13;
-    else if ((c >= 'n' && c <= 'z') || (c >= 'N' && c <= 'Z'))
-        return c - 13;
-    else
-        return c;
-}
+#include <getopt.h>
 
-struct fd_state {
-    char buffer[MAX_LINE];
-    size_t buffer_used;
-
-    size_t n_written;
-    size_t write_upto;
-
-    struct event *read_event;
-    struct event *write_event;
-
-    sockaddr_in cli;
-};
-
-struct fd_state *
-alloc_fd_state(struct event_base *base, evutil_socket_t fd)
+void
+run(const server_options& opts)
 {
-    struct fd_state *state = (fd_state*)malloc(sizeof(struct fd_state));
-    if (!state)
-        return NULL;
-    state->read_event = event_new(base, fd, EV_ET|EV_READ|EV_PERSIST, do_read, state);
-    if (!state->read_event) {
-        free(state);
-        return NULL;
+    unsigned int n = opts.reactors;
+    if (n == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        n = ncpu > 0 ? ncpu : 1;
     }
-    state->write_event =
-        event_new(base, fd, EV_ET|EV_WRITE|EV_PERSIST, do_write, state);
 
-    if (!state->write_event) {
-        event_free(state->read_event);
-        free(state);
-        return NULL;
+#ifndef SO_REUSEPORT
+    if (n > 1) {
+        fprintf(stderr, "SO_REUSEPORT is not supported, running a single reactor\n");
+        n = 1;
     }
+#endif
 
-    state->buffer_used = state->n_written = state->write_upto = 0;
+    //debug mode keeps a global event map which isn't safe to share between
+    //loops without libevent's thread locking, so only use it with one loop
+    if (n == 1)
+        event_enable_debug_mode();
 
-    assert(state->write_event);
-    return state;
-}
+    //a client resetting its connection fails the write, it doesn't kill us
+    if (opts.tcp)
+        signal(SIGPIPE, SIG_IGN);
 
-void
-free_fd_state(struct fd_state *state)
-{
-    event_free(state->read_event);
-    event_free(state->write_event);
-    free(state);
-}
+    //the only state the reactors share, see group_registry
+    vodeox::group_registry groups;
 
-void
-do_read(evutil_socket_t fd, short events, void *arg)
-{
-    fprintf(stderr, "%s\n", __FUNCTION__);
-
-    struct fd_state *state = (fd_state*)arg;
-    char buf[1024];
-    int i;
-    ssize_t result;
-    struct sockaddr_in cli;
-    socklen_t slen = sizeof(cli);
-
-    while (1) {
-        assert(state->write_event);
-        memset(&cli, 0, sizeof(cli));
-        result = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)&cli, &slen);
-
-        print_ip(cli);
+    vodeox::metrics_reporter reporter;
+    if (!reporter.start(opts.metrics_interval, SIGUSR1))
+        perror("metrics");
 
-        if (result <= 0)
-            break;
-
-        memcpy(&state->cli, &cli, sizeof(cli));
-        for (i=0; i < result; ++i)  {
-            if (state->buffer_used < sizeof(state->buffer))
-                state->buffer[state->buffer_used++] = rot13_char(buf[i]);
-            if (i == result-1) {
-                assert(state->write_event);
-                event_add(state->write_event, NULL);
-                state->write_upto = state->buffer_used;
-            }
-        }
+    //shared by all reactors, they only submit to it from outside
+    vodeox::Threadpool *pool = NULL;
+    if (opts.workers > 0) {
+        pool = new vodeox::Threadpool(opts.workers);
+        pool->start();
     }
 
-    if (result == 0) {
-        free_fd_state(state);
-    } else if (result < 0) {
-        if (errno == EAGAIN) // XXXX use evutil macro
-            return;
-        perror("recv");
-        free_fd_state(state);
+    std::vector<reactor*> reactors;
+    for (unsigned int i = 0; i < n; i++) {
+        reactor *r = new reactor(i, opts, groups, pool);
+        reactors.push_back(r);
+        if (!r->open(n > 1))
+            goto done; /*XXXerr*/
     }
-}
 
-void
-do_write(evutil_socket_t fd, short events, void *arg)
-{
-    fprintf(stderr, "%s\n", __FUNCTION__);
-
-    struct fd_state *state = (fd_state*)arg;
-
-    while (state->n_written < state->write_upto) {
-        ssize_t result = sendto(fd, state->buffer + state->n_written,
-                                state->write_upto - state->n_written, 0, (struct sockaddr*)&(state->cli), sizeof(state->cli));
-        if (result < 0) {
-            print_ip(state->cli);
-            fprintf(stderr, "sendto error %s %d %d\n", state->buffer, state->write_upto, errno);
-            if (errno == EAGAIN) // XXX use evutil macro
-                return;
-            free_fd_state(state);
-            return;
-        }
-        assert(result != 0);
+    for (unsigned int i = 0; i < reactors.size(); i++)
+        reactors[i]->start(reactors[i]);
+    for (unsigned int i = 0; i < reactors.size(); i++)
+        reactors[i]->join();
 
-        state->n_written += result;
+done:
+    //workers post back into the reactors, so they go first
+    if (pool) {
+        pool->stop();
+        delete pool;
     }
+    for (unsigned int i = 0; i < reactors.size(); i++)
+        delete reactors[i];
 
-    if (state->n_written == state->buffer_used)
-        state->n_written = state->write_upto = state->buffer_used = 1;
-
-    event_del(state->write_event);
+    reporter.report();
+    reporter.stop();
 }
 
 void
-do_accept(evutil_socket_t listener, short event, void *arg)
+usage(const char *prog)
 {
-    struct event_base *base = (event_base*)arg;
-    struct sockaddr_storage ss;
-    socklen_t slen = sizeof(ss);
-
-    int fd = accept(listener, (struct sockaddr*)&ss, &slen);
-
-    if (fd < 0) 
-    { // XXXX eagain??
-        perror("accept");
-    }
-    else if (fd > FD_SETSIZE) 
-    {
-        close(fd); // XXX replace all closes with EVUTIL_CLOSESOCKET */
-    } 
-    else 
-    {
-        struct fd_state *state;
-        evutil_make_socket_nonblocking(fd);
-        state = alloc_fd_state(base, fd);
-
-        assert(state); /*XXX err*/
-        assert(state->write_event);
-        
-        event_add(state->read_event, NULL);
-    }
-}
-
-void
-run(void)
-{
-    evutil_socket_t listener;
-    struct sockaddr_in sin;
-    struct event_base *base;
-    struct event *listener_event;
-
-    event_enable_debug_mode();
-
-    base = event_base_new();
-    if (!base)
-        return; /*XXXerr*/
-
-    memset(&sin,0,sizeof(sin));
-
-    sin.sin_family = AF_INET;
-    sin.sin_addr.s_addr = htonl(INADDR_ANY);
-    sin.sin_port = htons(40713);
-
-    listener = socket(AF_INET, SOCK_DGRAM, 0);
-    evutil_make_socket_nonblocking(listener);
-
-    if (bind(listener, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
-        perror("bind");
-        return;
-    }
-
-    struct fd_state *state;
-    state = alloc_fd_state(base, listener);
-        
-    assert(state); /*XXX err*/
-    assert(state->write_event);
-    
-    event_add(state->read_event, NULL);
-
-    //run even loop
-    event_base_dispatch(base);
+    fprintf(stderr, "Usage: %s [-p port] [-b recv batch size] [-s send batch size] [-q send queue length]\n"
+            "          [-r socket buffer size, bytes] [-x rot13|lower|checksum|xor:<key, up to 64 bytes>|none]\n"
+            "          [-t reactor threads, 0 = one per core] [-a pin reactors to cores]\n"
+            "          [-c initial sessions per reactor] [-m max sessions per reactor] [-i session idle timeout, sec]\n"
+            "          [-w filter worker threads, 0 = filter on the loop] [-d batches in flight per reactor]\n"
+            "          [-M metrics dump interval, sec, 0 = on SIGUSR1 only] [-H huge page backed slabs]\n"
+            "          [-T serve TCP clients too] [-o queued reply bytes before a TCP client is throttled]\n", prog);
 }
 
 int
 main(int c, char **v)
 {
     //    setvbuf(stdout, NULL, _IONBF, 0);
+    server_options opts;
+
+    int opt;
+    while ((opt = getopt(c, v, "p:b:s:q:r:x:t:ac:m:i:w:d:M:HTo:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            opts.port = atoi(optarg);
+            break;
+        case 'b':
+            opts.recv_batch = atoi(optarg);
+            if (opts.recv_batch == 0)
+                opts.recv_batch = 1;
+            break;
+        case 's':
+            opts.send_batch = atoi(optarg);
+            break;
+        case 'q':
+            opts.send_queue = atoi(optarg);
+            break;
+        case 'r':
+            opts.socket_buffer = atoi(optarg);
+            break;
+        case 'x': {
+            bool ok;
+            delete vodeox::create_payload_filter(optarg, ok);
+            if (!ok) {
+                usage(v[0]);
+                return 1;
+            }
+            opts.filter = optarg;
+            break;
+        }
+        case 't':
+            opts.reactors = atoi(optarg);
+            break;
+        case 'a':
+            opts.affinity = true;
+            break;
+        case 'c':
+            opts.session_capacity = atoi(optarg);
+            break;
+        case 'm':
+            opts.max_sessions = atoi(optarg);
+            break;
+        case 'i':
+            opts.session_idle = atoi(optarg);
+            break;
+        case 'w':
+            opts.workers = atoi(optarg);
+            break;
+        case 'd':
+            opts.handoff_depth = atoi(optarg);
+            break;
+        case 'M':
+            opts.metrics_interval = atoi(optarg);
+            break;
+        case 'H':
+            vodeox::slab_arena::set_hugepages(true);
+            break;
+        case 'T':
+            opts.tcp = true;
+            break;
+        case 'o':
+            opts.stream_outbound_limit = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(v[0]);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "payload kernels: %s\n", vodeox::transform_isa());
 
-    run();
+    //before any reactor runs, loop time and log stamps come off the TSC
+    fprintf(stderr, "clock: %s\n", vodeox::time::calibrate() ? "tsc" : "clock_gettime");
+    run(opts);
     return 0;
 }
 
@@ -0,0 +1,1038 @@
+#include "config.h"
+
+/* For sockaddr_in */
+#include <netinet/in.h>
+/* For TCP_NODELAY */
+#include <netinet/tcp.h>
+/* For socket functions */
+#include <sys/socket.h>
+/* For fcntl */
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include <event2/event.h>
+
+#include "main/reactor.h"
+#include "base/time.h"
+#include "base/metrics.h"
+#include "base/slab.h"
+#include "base/atomic.h"
+#include "net/protocol.h"
+
+#include <vector>
+
+#include <pthread.h>
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+void do_read(evutil_socket_t fd, short events, void *arg);
+void do_write(evutil_socket_t fd, short events, void *arg);
+void watch_session(struct fd_state *state, const vodeox::session *s);
+
+//across all reactors
+static vodeox::histogram s_reply_latency("net.reply_latency_ns");
+static vodeox::counter s_datagrams_in("net.datagrams_in");
+static vodeox::counter s_sessions_expired("net.sessions_expired");
+static vodeox::gauge s_sessions("net.sessions");
+static vodeox::gauge s_streams("net.streams");
+static vodeox::counter s_stream_frames_in("net.stream_frames_in");
+static vodeox::counter s_streams_throttled("net.streams_throttled");
+
+struct fd_state {
+    struct event *read_event;
+    struct event *write_event;
+    bool write_pending;
+
+    vodeox::recv_batch *rx;
+    vodeox::send_queue *tx;
+
+    vodeox::fanout_queue *fanout;
+
+    //applied to raw datagrams before they are echoed, NULL echoes them as is
+    const vodeox::payload_filter *filter;
+
+    //owned by the reactor, NULL for sockets that don't track peers
+    vodeox::session_table *sessions;
+    vodeox::group_registry *groups;
+
+    //owned by the reactor, NULL filters raw datagrams on the loop
+    vodeox::handoff_pipeline *handoff;
+
+    //owned by the reactor, idle timeouts of sessions
+    vodeox::timer_wheel *timers;
+};
+
+/*
+ * Idle timeout of one session. Sessions move around in their table, so the
+ * timer keeps the peer's key and looks the session up when it fires; if the
+ * peer was heard from in the meantime it is simply rearmed for the rest.
+ * Nothing cancels it, a timer finding its session gone or replaced just
+ * goes back to the pool.
+ */
+struct session_timer {
+    vodeox::timer_node node;
+    vodeox::peer_key key;
+    uint32 id;
+    struct fd_state *state;
+};
+
+//socket state, its events and the session timers come out of slabs, nothing
+//on the packet path calls malloc once they are warm
+static vodeox::object_pool<session_timer> s_session_timers;
+static vodeox::object_pool<fd_state> s_fd_states;
+
+struct event *
+alloc_event(struct event_base *base, evutil_socket_t fd, short what, event_callback_fn cb, void *arg)
+{
+    struct event *ev = (struct event*)vodeox::slab_allocate(event_get_struct_event_size());
+    if (ev && event_assign(ev, base, fd, what, cb, arg) != 0) {
+        vodeox::slab_deallocate(ev, event_get_struct_event_size());
+        return NULL;
+    }
+    return ev;
+}
+
+void
+free_event(struct event *ev)
+{
+    event_del(ev);
+    event_debug_unassign(ev);
+    vodeox::slab_deallocate(ev, event_get_struct_event_size());
+}
+
+struct fd_state *
+alloc_fd_state(struct event_base *base, evutil_socket_t fd, const server_options& opts)
+{
+    struct fd_state *state = s_fd_states.create();
+    state->rx = new vodeox::recv_batch(opts.recv_batch);
+    state->tx = new vodeox::send_queue(opts.send_queue, opts.send_batch, state->rx->datagram_size());
+    state->tx->set_latency_histogram(&s_reply_latency);
+    state->write_pending = false;
+    state->fanout = new vodeox::fanout_queue();
+    state->filter = NULL;
+    state->sessions = NULL;
+    state->groups = NULL;
+    state->handoff = NULL;
+    state->timers = NULL;
+    state->read_event = alloc_event(base, fd, EV_ET|EV_READ|EV_PERSIST, do_read, state);
+    if (!state->read_event) {
+        delete state->fanout;
+        delete state->tx;
+        delete state->rx;
+        s_fd_states.destroy(state);
+        return NULL;
+    }
+    state->write_event =
+        alloc_event(base, fd, EV_ET|EV_WRITE|EV_PERSIST, do_write, state);
+
+    if (!state->write_event) {
+        free_event(state->read_event);
+        delete state->fanout;
+        delete state->tx;
+        delete state->rx;
+        s_fd_states.destroy(state);
+        return NULL;
+    }
+
+    assert(state->write_event);
+    return state;
+}
+
+void
+free_fd_state(struct fd_state *state)
+{
+    free_event(state->read_event);
+    free_event(state->write_event);
+    delete state->fanout;
+    delete state->tx;
+    delete state->rx;
+    s_fd_states.destroy(state);
+}
+
+void
+schedule_write(struct fd_state *state)
+{
+    if (!state->write_pending && (!state->tx->empty() || !state->fanout->empty())) {
+        state->write_pending = true;
+        event_add(state->write_event, NULL);
+    }
+}
+
+char *
+reserve_reply(struct fd_state *state, evutil_socket_t fd, const struct sockaddr *peer, socklen_t peer_len)
+{
+    vodeox::send_queue *tx = state->tx;
+    char *out = tx->reserve(peer, peer_len);
+    if (!out) {
+        //queue is full, push out what the socket takes and retry once
+        tx->flush(fd);
+        out = tx->reserve(peer, peer_len);
+    }
+    return out;
+}
+
+bool
+push_reply(struct fd_state *state, evutil_socket_t fd, const struct sockaddr *peer, socklen_t peer_len,
+           const vodeox::buffer& data, uint64 stamp)
+{
+    vodeox::send_queue *tx = state->tx;
+    if (tx->push_ref(peer, peer_len, data, stamp))
+        return true;
+    tx->flush(fd);
+    return tx->push_ref(peer, peer_len, data, stamp);
+}
+
+/*
+ * Fans a PUBLISH out to the group through state's socket, body is msg's body
+ * as a slice of the buffer it was received in
+ */
+uint8
+publish_message(struct fd_state *state, const vodeox::message& msg, uint32 session,
+                const vodeox::peer_key& sender, const vodeox::buffer& body)
+{
+    vodeox::group_registry *groups = state->groups;
+    uint32 group;
+    const char *rest;
+    size_t rest_len;
+
+    if (!groups)
+        return vodeox::ACK_REFUSED;
+    if (!vodeox::decode_group(msg, group, rest, rest_len))
+        return vodeox::ACK_BAD_REQUEST;
+
+    vodeox::member_list *members = groups->members(group);
+    if (!members)
+        return vodeox::ACK_UNKNOWN_GROUP;
+
+    //every delivery shares one DATA header and the body as it was received
+    vodeox::buffer header = vodeox::buffer::allocate(vodeox::MESSAGE_HEADER_SIZE);
+    if (header.empty()) {
+        members->release();
+        return vodeox::ACK_REFUSED;
+    }
+    vodeox::encode_header(header.mutable_data(), vodeox::MSG_DATA, session, msg.sequence, msg.body_len);
+
+    vodeox::buffer_chain data;
+    data.append(header);
+    data.append(body);
+
+    state->fanout->publish(members, data, sender);
+    schedule_write(state);
+    return vodeox::ACK_OK;
+}
+
+/*
+ * Handles the protocol messages of one datagram on behalf of its sender,
+ * messages are parsed in place from the receive batch.
+ */
+class datagram_handler : public vodeox::message_handler
+{
+ public:
+    datagram_handler(struct fd_state *state, evutil_socket_t fd) :
+        m_state(state), m_fd(fd), m_session(NULL), m_peer(NULL), m_peer_len(0), m_stamp(0), m_index(0) {}
+
+    //the datagram is m_state->rx slot index
+    void reset(vodeox::session *s, unsigned int index, uint64 stamp)
+    {
+        vodeox::recv_batch *rx = m_state->rx;
+        m_session = s;
+        m_index = index;
+        m_peer = rx->peer(index);
+        m_peer_len = rx->peer_len(index);
+        m_stamp = stamp;
+    }
+
+    void on_message(const vodeox::message& msg)
+    {
+        switch (msg.type) {
+        case vodeox::MSG_HELLO:
+            if (m_session)
+                reply(vodeox::MSG_HELLO, msg.sequence, "", 0);
+            break;
+        case vodeox::MSG_JOIN:
+        case vodeox::MSG_LEAVE:
+            ack(msg, membership(msg));
+            break;
+        case vodeox::MSG_PUBLISH: {
+            uint8 status = publish(msg);
+            if (msg.flags & vodeox::FLAG_ACK_REQUESTED)
+                ack(msg, status);
+            break;
+        }
+        case vodeox::MSG_PING:
+            reply(vodeox::MSG_PONG, msg.sequence, msg.body, msg.body_len);
+            break;
+        default:
+            //server to client types, nothing to do
+            break;
+        }
+    }
+
+ private:
+    void reply(uint8 type, uint32 sequence, const char *body, size_t body_len)
+    {
+        char *out = reserve_reply(m_state, m_fd, m_peer, m_peer_len);
+        if (!out)
+            return;
+        if (vodeox::MESSAGE_HEADER_SIZE + body_len > m_state->tx->datagram_size())
+            body_len = m_state->tx->datagram_size() - vodeox::MESSAGE_HEADER_SIZE;
+
+        uint32 session = m_session ? m_session->id : 0;
+        size_t len = vodeox::encode_header(out, type, session, sequence, body_len);
+        memcpy(out + len, body, body_len);
+        m_state->tx->commit(len + body_len, m_stamp);
+    }
+
+    void ack(const vodeox::message& msg, uint8 status)
+    {
+        reply(vodeox::MSG_ACK, msg.sequence, (const char*)&status, 1);
+    }
+
+    uint8 membership(const vodeox::message& msg)
+    {
+        vodeox::group_registry *groups = m_state->groups;
+        uint32 group;
+        const char *rest;
+        size_t rest_len;
+
+        if (!m_session || !groups)
+            return vodeox::ACK_REFUSED;
+        if (!vodeox::decode_group(msg, group, rest, rest_len) || group == 0)
+            return vodeox::ACK_BAD_REQUEST;
+
+        if (msg.type == vodeox::MSG_JOIN) {
+            //a session is a member of at most one group
+            if (m_session->group && m_session->group != group)
+                groups->leave(m_session->group, m_session->key);
+            groups->join(group, m_session->key);
+            m_session->group = group;
+        } else {
+            if (m_session->group != group)
+                return vodeox::ACK_UNKNOWN_GROUP;
+            groups->leave(group, m_session->key);
+            m_session->group = 0;
+        }
+        return vodeox::ACK_OK;
+    }
+
+    uint8 publish(const vodeox::message& msg)
+    {
+        if (!m_session)
+            return vodeox::ACK_REFUSED;
+
+        vodeox::recv_batch *rx = m_state->rx;
+        vodeox::buffer body = rx->datagram(m_index).slice(msg.body - rx->data(m_index), msg.body_len);
+        return publish_message(m_state, msg, m_session->id, m_session->key, body);
+    }
+
+ private:
+    struct fd_state *m_state;
+    evutil_socket_t m_fd;
+
+    vodeox::session *m_session;
+    const struct sockaddr *m_peer;
+    socklen_t m_peer_len;
+    uint64 m_stamp;
+    unsigned int m_index;
+};
+
+void
+do_read(evutil_socket_t fd, short events, void *arg)
+{
+    struct fd_state *state = (fd_state*)arg;
+    vodeox::recv_batch *rx = state->rx;
+    vodeox::send_queue *tx = state->tx;
+    vodeox::session_table *sessions = state->sessions;
+    //monotonic usec as of this loop iteration, wall clock steps don't expire anyone
+    uint64 now = sessions ? vodeox::time::loop_ns() / 1000 : 0;
+    datagram_handler handler(state, fd);
+    int n;
+
+    do {
+        n = rx->receive(fd);
+        if (n < 0) {
+            //the listener is owned by its reactor, a failed read just ends this round
+            perror("recv");
+            break;
+        }
+        //one stamp per batch, replies measure from here to their sendmmsg
+        uint64 stamp = n > 0 ? vodeox::time::tsc_ns() : 0;
+        s_datagrams_in.add(n);
+
+        for (int m = 0; m < n; ++m) {
+            const char *buf = rx->data(m);
+            size_t len = rx->length(m);
+            vodeox::session *s = NULL;
+
+            if (len == 0)
+                continue;
+
+            if (sessions) {
+                vodeox::peer_key key;
+                bool inserted;
+                if (!vodeox::peer_key::from_sockaddr(rx->peer(m), rx->peer_len(m), key))
+                    continue;
+                s = sessions->find_or_insert(key, now, inserted);
+                if (!s)
+                    continue; //table is full, shed the new peer
+                if (inserted) {
+                    watch_session(state, s);
+                    s_sessions.add(1);
+                }
+                s->last_seen = now;
+                s->packets++;
+            }
+
+            if ((uint8)buf[0] == vodeox::PROTOCOL_MAGIC) {
+                handler.reset(s, m, stamp);
+                vodeox::dispatch_messages(buf, len, handler);
+                continue;
+            }
+
+            //anything else is a raw datagram and gets echoed through the filter,
+            //on a worker if there is room in the pipeline
+            if (state->handoff && state->handoff->add(rx->datagram(m), rx->peer(m), rx->peer_len(m), stamp))
+                continue;
+
+            //unfiltered echoes go out straight from the receive buffer
+            if (!state->filter) {
+                push_reply(state, fd, rx->peer(m), rx->peer_len(m), rx->datagram(m), stamp);
+                continue;
+            }
+
+            char *out = reserve_reply(state, fd, rx->peer(m), rx->peer_len(m));
+            if (!out)
+                continue;
+            tx->commit(state->filter->apply(out, buf, len, tx->datagram_size()), stamp);
+        }
+        //once per round, a datagram never waits for later ones to fill a batch
+        if (state->handoff)
+            state->handoff->flush();
+        //a short batch means the socket is drained
+    } while (n == (int)rx->batch_size());
+
+    state->fanout->pump(*tx);
+    schedule_write(state);
+}
+
+void
+on_handoff_complete(const vodeox::handoff_batch& batch, void *arg)
+{
+    struct fd_state *state = (fd_state*)arg;
+    evutil_socket_t fd = event_get_fd(state->read_event);
+
+    //no output memory on the worker, the drops are counted there
+    if (batch.failed())
+        return;
+
+    for (unsigned int i = 0; i < batch.size(); ++i)
+        push_reply(state, fd, batch.peer(i), batch.peer_len(i), batch.output(i), batch.stamp());
+}
+
+void
+do_handoff(evutil_socket_t fd, short events, void *arg)
+{
+    struct fd_state *state = (fd_state*)arg;
+
+    if (state->handoff->drain())
+        schedule_write(state);
+}
+
+void
+on_session_expired(const vodeox::session& s, void *arg)
+{
+    vodeox::group_registry *groups = (vodeox::group_registry*)arg;
+    if (s.group)
+        groups->leave(s.group, s.key);
+}
+
+void
+on_session_timer(vodeox::timer_node *node, void *arg)
+{
+    session_timer *t = (session_timer*)arg;
+    struct fd_state *state = t->state;
+    vodeox::session_table *sessions = state->sessions;
+    vodeox::session *s = sessions->find(t->key);
+
+    if (s && s->id == t->id) {
+        uint64 now = vodeox::time::loop_ns() / 1000;
+        uint64 idle = now > s->last_seen ? now - s->last_seen : 0;
+        if (idle < sessions->idle_usec()) {
+            state->timers->schedule(node, sessions->idle_usec() - idle);
+            return;
+        }
+        on_session_expired(*s, state->groups);
+        sessions->erase(t->key);
+        s_sessions.add(-1);
+        s_sessions_expired.add();
+    }
+    s_session_timers.destroy(t);
+}
+
+void
+watch_session(struct fd_state *state, const vodeox::session *s)
+{
+    session_timer *t = s_session_timers.create();
+    t->key = s->key;
+    t->id = s->id;
+    t->state = state;
+    state->timers->schedule(&t->node, state->sessions->idle_usec(), on_session_timer, t);
+}
+
+void
+do_timers(evutil_socket_t fd, short events, void *arg)
+{
+    struct fd_state *state = (fd_state*)arg;
+
+    state->timers->advance(vodeox::time::loop_ns() / 1000);
+    //expired sessions may have left fan-out work behind
+    schedule_write(state);
+}
+
+void
+do_write(evutil_socket_t fd, short events, void *arg)
+{
+    struct fd_state *state = (fd_state*)arg;
+
+    //on EAGAIN keep the event armed, edge triggering brings us back once writable
+    for (;;) {
+        if (!state->tx->flush(fd))
+            return;
+        if (state->fanout->pump(*state->tx) && state->tx->empty())
+            break;
+    }
+
+    state->write_pending = false;
+    event_del(state->write_event);
+}
+
+/*
+ * A TCP client. Its frames are handled like datagrams on the reactor's UDP
+ * socket, with the same filter and PUBLISH fan-out, but replies go back on
+ * the connection. Group deliveries are addressed by UDP peer, so JOIN and
+ * LEAVE are refused here.
+ *
+ * Once more than outbound_limit bytes of replies are waiting the connection
+ * stops reading until half of them are out, the kernel buffers and TCP flow
+ * control push back on the client from there.
+ */
+struct stream_conn {
+    evutil_socket_t fd;
+    struct event *read_event;
+    struct event *write_event;
+    bool write_pending;
+    bool paused;
+
+    vodeox::stream_reader rx;
+    vodeox::stream_writer tx;
+
+    vodeox::peer_key key;
+    uint32 id;
+
+    struct stream_server *server;
+    stream_conn *prev;
+    stream_conn *next;
+};
+
+/*
+ * A reactor's TCP listener and its connections
+ */
+struct stream_server {
+    struct event *accept_event;
+
+    //the reactor's datagram socket, for the filter and fan-out
+    struct fd_state *udp;
+
+    size_t max_frame;
+    size_t outbound_limit;
+
+    stream_conn *conns;
+};
+
+static vodeox::object_pool<stream_conn> s_stream_conns;
+
+//session ids of connections, the range above the session tables' ids
+static volatile uint32 s_next_stream_id = 0;
+
+//accepts per listener wakeup
+static const int STREAM_ACCEPT_BATCH = 64;
+
+void
+close_stream(stream_conn *c)
+{
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        c->server->conns = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+
+    free_event(c->read_event);
+    free_event(c->write_event);
+    evutil_closesocket(c->fd);
+    s_streams.add(-1);
+    s_stream_conns.destroy(c);
+}
+
+/*
+ * Writes what the socket takes and arms the write event for the rest,
+ * false if the connection failed and is gone
+ */
+bool
+flush_stream(stream_conn *c)
+{
+    int r = c->tx.flush(c->fd);
+    if (r < 0) {
+        close_stream(c);
+        return false;
+    }
+    if (r == 0 && !c->write_pending) {
+        c->write_pending = true;
+        event_add(c->write_event, NULL);
+    }
+    return true;
+}
+
+class stream_handler : public vodeox::message_handler
+{
+ public:
+    explicit stream_handler(stream_conn *c) : m_conn(c), m_frame(NULL) {}
+
+    void reset(const vodeox::buffer *frame) { m_frame = frame; }
+
+    void on_message(const vodeox::message& msg)
+    {
+        switch (msg.type) {
+        case vodeox::MSG_HELLO:
+            reply(vodeox::MSG_HELLO, msg.sequence, vodeox::buffer());
+            break;
+        case vodeox::MSG_JOIN:
+        case vodeox::MSG_LEAVE:
+            ack(msg, vodeox::ACK_REFUSED);
+            break;
+        case vodeox::MSG_PUBLISH: {
+            uint8 status = publish_message(m_conn->server->udp, msg, m_conn->id, m_conn->key, body(msg));
+            if (msg.flags & vodeox::FLAG_ACK_REQUESTED)
+                ack(msg, status);
+            break;
+        }
+        case vodeox::MSG_PING:
+            reply(vodeox::MSG_PONG, msg.sequence, body(msg));
+            break;
+        default:
+            break;
+        }
+    }
+
+ private:
+    vodeox::buffer body(const vodeox::message& msg)
+    {
+        return m_frame->slice(msg.body - m_frame->data(), msg.body_len);
+    }
+
+    void reply(uint8 type, uint32 sequence, const vodeox::buffer& body)
+    {
+        char header[vodeox::MESSAGE_HEADER_SIZE];
+        vodeox::encode_header(header, type, m_conn->id, sequence, body.size());
+        m_conn->tx.push_frame(header, sizeof(header), body);
+    }
+
+    void ack(const vodeox::message& msg, uint8 status)
+    {
+        char out[vodeox::MESSAGE_HEADER_SIZE + 1];
+        vodeox::encode_header(out, vodeox::MSG_ACK, m_conn->id, msg.sequence, 1);
+        out[vodeox::MESSAGE_HEADER_SIZE] = status;
+        m_conn->tx.push_frame(out, sizeof(out), vodeox::buffer());
+    }
+
+ private:
+    stream_conn *m_conn;
+    const vodeox::buffer *m_frame;
+};
+
+void
+handle_frame(stream_conn *c, stream_handler& handler, const vodeox::buffer& frame)
+{
+    if (frame.empty())
+        return;
+
+    if ((uint8)frame.data()[0] == vodeox::PROTOCOL_MAGIC) {
+        handler.reset(&frame);
+        vodeox::dispatch_messages(frame.data(), frame.size(), handler);
+        return;
+    }
+
+    //raw payloads are echoed through the filter, straight from the read chunk without one
+    const vodeox::payload_filter *filter = c->server->udp->filter;
+    if (!filter) {
+        c->tx.push_frame(NULL, 0, frame);
+        return;
+    }
+
+    size_t room = c->server->max_frame;
+    vodeox::buffer out = vodeox::buffer::allocate(room);
+    if (out.empty())
+        return;
+    out.truncate(filter->apply(out.mutable_data(), frame.data(), frame.size(), room));
+    c->tx.push_frame(NULL, 0, out);
+}
+
+void
+do_stream_read(evutil_socket_t fd, short events, void *arg)
+{
+    stream_conn *c = (stream_conn*)arg;
+    stream_handler handler(c);
+
+    //edge triggered, read until the socket is drained or the client is throttled
+    while (!c->paused) {
+        vodeox::buffer frame;
+        int r;
+        while ((r = c->rx.next(frame)) > 0) {
+            handle_frame(c, handler, frame);
+            s_stream_frames_in.add();
+        }
+        //longer than any datagram we'd take, the stream is out of sync, or
+        //we ran out of memory halfway through a reply
+        if (r < 0 || c->tx.failed()) {
+            close_stream(c);
+            return;
+        }
+        //let go of the last frame so its chunk can be reused
+        frame.reset();
+
+        if (c->tx.pending() > c->server->outbound_limit) {
+            if (!flush_stream(c))
+                return;
+            if (c->tx.pending() > c->server->outbound_limit) {
+                c->paused = true;
+                event_del(c->read_event);
+                s_streams_throttled.add();
+                return;
+            }
+        }
+
+        ssize_t n = c->rx.fill(fd);
+        if (n == 0) {
+            close_stream(c);
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            close_stream(c);
+            return;
+        }
+    }
+
+    //all replies of this round leave in as few writev calls as possible
+    flush_stream(c);
+}
+
+void
+do_stream_write(evutil_socket_t fd, short events, void *arg)
+{
+    stream_conn *c = (stream_conn*)arg;
+
+    int r = c->tx.flush(fd);
+    if (r < 0) {
+        close_stream(c);
+        return;
+    }
+    if (r > 0) {
+        c->write_pending = false;
+        event_del(c->write_event);
+    }
+
+    if (c->paused && c->tx.pending() <= c->server->outbound_limit / 2) {
+        c->paused = false;
+        event_add(c->read_event, NULL);
+        //whatever arrived while we weren't reading won't trigger another edge
+        do_stream_read(fd, EV_READ, c);
+    }
+}
+
+bool
+open_stream(struct stream_server *server, evutil_socket_t fd, const struct sockaddr *peer, socklen_t peer_len)
+{
+    struct event_base *base = event_get_base(server->accept_event);
+    stream_conn *c = s_stream_conns.create();
+
+    if (!vodeox::peer_key::from_sockaddr(peer, peer_len, c->key)) {
+        s_stream_conns.destroy(c);
+        return false;
+    }
+    c->fd = fd;
+    c->id = vodeox::SESSION_ID_LIMIT |
+            (vodeox::atomic_fetch_add(&s_next_stream_id, 1U) & (vodeox::SESSION_ID_LIMIT - 1));
+    c->server = server;
+    c->write_pending = false;
+    c->paused = false;
+    c->rx.set_max_frame(server->max_frame);
+
+    c->read_event = alloc_event(base, fd, EV_ET|EV_READ|EV_PERSIST, do_stream_read, c);
+    c->write_event = alloc_event(base, fd, EV_ET|EV_WRITE|EV_PERSIST, do_stream_write, c);
+    if (!c->read_event || !c->write_event) {
+        if (c->read_event)
+            free_event(c->read_event);
+        if (c->write_event)
+            free_event(c->write_event);
+        s_stream_conns.destroy(c);
+        return false;
+    }
+
+    //replies are coalesced before they are written, don't hold them back again
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    c->prev = NULL;
+    c->next = server->conns;
+    if (c->next)
+        c->next->prev = c;
+    server->conns = c;
+    s_streams.add(1);
+
+    event_add(c->read_event, NULL);
+    return true;
+}
+
+void
+do_accept(evutil_socket_t listener, short event, void *arg)
+{
+    struct stream_server *server = (stream_server*)arg;
+
+    for (int i = 0; i < STREAM_ACCEPT_BATCH; ++i) {
+        struct sockaddr_storage ss;
+        socklen_t slen = sizeof(ss);
+
+#ifdef HAVE_ACCEPT4
+        int fd = accept4(listener, (struct sockaddr*)&ss, &slen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        int fd = accept(listener, (struct sockaddr*)&ss, &slen);
+        if (fd >= 0)
+            evutil_make_socket_nonblocking(fd);
+#endif
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            return;
+        }
+
+        if (!open_stream(server, fd, (struct sockaddr*)&ss, slen))
+            evutil_closesocket(fd);
+    }
+}
+
+reactor::reactor(unsigned int id, const server_options& opts, vodeox::group_registry& groups,
+                 vodeox::Threadpool* pool) :
+    m_id(id),
+    m_opts(opts),
+    m_groups(groups),
+    m_pool(pool),
+    m_base(NULL),
+    m_fd(-1),
+    m_state(NULL),
+    m_filter(NULL),
+    m_sessions(NULL),
+    m_timers(NULL),
+    m_timer_event(NULL),
+    m_handoff(NULL),
+    m_handoff_event(NULL),
+    m_stream_fd(-1),
+    m_streams(NULL)
+{
+}
+
+reactor::~reactor()
+{
+    if (m_streams) {
+        while (m_streams->conns)
+            close_stream(m_streams->conns);
+        if (m_streams->accept_event)
+            event_free(m_streams->accept_event);
+        delete m_streams;
+    }
+    if (m_stream_fd >= 0)
+        evutil_closesocket(m_stream_fd);
+
+    if (m_handoff_event)
+        event_free(m_handoff_event);
+    delete m_handoff;
+    if (m_timer_event)
+        event_free(m_timer_event);
+    //pending session timers are only unlinked, their blocks stay in the slab
+    delete m_timers;
+    if (m_state)
+        free_fd_state(m_state);
+    delete m_sessions;
+    delete m_filter;
+    if (m_fd >= 0)
+        evutil_closesocket(m_fd);
+    if (m_base)
+        event_base_free(m_base);
+}
+
+bool
+reactor::open(bool reuseport)
+{
+    struct sockaddr_in sin;
+
+    m_base = event_base_new();
+    if (!m_base)
+        return false;
+
+    memset(&sin,0,sizeof(sin));
+
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    sin.sin_port = htons(m_opts.port);
+
+    m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_fd < 0) {
+        perror("socket");
+        return false;
+    }
+    evutil_make_socket_nonblocking(m_fd);
+
+#ifdef SO_REUSEPORT
+    if (reuseport) {
+        int on = 1;
+        if (setsockopt(m_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            perror("setsockopt(SO_REUSEPORT)");
+            return false;
+        }
+    }
+#endif
+
+    //bursts of joins or fan-out replies overflow the default buffers long before
+    //the loop gets to run, the kernel caps these at net.core.[rw]mem_max
+    if (m_opts.socket_buffer > 0) {
+        setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &m_opts.socket_buffer, sizeof(m_opts.socket_buffer));
+        setsockopt(m_fd, SOL_SOCKET, SO_SNDBUF, &m_opts.socket_buffer, sizeof(m_opts.socket_buffer));
+    }
+
+    if (bind(m_fd, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+        perror("bind");
+        return false;
+    }
+
+    m_state = alloc_fd_state(m_base, m_fd, m_opts);
+    if (!m_state)
+        return false;
+
+    m_sessions = new vodeox::session_table(m_opts.session_capacity, m_opts.max_sessions,
+                                           m_opts.session_idle * 1000000ULL);
+    m_state->sessions = m_sessions;
+    m_state->groups = &m_groups;
+
+    bool ok;
+    m_filter = vodeox::create_payload_filter(m_opts.filter, ok);
+    m_state->filter = m_filter;
+
+    m_timers = new vodeox::timer_wheel(vodeox::time::loop_ns() / 1000);
+    m_state->timers = m_timers;
+
+    m_timer_event = event_new(m_base, -1, EV_PERSIST, do_timers, m_state);
+    if (!m_timer_event)
+        return false;
+    struct timeval tick = { 0, (suseconds_t)m_timers->tick_usec() };
+    event_add(m_timer_event, &tick);
+
+    if (m_pool) {
+        m_handoff = new vodeox::handoff_pipeline(*m_pool, m_filter, m_opts.recv_batch,
+                                                 m_state->rx->datagram_size(), m_opts.handoff_depth);
+        if (!m_handoff->open(on_handoff_complete, m_state))
+            return false;
+        m_handoff_event = event_new(m_base, m_handoff->fd(), EV_READ|EV_PERSIST, do_handoff, m_state);
+        if (!m_handoff_event)
+            return false;
+        event_add(m_handoff_event, NULL);
+        m_state->handoff = m_handoff;
+    }
+
+    if (m_opts.tcp && !open_streams(reuseport))
+        return false;
+
+    event_add(m_state->read_event, NULL);
+    return true;
+}
+
+bool
+reactor::open_streams(bool reuseport)
+{
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    sin.sin_port = htons(m_opts.port);
+
+    m_stream_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_stream_fd < 0) {
+        perror("socket");
+        return false;
+    }
+    evutil_make_socket_nonblocking(m_stream_fd);
+    evutil_make_listen_socket_reuseable(m_stream_fd);
+
+#ifdef SO_REUSEPORT
+    //every reactor listens on the port, the kernel spreads connections between them
+    if (reuseport) {
+        int on = 1;
+        if (setsockopt(m_stream_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            perror("setsockopt(SO_REUSEPORT)");
+            return false;
+        }
+    }
+#endif
+
+    if (bind(m_stream_fd, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+        perror("bind");
+        return false;
+    }
+    if (listen(m_stream_fd, SOMAXCONN) < 0) {
+        perror("listen");
+        return false;
+    }
+
+    m_streams = new stream_server();
+    m_streams->udp = m_state;
+    m_streams->max_frame = m_state->rx->datagram_size();
+    m_streams->outbound_limit = m_opts.stream_outbound_limit;
+    m_streams->conns = NULL;
+    m_streams->accept_event = event_new(m_base, m_stream_fd, EV_READ|EV_PERSIST, do_accept, m_streams);
+    if (!m_streams->accept_event)
+        return false;
+    event_add(m_streams->accept_event, NULL);
+    return true;
+}
+
+void
+reactor::run()
+{
+#ifdef __linux__
+    if (m_opts.affinity) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(m_id % (ncpu > 0 ? ncpu : 1), &cpus);
+        if (0 != pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+            fprintf(stderr, "couldn't pin reactor %u to a cpu\n", m_id);
+    }
+#endif
+
+    //one iteration at a time, callbacks read the loop time tick() took
+    for (;;) {
+        vodeox::time::tick();
+        if (event_base_loop(m_base, EVLOOP_ONCE) != 0 ||
+            event_base_got_exit(m_base) || event_base_got_break(m_base))
+            break;
+    }
+}
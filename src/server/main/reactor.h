@@ -0,0 +1,128 @@
+#ifndef __MAIN_REACTOR_H
+#define __MAIN_REACTOR_H
+
+#include <event2/event.h>
+
+#include <string>
+
+#include "base/scoped_lock.h"
+#include "net/recv_batch.h"
+#include "net/send_queue.h"
+#include "net/session_table.h"
+#include "net/fanout.h"
+#include "net/handoff.h"
+#include "net/stream.h"
+#include "base/transform.h"
+#include "base/threadpool.h"
+#include "base/timer_wheel.h"
+
+#define DEFAULT_PORT 40713
+
+struct server_options {
+    unsigned short port;
+    unsigned int recv_batch;
+    unsigned int send_batch;
+    unsigned int send_queue;
+    int socket_buffer;          //SO_RCVBUF/SO_SNDBUF in bytes, 0 keeps the system default
+    std::string filter;         //payload filter for raw datagrams, see create_payload_filter
+
+    //number of event loops, 0 means one per online core
+    unsigned int reactors;
+    bool affinity;
+
+    //per reactor
+    size_t session_capacity;
+    size_t max_sessions;
+    unsigned int session_idle;  //seconds
+
+    //threads running the payload filter off the loops, 0 filters inline
+    unsigned int workers;
+    unsigned int handoff_depth; //batches in flight per reactor
+
+    //seconds between metrics dumps to stderr, 0 dumps on SIGUSR1 only
+    unsigned int metrics_interval;
+
+    //TCP clients on the same port, framed as in net/stream.h
+    bool tcp;
+    size_t stream_outbound_limit;   //bytes of replies queued before a client is throttled
+
+    server_options() :
+        port(DEFAULT_PORT),
+        recv_batch(vodeox::DEFAULT_RECV_BATCH),
+        send_batch(vodeox::DEFAULT_SEND_BATCH),
+        send_queue(vodeox::DEFAULT_SEND_QUEUE),
+        socket_buffer(4 * 1024 * 1024),
+        filter("rot13"),
+        reactors(1),
+        affinity(false),
+        session_capacity(vodeox::DEFAULT_SESSION_CAPACITY),
+        max_sessions(vodeox::DEFAULT_MAX_SESSIONS),
+        session_idle(vodeox::DEFAULT_SESSION_IDLE_USEC / 1000000),
+        workers(0),
+        handoff_depth(vodeox::DEFAULT_HANDOFF_DEPTH),
+        metrics_interval(0),
+        tcp(false),
+        stream_outbound_limit(vodeox::DEFAULT_STREAM_OUTBOUND_LIMIT) {}
+};
+
+struct fd_state;
+struct stream_server;
+
+/*
+ * One event loop with its own SO_REUSEPORT socket. Reactors don't share any
+ * mutable state, the kernel spreads incoming datagrams between their sockets
+ * by flow hash so a given peer always lands on the same reactor. With TCP on
+ * every reactor also listens on the port and serves the connections it
+ * accepts on the same loop.
+ *
+ * With a worker pool the loop only moves bytes: raw datagrams go through a
+ * handoff_pipeline and their replies are queued when the batch comes back.
+ */
+class reactor : public vodeox::thread
+{
+ public:
+    reactor(unsigned int id, const server_options& opts, vodeox::group_registry& groups,
+            vodeox::Threadpool* pool = NULL);
+    virtual ~reactor();
+
+    /*
+     * Creates the event base and binds the socket, done on the calling thread
+     * so configuration errors show up before any loop is started.
+     */
+    bool open(bool reuseport);
+
+    void run();
+
+    unsigned int id() const { return m_id; }
+
+ private:
+    bool open_streams(bool reuseport);
+
+    reactor(const reactor&);
+    reactor& operator=(const reactor&);
+
+ private:
+    unsigned int            m_id;
+    server_options          m_opts;
+    vodeox::group_registry& m_groups;
+    vodeox::Threadpool*     m_pool;
+
+    struct event_base*      m_base;
+    evutil_socket_t         m_fd;
+    struct fd_state*        m_state;
+
+    vodeox::payload_filter* m_filter;
+    vodeox::session_table*  m_sessions;
+
+    //session idle timeouts, advanced by a libevent timer every tick
+    vodeox::timer_wheel*        m_timers;
+    struct event*               m_timer_event;
+
+    vodeox::handoff_pipeline*   m_handoff;
+    struct event*               m_handoff_event;
+
+    evutil_socket_t             m_stream_fd;
+    struct stream_server*       m_streams;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include "config.h"
+
+#include "net/fanout.h"
+#include "base/slab.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace vodeox
+{
+
+member_list* member_list::create(size_t count)
+{
+    //always room for one member so the flexible array stays valid
+    size_t n = count ? count : 1;
+    member_list* l = (member_list*)slab_allocate(offsetof(member_list, m_members) + n * sizeof(peer_key));
+    if (!l)
+        return NULL;
+    l->m_refs = 1;
+    l->m_count = count;
+    return l;
+}
+
+void member_list::release()
+{
+    if (atomic_fetch_sub(&m_refs, 1) == 1)
+        slab_deallocate(this, offsetof(member_list, m_members) + (m_count ? m_count : 1) * sizeof(peer_key));
+}
+
+group_registry::~group_registry()
+{
+    for (unsigned i = 0; i < GROUP_SHARDS; i++)
+        for (group_map::iterator g = m_shards[i].groups.begin(); g != m_shards[i].groups.end(); ++g)
+        {
+            invalidate(g->second);
+            delete g->second;
+        }
+}
+
+void group_registry::invalidate(group* g)
+{
+    //publishes still walking the old snapshot keep their own reference
+    if (g->snapshot)
+        g->snapshot->release();
+    g->snapshot = NULL;
+}
+
+bool group_registry::join(uint32 group_id, const peer_key& peer)
+{
+    shard& s = shard_of(group_id);
+    scoped_lock lock(s.lock);
+
+    group*& g = s.groups[group_id];
+    if (!g)
+        g = new group();
+    if (!g->members.insert(peer).second)
+        return false;
+
+    invalidate(g);
+    return true;
+}
+
+bool group_registry::leave(uint32 group_id, const peer_key& peer)
+{
+    shard& s = shard_of(group_id);
+    scoped_lock lock(s.lock);
+
+    group_map::iterator i = s.groups.find(group_id);
+    if (i == s.groups.end() || i->second->members.erase(peer) == 0)
+        return false;
+
+    invalidate(i->second);
+    if (i->second->members.empty())
+    {
+        delete i->second;
+        s.groups.erase(i);
+    }
+    return true;
+}
+
+member_list* group_registry::members(uint32 group_id)
+{
+    shard& s = shard_of(group_id);
+    scoped_lock lock(s.lock);
+
+    group_map::iterator i = s.groups.find(group_id);
+    if (i == s.groups.end())
+        return NULL;
+
+    group* g = i->second;
+    if (!g->snapshot)
+    {
+        member_list* l = member_list::create(g->members.size());
+        if (!l)
+            return NULL;
+        size_t n = 0;
+        for (std::set<peer_key>::const_iterator m = g->members.begin(); m != g->members.end(); ++m)
+            l->m_members[n++] = *m;
+        g->snapshot = l;
+    }
+
+    g->snapshot->retain();
+    return g->snapshot;
+}
+
+size_t group_registry::size() const
+{
+    size_t n = 0;
+    for (unsigned i = 0; i < GROUP_SHARDS; i++)
+    {
+        scoped_lock lock(m_shards[i].lock);
+        n += m_shards[i].groups.size();
+    }
+    return n;
+}
+
+fanout_queue::~fanout_queue()
+{
+    for (size_t i = 0; i < m_jobs.size(); i++)
+        m_jobs[i].members->release();
+}
+
+void fanout_queue::publish(member_list* members, const buffer_chain& data, const peer_key& sender)
+{
+    m_jobs.push_back(job());
+    job& j = m_jobs.back();
+    j.members = members;
+    j.data = data;
+    j.sender = sender;
+    j.next = 0;
+}
+
+bool fanout_queue::pump(send_queue& tx)
+{
+    while (!m_jobs.empty())
+    {
+        job& j = m_jobs.front();
+        const member_list& members = *j.members;
+
+        while (j.next < members.size())
+        {
+            if (tx.full())
+                return false;
+
+            const peer_key& peer = members[j.next++];
+            if (peer == j.sender)
+                continue;
+
+            struct sockaddr_storage ss;
+            socklen_t len = peer.to_sockaddr(ss);
+            tx.push_ref((struct sockaddr*)&ss, len, j.data);
+        }
+
+        j.members->release();
+        m_jobs.pop_front();
+    }
+    return true;
+}
+
+} //namespace vodeox
@@ -0,0 +1,152 @@
+#ifndef __NET_FANOUT_H
+#define __NET_FANOUT_H
+
+#include <stddef.h>
+
+#include <map>
+#include <set>
+#include <deque>
+
+#include "base/types.h"
+#include "base/atomic.h"
+#include "base/scoped_lock.h"
+#include "base/slab.h"
+#include "net/session_table.h"
+#include "net/send_queue.h"
+#include "base/buffer.h"
+
+namespace vodeox
+{
+
+/*
+ * Immutable, refcounted snapshot of a group's members. Publishers hold on to a
+ * snapshot while they walk it, membership changes build a new one.
+ */
+class member_list
+{
+ public:
+    static member_list* create(size_t count);
+
+    void retain() { atomic_fetch_add(&m_refs, 1); }
+    void release();
+
+    size_t size() const { return m_count; }
+    const peer_key& operator[](size_t i) const { return m_members[i]; }
+
+ private:
+    member_list();
+    member_list(const member_list&);
+    member_list& operator=(const member_list&);
+
+    friend class group_registry;
+
+ private:
+    volatile int    m_refs;
+    size_t          m_count;
+    peer_key        m_members[1];
+};
+
+/*
+ * Group membership shared by all reactors. Any reactor can deliver to any
+ * member because every reactor socket is bound to the same port, so the
+ * registry is the only piece of fan-out state shared between threads.
+ *
+ * Groups are spread over GROUP_SHARDS independently locked maps, so reactors
+ * only wait on each other when they touch groups in the same shard. A group
+ * keeps its members in a sorted set, joins and leaves are O(log N), and the
+ * immutable snapshot publishes hand out is only rebuilt by the first publish
+ * after a change. Building up a group of N members costs O(N log N) instead
+ * of a copy of the list per join.
+ */
+class group_registry
+{
+ public:
+    enum { GROUP_SHARDS = 16 };
+
+    group_registry() {}
+    virtual ~group_registry();
+
+    bool join(uint32 group, const peer_key& peer);
+    bool leave(uint32 group, const peer_key& peer);
+
+    /*
+     * Returns a retained snapshot of the group's members or NULL for an
+     * empty group. The caller must release() it.
+     */
+    member_list* members(uint32 group);
+
+    size_t size() const;
+
+ private:
+    struct group
+    {
+        std::set<peer_key>  members;
+        member_list*        snapshot;   //NULL until a publish needs it after a change
+
+        group() : snapshot(NULL) {}
+    };
+
+    typedef std::map<uint32, group*> group_map;
+
+    struct shard
+    {
+        mutable mutex       lock;
+        group_map           groups;
+    };
+
+    shard& shard_of(uint32 group) { return m_shards[group % GROUP_SHARDS]; }
+
+    static void invalidate(group* g);
+
+    group_registry(const group_registry&);
+    group_registry& operator=(const group_registry&);
+
+ private:
+    shard               m_shards[GROUP_SHARDS];
+};
+
+/*
+ * Per-reactor backlog of pending deliveries. A publish is recorded as one job
+ * (snapshot, buffers, cursor) and pump() turns it into send queue entries only
+ * as fast as the queue drains, so a 1-to-10,000 fan-out never needs 10,000
+ * queue slots or 10,000 copies of the payload.
+ */
+class fanout_queue
+{
+ public:
+    fanout_queue() {}
+    virtual ~fanout_queue();
+
+    /*
+     * Takes over the caller's reference to members, data is shared by
+     * every delivery.
+     */
+    void publish(member_list* members, const buffer_chain& data, const peer_key& sender);
+
+    /*
+     * Moves deliveries into tx until it is full, returns true once every
+     * job has been handed over.
+     */
+    bool pump(send_queue& tx);
+
+    bool empty() const { return m_jobs.empty(); }
+
+ private:
+    struct job
+    {
+        member_list*    members;
+        buffer_chain    data;
+        peer_key        sender;
+        size_t          next;
+    };
+
+    fanout_queue(const fanout_queue&);
+    fanout_queue& operator=(const fanout_queue&);
+
+ private:
+    std::deque<job, slab_allocator<job> >   m_jobs;
+};
+
+} //namespace vodeox
+
+#endif
@@ -0,0 +1,228 @@
+#include "config.h"
+
+#include "net/handoff.h"
+#include "base/atomic.h"
+#include "base/metrics.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+namespace vodeox
+{
+
+//datagrams of batches the filter couldn't get output memory for
+static counter s_dropped("handoff.dropped");
+
+handoff_batch::handoff_batch(unsigned int capacity, size_t datagram_size) :
+    m_capacity(capacity ? capacity : 1),
+    m_count(0),
+    m_datagram_size(datagram_size),
+    m_stamp(0),
+    m_failed(false)
+{
+    m_in = new buffer[m_capacity];
+    m_out = new buffer[m_capacity];
+    m_peers = new struct sockaddr_storage[m_capacity];
+    m_peer_lens = new socklen_t[m_capacity];
+}
+
+handoff_batch::~handoff_batch()
+{
+    delete [] m_peer_lens;
+    delete [] m_peers;
+    delete [] m_out;
+    delete [] m_in;
+}
+
+handoff_pipeline::handoff_pipeline(Threadpool& pool, const payload_filter* filter,
+                                   unsigned int batch_size, size_t datagram_size,
+                                   unsigned int depth) :
+    m_pool(pool),
+    m_filter(filter),
+    m_batch_size(batch_size ? batch_size : 1),
+    m_datagram_size(datagram_size),
+    m_depth(depth ? depth : 1),
+    m_on_complete(NULL),
+    m_arg(NULL),
+    m_wakeup_rd(-1),
+    m_wakeup_wr(-1),
+    m_signaled(0),
+    m_current(NULL),
+    m_in_flight(0),
+    m_done(m_depth)
+{
+}
+
+handoff_pipeline::~handoff_pipeline()
+{
+    //the pool is stopped before its reactors go away, whatever it didn't get
+    //to is still in m_all
+    for (size_t i = 0; i < m_all.size(); i++)
+        delete m_all[i];
+
+    if (m_wakeup_wr >= 0 && m_wakeup_wr != m_wakeup_rd)
+        close(m_wakeup_wr);
+    if (m_wakeup_rd >= 0)
+        close(m_wakeup_rd);
+}
+
+bool handoff_pipeline::open(completion_callback on_complete, void* arg)
+{
+    m_on_complete = on_complete;
+    m_arg = arg;
+
+#ifdef HAVE_SYS_EVENTFD_H
+    m_wakeup_rd = m_wakeup_wr = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeup_rd >= 0)
+        return true;
+#endif
+
+    int fds[2];
+    if (pipe(fds) < 0)
+    {
+        perror("pipe");
+        return false;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    m_wakeup_rd = fds[0];
+    m_wakeup_wr = fds[1];
+    return true;
+}
+
+handoff_batch* handoff_pipeline::acquire()
+{
+    if (m_in_flight >= m_depth)
+        return NULL;
+
+    handoff_batch* b;
+    if (!m_free.empty())
+    {
+        b = m_free.back();
+        m_free.pop_back();
+    }
+    else
+    {
+        b = new handoff_batch(m_batch_size, m_datagram_size);
+        m_all.push_back(b);
+    }
+    b->m_count = 0;
+    b->m_failed = false;
+    return b;
+}
+
+bool handoff_pipeline::add(const buffer& data, const struct sockaddr* peer, socklen_t peer_len, uint64 stamp)
+{
+    if (m_current && m_current->full())
+        flush();
+    if (!m_current && !(m_current = acquire()))
+        return false;
+    if (data.size() > m_datagram_size || peer_len > (socklen_t)sizeof(struct sockaddr_storage))
+        return false;
+
+    handoff_batch* b = m_current;
+    unsigned int i = b->m_count++;
+    if (i == 0)
+        b->m_stamp = stamp;
+    b->m_in[i] = data;
+    memcpy(&b->m_peers[i], peer, peer_len);
+    b->m_peer_lens[i] = peer_len;
+    return true;
+}
+
+void handoff_pipeline::flush()
+{
+    handoff_batch* b = m_current;
+    if (!b)
+        return;
+    m_current = NULL;
+
+    if (b->m_count == 0)
+    {
+        m_free.push_back(b);
+        return;
+    }
+    m_in_flight++;
+    m_pool.submit(job(this, b));
+}
+
+void handoff_pipeline::process(handoff_batch* b)
+{
+    if (!m_filter)
+    {
+        for (unsigned int i = 0; i < b->m_count; i++)
+            b->m_out[i] = b->m_in[i];
+        return;
+    }
+
+    //one chunk for the whole batch, the results are sliced out of it
+    buffer out = buffer::allocate(b->m_count * m_datagram_size);
+    if (out.empty())
+    {
+        b->m_failed = true;
+        s_dropped.add(b->m_count);
+        return;
+    }
+
+    for (unsigned int i = 0; i < b->m_count; i++)
+    {
+        size_t off = i * m_datagram_size;
+        size_t len = m_filter->apply(out.mutable_data() + off, b->m_in[i].data(), b->m_in[i].size(),
+                                     m_datagram_size);
+        b->m_out[i] = out.slice(off, len);
+        b->m_in[i].reset();
+    }
+}
+
+void handoff_pipeline::complete(handoff_batch* b)
+{
+    //never more than depth batches in flight, so this doesn't block
+    m_done.push(b);
+
+    //the loop clears the flag before it drains, so a completion either gets
+    //drained in the current round or rings the bell for the next one
+    if (atomic_exchange(&m_signaled, 1) == 0)
+    {
+        uint64 one = 1;
+        ssize_t ret;
+        do {
+            ret = write(m_wakeup_wr, &one, m_wakeup_wr == m_wakeup_rd ? sizeof(one) : 1);
+        } while (ret < 0 && errno == EINTR);
+    }
+}
+
+unsigned int handoff_pipeline::drain()
+{
+    char buf[64];
+    while (read(m_wakeup_rd, buf, sizeof(buf)) > 0)
+        ;
+    atomic_exchange(&m_signaled, 0);
+
+    unsigned int n = 0;
+    handoff_batch* b;
+    while (m_done.try_pop(b))
+    {
+        m_on_complete(*b, m_arg);
+        for (unsigned int i = 0; i < b->m_count; i++)
+        {
+            b->m_in[i].reset();
+            b->m_out[i].reset();
+        }
+        m_in_flight--;
+        m_free.push_back(b);
+        n++;
+    }
+    return n;
+}
+
+} //namespace vodeox
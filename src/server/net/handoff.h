@@ -0,0 +1,171 @@
+#ifndef __NET_HANDOFF_H
+#define __NET_HANDOFF_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "base/types.h"
+#include "base/concurrent_queue.h"
+#include "base/threadpool.h"
+#include "base/transform.h"
+#include "base/buffer.h"
+
+namespace vodeox
+{
+
+static const unsigned int DEFAULT_HANDOFF_DEPTH = 4;
+
+/*
+ * A batch of raw datagrams on its way through the pool, the worker fills the
+ * output slots. Inputs are slices of the receive buffers, outputs slices of
+ * one chunk the worker writes the filtered datagrams to, or the inputs
+ * themselves when there is no filter. Batches are owned by their pipeline and
+ * recycled, the slices are let go once the batch is drained.
+ */
+class handoff_batch
+{
+ public:
+    handoff_batch(unsigned int capacity, size_t datagram_size);
+    virtual ~handoff_batch();
+
+    unsigned int size() const { return m_count; }
+    unsigned int capacity() const { return m_capacity; }
+    bool full() const { return m_count == m_capacity; }
+
+    /*
+     * Receive time of the first datagram, see handoff_pipeline::add
+     */
+    uint64 stamp() const { return m_stamp; }
+
+    /*
+     * The worker had no memory for the outputs, nothing is to be sent
+     */
+    bool failed() const { return m_failed; }
+
+    const buffer& output(unsigned int i) const { return m_out[i]; }
+    const struct sockaddr* peer(unsigned int i) const { return (const struct sockaddr*)&m_peers[i]; }
+    socklen_t peer_len(unsigned int i) const { return m_peer_lens[i]; }
+
+ private:
+    handoff_batch(const handoff_batch&);
+    handoff_batch& operator=(const handoff_batch&);
+
+    friend class handoff_pipeline;
+
+ private:
+    unsigned int                m_capacity;
+    unsigned int                m_count;
+    size_t                      m_datagram_size;
+    uint64                      m_stamp;
+    bool                        m_failed;
+
+    buffer*                     m_in;
+    buffer*                     m_out;
+    struct sockaddr_storage*    m_peers;
+    socklen_t*                  m_peer_lens;
+};
+
+/*
+ * Moves the payload filter off a reactor's loop. The loop adds references to
+ * raw datagrams to a batch and hands it to the pool once per receive round, so no datagram
+ * waits for a batch to fill up. Workers run the filter and post the batch back
+ * on a completion queue, waking the loop through an eventfd (a pipe where
+ * eventfd is not available). Only the first completion after the loop last
+ * drained writes to the fd, so a burst of batches costs one wakeup.
+ *
+ * At most depth batches are in flight per pipeline. Beyond that add() refuses
+ * and the caller handles the datagram inline, which bounds both the memory
+ * and the time a datagram can spend queued behind the pool.
+ *
+ * Everything but the worker side runs on the owning loop thread.
+ */
+class handoff_pipeline
+{
+ public:
+    /*
+     * Called on the loop thread for every finished batch
+     */
+    typedef void (*completion_callback)(const handoff_batch& batch, void* arg);
+
+    handoff_pipeline(Threadpool& pool, const payload_filter* filter,
+                     unsigned int batch_size, size_t datagram_size,
+                     unsigned int depth = DEFAULT_HANDOFF_DEPTH);
+    virtual ~handoff_pipeline();
+
+    /*
+     * Creates the wakeup fd, false on failure
+     */
+    bool open(completion_callback on_complete, void* arg);
+
+    /*
+     * The loop watches this fd for reads and calls drain() when it fires
+     */
+    int fd() const { return m_wakeup_rd; }
+
+    /*
+     * Adds a reference to a datagram to the current batch, false when every
+     * batch is in flight
+     */
+    bool add(const buffer& data, const struct sockaddr* peer, socklen_t peer_len, uint64 stamp = 0);
+
+    /*
+     * Hands the current batch to the pool
+     */
+    void flush();
+
+    /*
+     * Delivers finished batches to the completion callback, returns how many
+     */
+    unsigned int drain();
+
+    unsigned int in_flight() const { return m_in_flight; }
+
+ private:
+    //worker side
+    void process(handoff_batch* b);
+    void complete(handoff_batch* b);
+
+    handoff_batch* acquire();
+
+    struct job
+    {
+        handoff_pipeline*   pipeline;
+        handoff_batch*      batch;
+
+        job(handoff_pipeline* p, handoff_batch* b) : pipeline(p), batch(b) {}
+        void operator()() { pipeline->process(batch); pipeline->complete(batch); }
+    };
+    friend struct job;
+
+    handoff_pipeline(const handoff_pipeline&);
+    handoff_pipeline& operator=(const handoff_pipeline&);
+
+ private:
+    Threadpool&                         m_pool;
+    const payload_filter*               m_filter;
+    unsigned int                        m_batch_size;
+    size_t                              m_datagram_size;
+    unsigned int                        m_depth;
+
+    completion_callback                 m_on_complete;
+    void*                               m_arg;
+
+    int                                 m_wakeup_rd;
+    int                                 m_wakeup_wr;
+    volatile int                        m_signaled;
+
+    //loop thread only
+    handoff_batch*                      m_current;
+    std::vector<handoff_batch*>         m_free;
+    std::vector<handoff_batch*>         m_all;
+    unsigned int                        m_in_flight;
+
+    concurrent_queue<handoff_batch*>    m_done;
+};
+
+} //namespace vodeox
+
+#endif
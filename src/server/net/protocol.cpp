@@ -0,0 +1,109 @@
+#include "config.h"
+
+#include "net/protocol.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+namespace vodeox
+{
+
+static inline uint32 load_uint32(const char* p)
+{
+    uint32 v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+static inline uint16 load_uint16(const char* p)
+{
+    uint16 v;
+    memcpy(&v, p, sizeof(v));
+    return ntohs(v);
+}
+
+decode_status decode_message(const char* buf, size_t len, message& msg, size_t& consumed)
+{
+    if (len < MESSAGE_HEADER_SIZE)
+        return DECODE_SHORT;
+
+    const uint8* h = (const uint8*)buf;
+    if (h[0] != PROTOCOL_MAGIC)
+        return DECODE_BAD_MAGIC;
+    if (h[1] != PROTOCOL_VERSION)
+        return DECODE_BAD_VERSION;
+    if (h[2] == 0 || h[2] >= MSG_TYPE_MAX)
+        return DECODE_BAD_TYPE;
+
+    size_t body_len = load_uint16(buf + 12);
+    if (len - MESSAGE_HEADER_SIZE < body_len)
+        return DECODE_SHORT;
+
+    msg.type = h[2];
+    msg.flags = h[3];
+    msg.session = load_uint32(buf + 4);
+    msg.sequence = load_uint32(buf + 8);
+    msg.body = buf + MESSAGE_HEADER_SIZE;
+    msg.body_len = body_len;
+
+    consumed = MESSAGE_HEADER_SIZE + body_len;
+    return DECODE_OK;
+}
+
+bool decode_group(const message& msg, uint32& group, const char*& rest, size_t& rest_len)
+{
+    if (msg.body_len < sizeof(uint32))
+        return false;
+
+    group = load_uint32(msg.body);
+    rest = msg.body + sizeof(uint32);
+    rest_len = msg.body_len - sizeof(uint32);
+    return true;
+}
+
+void encode_uint32(char* out, uint32 v)
+{
+    v = htonl(v);
+    memcpy(out, &v, sizeof(v));
+}
+
+size_t encode_header(char* out, uint8 type, uint32 session, uint32 sequence, size_t body_len, uint8 flags)
+{
+    uint8* h = (uint8*)out;
+    h[0] = PROTOCOL_MAGIC;
+    h[1] = PROTOCOL_VERSION;
+    h[2] = type;
+    h[3] = flags;
+    encode_uint32(out + 4, session);
+    encode_uint32(out + 8, sequence);
+
+    uint16 l = htons((uint16)body_len);
+    memcpy(out + 12, &l, sizeof(l));
+    out[14] = out[15] = 0;
+    return MESSAGE_HEADER_SIZE;
+}
+
+int dispatch_messages(const char* buf, size_t len, message_handler& h)
+{
+    int count = 0;
+    while (len > 0)
+    {
+        message msg;
+        size_t consumed;
+        decode_status status = decode_message(buf, len, msg, consumed);
+        if (status != DECODE_OK)
+        {
+            h.on_error(status);
+            break;
+        }
+
+        h.on_message(msg);
+        count++;
+
+        buf += consumed;
+        len -= consumed;
+    }
+    return count;
+}
+
+} //namespace vodeox
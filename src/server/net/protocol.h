@@ -0,0 +1,130 @@
+#ifndef __NET_PROTOCOL_H
+#define __NET_PROTOCOL_H
+
+#include <stddef.h>
+
+#include "base/types.h"
+
+namespace vodeox
+{
+
+/*
+ * Binary signaling protocol. Every message is a fixed 16 byte header followed
+ * by length bytes of body, all integers in network byte order:
+ *
+ *   0        1        2        3
+ *   +--------+--------+--------+--------+
+ *   | magic  |version |  type  | flags  |
+ *   +--------+--------+--------+--------+
+ *   |            session id             |
+ *   +-----------------------------------+
+ *   |             sequence              |
+ *   +-----------------+-----------------+
+ *   |     length      |    reserved     |
+ *   +-----------------+-----------------+
+ *
+ * A datagram may carry several messages back to back. JOIN, LEAVE, PUBLISH and
+ * DATA bodies start with a 32 bit group id, ACK carries a one byte status.
+ */
+
+static const uint8 PROTOCOL_MAGIC = 0xd5;
+static const uint8 PROTOCOL_VERSION = 1;
+static const size_t MESSAGE_HEADER_SIZE = 16;
+static const size_t MAX_MESSAGE_BODY = 0xffff;
+
+enum message_type
+{
+    MSG_HELLO = 1,      //client introduces itself, answered with HELLO carrying its session id
+    MSG_JOIN,           //join a group, ACKed
+    MSG_LEAVE,          //leave a group, ACKed
+    MSG_PUBLISH,        //deliver the body to every other member of the group
+    MSG_DATA,           //server to client delivery of a PUBLISH
+    MSG_ACK,
+    MSG_PING,           //answered with PONG carrying the same body
+    MSG_PONG,
+    MSG_TYPE_MAX
+};
+
+enum message_flags
+{
+    FLAG_ACK_REQUESTED = 0x01     //ACK a PUBLISH (JOIN and LEAVE are always ACKed)
+};
+
+enum ack_status
+{
+    ACK_OK = 0,
+    ACK_BAD_REQUEST,
+    ACK_UNKNOWN_GROUP,
+    ACK_REFUSED
+};
+
+enum decode_status
+{
+    DECODE_OK = 0,
+    DECODE_SHORT,           //fewer bytes than a header, or than the header says
+    DECODE_BAD_MAGIC,
+    DECODE_BAD_VERSION,
+    DECODE_BAD_TYPE
+};
+
+/*
+ * Decoded view of one message. body points into the buffer that was decoded,
+ * nothing is copied, so the view is only valid as long as that buffer is.
+ */
+struct message
+{
+    uint8           type;
+    uint8           flags;
+    uint32          session;
+    uint32          sequence;
+    const char*     body;
+    size_t          body_len;
+};
+
+/*
+ * Decodes the message at the start of buf. On DECODE_OK msg is filled in and
+ * consumed is the size of the whole message. Safe on arbitrary input: it never
+ * reads outside [buf, buf + len), never allocates and keeps no state, so it can
+ * be handed straight to a fuzzer.
+ */
+decode_status decode_message(const char* buf, size_t len, message& msg, size_t& consumed);
+
+/*
+ * Splits a group prefixed body into the group id and the rest of the body.
+ */
+bool decode_group(const message& msg, uint32& group, const char*& rest, size_t& rest_len);
+
+/*
+ * Writes a header for a body of body_len bytes, out needs MESSAGE_HEADER_SIZE
+ * bytes. Returns MESSAGE_HEADER_SIZE.
+ */
+size_t encode_header(char* out, uint8 type, uint32 session, uint32 sequence, size_t body_len, uint8 flags = 0);
+
+void encode_uint32(char* out, uint32 v);
+
+/*
+ * Interface for consumers of decoded messages.
+ */
+class message_handler
+{
+ public:
+    virtual ~message_handler() {}
+
+    virtual void on_message(const message& msg) = 0;
+
+    /*
+     * Called once when a datagram stops parsing, whatever follows
+     * the bad message in the buffer is ignored.
+     */
+    virtual void on_error(decode_status status) {}
+};
+
+/*
+ * Decodes every message in buf straight from the receive buffer and hands them
+ * to h in order. Returns the number of messages dispatched.
+ */
+int dispatch_messages(const char* buf, size_t len, message_handler& h);
+
+} //namespace vodeox
+
+#endif
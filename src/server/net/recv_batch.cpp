@@ -0,0 +1,153 @@
+#include "config.h"
+
+#include "net/recv_batch.h"
+
+#include <errno.h>
+#include <string.h>
+
+namespace vodeox
+{
+
+recv_batch::recv_batch(unsigned int batch_size, size_t datagram_size) :
+    m_batch_size(batch_size ? batch_size : 1),
+    m_datagram_size(datagram_size),
+    m_cursor(0)
+{
+    m_lengths = new size_t[m_batch_size];
+    m_truncated = new bool[m_batch_size];
+    m_peers = new struct sockaddr_storage[m_batch_size];
+    m_peer_lens = new socklen_t[m_batch_size];
+
+#ifdef HAVE_RECVMMSG
+    m_msgs = new struct mmsghdr[m_batch_size];
+    m_iovecs = new struct iovec[m_batch_size];
+    m_use_mmsg = true;
+
+    //the buffers move with the chunk, see prepare()
+    memset(m_msgs, 0, sizeof(struct mmsghdr) * m_batch_size);
+    for (unsigned int i = 0; i < m_batch_size; i++)
+    {
+        m_iovecs[i].iov_len = m_datagram_size;
+        m_msgs[i].msg_hdr.msg_iov = &m_iovecs[i];
+        m_msgs[i].msg_hdr.msg_iovlen = 1;
+        m_msgs[i].msg_hdr.msg_name = &m_peers[i];
+    }
+#endif
+}
+
+recv_batch::~recv_batch()
+{
+#ifdef HAVE_RECVMMSG
+    delete [] m_iovecs;
+    delete [] m_msgs;
+#endif
+    delete [] m_peer_lens;
+    delete [] m_peers;
+    delete [] m_truncated;
+    delete [] m_lengths;
+}
+
+size_t recv_batch::chunk_size() const
+{
+    size_t round = m_batch_size * m_datagram_size;
+    size_t size = round * RECV_CHUNK_BATCHES;
+
+    //stay within the slab, only a single round too big for it goes to malloc
+    if (size > BUFFER_MAX_POOLED)
+        size = round > BUFFER_MAX_POOLED ? round : BUFFER_MAX_POOLED;
+    return size;
+}
+
+bool recv_batch::prepare()
+{
+    size_t round = m_batch_size * m_datagram_size;
+
+    if (m_chunk.unique())
+        m_cursor = 0;
+    else if (!m_chunk.empty() && m_cursor + 2 * round <= m_chunk.size())
+        m_cursor += round;
+    else
+    {
+        //datagrams of earlier rounds are still referenced, leave them be
+        m_chunk = buffer::allocate(chunk_size());
+        m_cursor = 0;
+        if (m_chunk.empty())
+        {
+            errno = ENOMEM;
+            return false;
+        }
+    }
+
+#ifdef HAVE_RECVMMSG
+    for (unsigned int i = 0; i < m_batch_size; i++)
+        m_iovecs[i].iov_base = data(i);
+#endif
+    return true;
+}
+
+int recv_batch::receive(int fd)
+{
+    if (!prepare())
+        return -1;
+
+#ifdef HAVE_RECVMMSG
+    if (m_use_mmsg)
+    {
+        int ret = receive_mmsg(fd);
+        if (ret >= 0 || errno != ENOSYS)
+            return ret;
+
+        //built against a libc that has it, running on a kernel that doesn't
+        m_use_mmsg = false;
+    }
+#endif
+    return receive_loop(fd);
+}
+
+#ifdef HAVE_RECVMMSG
+int recv_batch::receive_mmsg(int fd)
+{
+    for (unsigned int i = 0; i < m_batch_size; i++)
+    {
+        m_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        m_msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    int n = recvmmsg(fd, m_msgs, m_batch_size, 0, NULL);
+    if (n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        m_lengths[i] = m_msgs[i].msg_len;
+        m_truncated[i] = (m_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+        m_peer_lens[i] = m_msgs[i].msg_hdr.msg_namelen;
+    }
+    return n;
+}
+#endif
+
+int recv_batch::receive_loop(int fd)
+{
+    unsigned int n = 0;
+    while (n < m_batch_size)
+    {
+        m_peer_lens[n] = sizeof(struct sockaddr_storage);
+        ssize_t result = recvfrom(fd, data(n), m_datagram_size, 0,
+                                  (struct sockaddr*)&m_peers[n], &m_peer_lens[n]);
+        if (result < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            //report what we already have, the error will show up again on the next call
+            return n > 0 ? (int)n : -1;
+        }
+
+        m_lengths[n] = result;
+        m_truncated[n] = (size_t)result == m_datagram_size;
+        n++;
+    }
+    return n;
+}
+
+} //namespace vodeox
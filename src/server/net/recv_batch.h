@@ -0,0 +1,98 @@
+#ifndef __NET_RECV_BATCH_H
+#define __NET_RECV_BATCH_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stddef.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_RECVMMSG
+#include <sys/uio.h>
+#endif
+
+#include "base/buffer.h"
+
+namespace vodeox
+{
+
+static const unsigned int DEFAULT_RECV_BATCH = 32;
+static const size_t DEFAULT_DATAGRAM_SIZE = 2048;
+
+//receive rounds per chunk, fewer when that wouldn't fit a slab class
+static const unsigned int RECV_CHUNK_BATCHES = 4;
+
+/*
+ * Batched datagram receiver. Drains up to batch_size datagrams per receive()
+ * call, with a single recvmmsg where the platform has it and a recvfrom loop
+ * otherwise.
+ *
+ * Datagrams land straight in a buffer chunk. data() is only valid until the
+ * next receive(), but datagram() hands out a slice that keeps its bytes alive
+ * for as long as it is held: the next round then receives into the unused
+ * part of the chunk, or into a new one, instead of overwriting them. A chunk
+ * nobody kept a slice of is reused from the start.
+ */
+class recv_batch
+{
+ public:
+    recv_batch(unsigned int batch_size = DEFAULT_RECV_BATCH,
+               size_t datagram_size = DEFAULT_DATAGRAM_SIZE);
+    virtual ~recv_batch();
+
+    /*
+     * Returns the number of datagrams received, 0 if the socket would block
+     * and -1 on error (errno is preserved).
+     */
+    int receive(int fd);
+
+    unsigned int batch_size() const { return m_batch_size; }
+    size_t datagram_size() const { return m_datagram_size; }
+
+    char* data(unsigned int i) { return m_chunk.mutable_data() + m_cursor + i * m_datagram_size; }
+
+    /*
+     * Shared, zero copy reference to datagram i
+     */
+    buffer datagram(unsigned int i) const { return m_chunk.slice(m_cursor + i * m_datagram_size, m_lengths[i]); }
+    size_t length(unsigned int i) const { return m_lengths[i]; }
+    bool truncated(unsigned int i) const { return m_truncated[i]; }
+
+    const struct sockaddr* peer(unsigned int i) const { return (const struct sockaddr*)&m_peers[i]; }
+    socklen_t peer_len(unsigned int i) const { return m_peer_lens[i]; }
+
+ private:
+    size_t chunk_size() const;
+    bool prepare();
+    int receive_loop(int fd);
+#ifdef HAVE_RECVMMSG
+    int receive_mmsg(int fd);
+#endif
+
+    //no copies, the slots are owned by this object
+    recv_batch(const recv_batch&);
+    recv_batch& operator=(const recv_batch&);
+
+ private:
+    unsigned int                m_batch_size;
+    size_t                      m_datagram_size;
+
+    buffer                      m_chunk;
+    size_t                      m_cursor;   //first slot of this round in m_chunk
+    size_t*                     m_lengths;
+    bool*                       m_truncated;
+    struct sockaddr_storage*    m_peers;
+    socklen_t*                  m_peer_lens;
+
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr*             m_msgs;
+    struct iovec*               m_iovecs;
+    bool                        m_use_mmsg;
+#endif
+};
+
+} //namespace vodeox
+
+#endif
@@ -0,0 +1,240 @@
+#include "config.h"
+
+#include "net/send_queue.h"
+#include "base/time.h"
+
+#include <errno.h>
+#include <string.h>
+
+namespace vodeox
+{
+
+send_queue::send_queue(unsigned int capacity, unsigned int batch_size, size_t datagram_size) :
+    m_capacity(capacity ? capacity : 1),
+    m_batch_size(batch_size ? batch_size : 1),
+    m_datagram_size(datagram_size),
+    m_head(0),
+    m_tail(0),
+    m_reserved(false),
+    m_errors(0),
+    m_latency(NULL)
+{
+    if (m_batch_size > m_capacity)
+        m_batch_size = m_capacity;
+
+    m_entries = new entry[m_capacity];
+    m_buffers = new char[m_capacity * m_datagram_size];
+
+    m_iovecs = new struct iovec[m_batch_size * buffer_chain::MAX_PIECES];
+
+#ifdef HAVE_SENDMMSG
+    m_msgs = new struct mmsghdr[m_batch_size];
+    m_use_mmsg = true;
+
+    memset(m_msgs, 0, sizeof(struct mmsghdr) * m_batch_size);
+    for (unsigned int i = 0; i < m_batch_size; i++)
+        m_msgs[i].msg_hdr.msg_iov = &m_iovecs[i * buffer_chain::MAX_PIECES];
+#endif
+}
+
+send_queue::~send_queue()
+{
+    m_latency = NULL;
+    while (!empty())
+        sent(1);
+
+#ifdef HAVE_SENDMMSG
+    delete [] m_msgs;
+#endif
+    delete [] m_iovecs;
+    delete [] m_buffers;
+    delete [] m_entries;
+}
+
+send_queue::entry* send_queue::claim(const struct sockaddr* peer, socklen_t peer_len)
+{
+    if (full() || m_reserved || peer_len > sizeof(m_entries[0].peer))
+        return NULL;
+
+    entry& e = m_entries[slot(m_tail)];
+    memcpy(&e.peer, peer, peer_len);
+    e.peer_len = peer_len;
+    e.len = 0;
+    e.refs.clear();
+    e.stamp = 0;
+    return &e;
+}
+
+char* send_queue::reserve(const struct sockaddr* peer, socklen_t peer_len)
+{
+    if (!claim(peer, peer_len))
+        return NULL;
+
+    m_reserved = true;
+    return data(slot(m_tail));
+}
+
+void send_queue::commit(size_t len, uint64 stamp)
+{
+    if (!m_reserved)
+        return;
+
+    m_entries[slot(m_tail)].len = len < m_datagram_size ? len : m_datagram_size;
+    m_entries[slot(m_tail)].stamp = stamp;
+    m_reserved = false;
+    m_tail++;
+}
+
+bool send_queue::push(const struct sockaddr* peer, socklen_t peer_len, const char* data, size_t len)
+{
+    if (len > m_datagram_size)
+        return false;
+
+    char* buf = reserve(peer, peer_len);
+    if (!buf)
+        return false;
+
+    memcpy(buf, data, len);
+    commit(len);
+    return true;
+}
+
+bool send_queue::push_ref(const struct sockaddr* peer, socklen_t peer_len, const buffer& data, uint64 stamp)
+{
+    entry* e = claim(peer, peer_len);
+    if (!e)
+        return false;
+
+    e->refs.append(data);
+    e->len = data.size();
+    e->stamp = stamp;
+    m_tail++;
+    return true;
+}
+
+bool send_queue::push_ref(const struct sockaddr* peer, socklen_t peer_len, const buffer_chain& data, uint64 stamp)
+{
+    entry* e = claim(peer, peer_len);
+    if (!e)
+        return false;
+
+    e->refs = data;
+    e->len = data.size();
+    e->stamp = stamp;
+    m_tail++;
+    return true;
+}
+
+unsigned int send_queue::entry_iovec(unsigned int i, struct iovec* iov)
+{
+    const entry& e = m_entries[i];
+    if (!e.refs.empty())
+        return e.refs.to_iovec(iov);
+
+    iov[0].iov_base = data(i);
+    iov[0].iov_len = e.len;
+    return 1;
+}
+
+void send_queue::sent(unsigned int n)
+{
+    //one clock read per batch
+    uint64 now = m_latency ? vodeox::time::tsc_ns() : 0;
+    for (unsigned int k = 0; k < n; k++)
+    {
+        entry& e = m_entries[slot(m_head++)];
+        if (now && e.stamp)
+        {
+            m_latency->record(now > e.stamp ? now - e.stamp : 0);
+            e.stamp = 0;
+        }
+        e.refs.clear();
+    }
+}
+
+void send_queue::drop_head()
+{
+    //never sent, not a latency sample
+    m_entries[slot(m_head)].stamp = 0;
+    m_errors++;
+    sent(1);
+}
+
+bool send_queue::flush(int fd)
+{
+#ifdef HAVE_SENDMMSG
+    if (m_use_mmsg)
+    {
+        bool drained = flush_mmsg(fd);
+        if (m_use_mmsg)
+            return drained;
+    }
+#endif
+    return flush_loop(fd);
+}
+
+#ifdef HAVE_SENDMMSG
+bool send_queue::flush_mmsg(int fd)
+{
+    while (!empty())
+    {
+        unsigned int n = size() < m_batch_size ? size() : m_batch_size;
+        for (unsigned int k = 0; k < n; k++)
+        {
+            unsigned int i = slot(m_head + k);
+            m_msgs[k].msg_hdr.msg_iovlen = entry_iovec(i, m_msgs[k].msg_hdr.msg_iov);
+            m_msgs[k].msg_hdr.msg_name = &m_entries[i].peer;
+            m_msgs[k].msg_hdr.msg_namelen = m_entries[i].peer_len;
+        }
+
+        int count = sendmmsg(fd, m_msgs, n, 0);
+        if (count < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return false;
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOSYS)
+            {
+                m_use_mmsg = false;
+                return false;
+            }
+            //sendmmsg reports the error of the first datagram, skip it and go on
+            drop_head();
+            continue;
+        }
+
+        sent(count);
+    }
+    return true;
+}
+#endif
+
+bool send_queue::flush_loop(int fd)
+{
+    while (!empty())
+    {
+        unsigned int i = slot(m_head);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &m_entries[i].peer;
+        msg.msg_namelen = m_entries[i].peer_len;
+        msg.msg_iov = m_iovecs;
+        msg.msg_iovlen = entry_iovec(i, m_iovecs);
+
+        ssize_t result = sendmsg(fd, &msg, 0);
+        if (result < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return false;
+            if (errno == EINTR)
+                continue;
+            drop_head();
+            continue;
+        }
+        sent(1);
+    }
+    return true;
+}
+
+} //namespace vodeox
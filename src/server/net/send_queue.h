@@ -0,0 +1,146 @@
+#ifndef __NET_SEND_QUEUE_H
+#define __NET_SEND_QUEUE_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stddef.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "base/types.h"
+#include "base/metrics.h"
+#include "base/buffer.h"
+
+namespace vodeox
+{
+
+static const unsigned int DEFAULT_SEND_BATCH = 32;
+static const unsigned int DEFAULT_SEND_QUEUE = 1024;
+
+/*
+ * Outbound datagram queue. Every entry carries its own destination, so replies
+ * to different peers never share state. Entries live in a preallocated ring and
+ * are flushed up to batch_size at a time with sendmmsg (or a sendmsg loop where
+ * sendmmsg is not available), normally from an EV_WRITE callback.
+ *
+ * An entry either holds its bytes in its own slot or references buffers it
+ * gathers from when sending, see push_ref().
+ */
+class send_queue
+{
+ public:
+    send_queue(unsigned int capacity = DEFAULT_SEND_QUEUE,
+               unsigned int batch_size = DEFAULT_SEND_BATCH,
+               size_t datagram_size = 2048);
+    virtual ~send_queue();
+
+    /*
+     * Reserves the next slot for peer and returns its payload buffer
+     * (datagram_size bytes) so the caller can fill it in place; the entry
+     * becomes visible to flush() once commit() is called with its length.
+     * Returns NULL when the queue is full.
+     */
+    char* reserve(const struct sockaddr* peer, socklen_t peer_len);
+
+    /*
+     * stamp is when the request behind this reply came in (time::tsc_ns),
+     * the time until it leaves goes to the latency histogram. 0 if unknown.
+     */
+    void commit(size_t len, uint64 stamp = 0);
+
+    /*
+     * Copies len bytes for peer into the queue, returns false when full
+     * or when the payload doesn't fit into a slot.
+     */
+    bool push(const struct sockaddr* peer, socklen_t peer_len, const char* data, size_t len);
+
+    /*
+     * Queues a reference to data for peer without copying it, the queue
+     * holds its own reference until the datagram is sent or dropped.
+     * A chain goes out as one datagram gathered from its pieces.
+     */
+    bool push_ref(const struct sockaddr* peer, socklen_t peer_len, const buffer& data, uint64 stamp = 0);
+    bool push_ref(const struct sockaddr* peer, socklen_t peer_len, const buffer_chain& data, uint64 stamp = 0);
+
+    /*
+     * Sends as much as the socket accepts. Returns true once the queue is empty,
+     * false if the socket would block and entries remain. Entries failing with
+     * a per-destination error are dropped and counted in errors().
+     */
+    bool flush(int fd);
+
+    /*
+     * Receive to send latency of stamped replies, NULL turns it off
+     */
+    void set_latency_histogram(histogram* h) { m_latency = h; }
+
+    bool empty() const { return m_head == m_tail; }
+    bool full() const { return m_tail - m_head == m_capacity; }
+    unsigned int size() const { return (unsigned int)(m_tail - m_head); }
+
+    size_t datagram_size() const { return m_datagram_size; }
+    uint64 errors() const { return m_errors; }
+
+ private:
+    struct entry
+    {
+        union
+        {
+            struct sockaddr         sa;
+            struct sockaddr_in      sin;
+            struct sockaddr_in6     sin6;
+        }                       peer;
+        socklen_t               peer_len;
+        size_t                  len;
+        buffer_chain            refs;   //empty when the bytes are in our own slot
+        uint64                  stamp;
+    };
+
+    unsigned int slot(uint64 pos) const { return (unsigned int)(pos % m_capacity); }
+    char* data(unsigned int i) { return m_buffers + i * m_datagram_size; }
+    unsigned int entry_iovec(unsigned int i, struct iovec* iov);
+
+    entry* claim(const struct sockaddr* peer, socklen_t peer_len);
+    void sent(unsigned int n);
+
+    void drop_head();
+    bool flush_loop(int fd);
+#ifdef HAVE_SENDMMSG
+    bool flush_mmsg(int fd);
+#endif
+
+    send_queue(const send_queue&);
+    send_queue& operator=(const send_queue&);
+
+ private:
+    unsigned int            m_capacity;
+    unsigned int            m_batch_size;
+    size_t                  m_datagram_size;
+
+    entry*                  m_entries;
+    char*                   m_buffers;
+
+    //monotonically growing positions, slot() maps them onto the ring
+    uint64                  m_head;
+    uint64                  m_tail;
+    bool                    m_reserved;
+
+    uint64                  m_errors;
+    histogram*              m_latency;
+
+    //buffer_chain::MAX_PIECES per message
+    struct iovec*           m_iovecs;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr*         m_msgs;
+    bool                    m_use_mmsg;
+#endif
+};
+
+} //namespace vodeox
+
+#endif
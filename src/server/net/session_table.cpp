@@ -0,0 +1,219 @@
+#include "config.h"
+
+#include "net/session_table.h"
+
+#include <netinet/in.h>
+#include <string.h>
+
+namespace vodeox
+{
+
+bool peer_key::from_sockaddr(const struct sockaddr* sa, socklen_t len, peer_key& key)
+{
+    memset(&key, 0, sizeof(key));
+
+    if (sa->sa_family == AF_INET && len >= (socklen_t)sizeof(struct sockaddr_in))
+    {
+        const struct sockaddr_in* sin = (const struct sockaddr_in*)sa;
+        memcpy(key.addr, &sin->sin_addr, 4);
+        key.port = sin->sin_port;
+        key.family = AF_INET;
+        return true;
+    }
+    else if (sa->sa_family == AF_INET6 && len >= (socklen_t)sizeof(struct sockaddr_in6))
+    {
+        const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*)sa;
+        memcpy(key.addr, &sin6->sin6_addr, 16);
+        key.port = sin6->sin6_port;
+        key.family = AF_INET6;
+        return true;
+    }
+    return false;
+}
+
+socklen_t peer_key::to_sockaddr(struct sockaddr_storage& ss) const
+{
+    memset(&ss, 0, sizeof(ss));
+    if (family == AF_INET)
+    {
+        struct sockaddr_in* sin = (struct sockaddr_in*)&ss;
+        sin->sin_family = AF_INET;
+        sin->sin_port = port;
+        memcpy(&sin->sin_addr, addr, 4);
+        return sizeof(struct sockaddr_in);
+    }
+
+    struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&ss;
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = port;
+    memcpy(&sin6->sin6_addr, addr, 16);
+    return sizeof(struct sockaddr_in6);
+}
+
+bool peer_key::operator==(const peer_key& k) const
+{
+    return memcmp(this, &k, sizeof(peer_key)) == 0;
+}
+
+bool peer_key::operator<(const peer_key& k) const
+{
+    return memcmp(this, &k, sizeof(peer_key)) < 0;
+}
+
+static size_t round_up_pow2(size_t n)
+{
+    size_t c = 16;
+    while (c < n)
+        c <<= 1;
+    return c;
+}
+
+session_table::session_table(size_t capacity, size_t max_sessions, uint64 idle_usec) :
+    m_size(0),
+    m_max_sessions(max_sessions),
+    m_idle_usec(idle_usec),
+    m_next_id(1)
+{
+    //keep the load factor under 3/4 for the requested number of sessions
+    size_t slots = round_up_pow2(capacity + capacity / 3);
+    m_slots = new session[slots];
+    memset(m_slots, 0, sizeof(session) * slots);
+    m_mask = slots - 1;
+}
+
+session_table::~session_table()
+{
+    delete [] m_slots;
+}
+
+uint64 session_table::hash(const peer_key& key)
+{
+    uint64 a, b;
+    uint32 c;
+    memcpy(&a, key.addr, 8);
+    memcpy(&b, key.addr + 8, 8);
+    memcpy(&c, &key.port, 4);
+
+    //murmur3 finalizer over the folded key
+    uint64 h = a ^ (b * 0x9e3779b97f4a7c15ULL) ^ ((uint64)c << 17);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+size_t session_table::probe(const peer_key& key, bool& found) const
+{
+    size_t i = hash(key) & m_mask;
+    while (m_slots[i].id != 0)
+    {
+        if (m_slots[i].key == key)
+        {
+            found = true;
+            return i;
+        }
+        i = (i + 1) & m_mask;
+    }
+    found = false;
+    return i;
+}
+
+session* session_table::find(const peer_key& key)
+{
+    bool found;
+    size_t i = probe(key, found);
+    return found ? &m_slots[i] : NULL;
+}
+
+session* session_table::find_or_insert(const peer_key& key, uint64 now, bool& inserted)
+{
+    bool found;
+    size_t i = probe(key, found);
+    inserted = false;
+    if (found)
+        return &m_slots[i];
+
+    if (m_size >= m_max_sessions)
+        return NULL;
+
+    if ((m_size + 1) * 4 > capacity() * 3)
+    {
+        grow();
+        i = probe(key, found);
+    }
+
+    session& s = m_slots[i];
+    s.key = key;
+    s.id = m_next_id++;
+    if (m_next_id == SESSION_ID_LIMIT)
+        m_next_id = 1;
+    s.last_seen = now;
+    s.packets = 0;
+    s.group = 0;
+
+    m_size++;
+    inserted = true;
+    return &s;
+}
+
+bool session_table::erase(const peer_key& key)
+{
+    bool found;
+    size_t i = probe(key, found);
+    if (!found)
+        return false;
+
+    erase_slot(i);
+    return true;
+}
+
+void session_table::erase_slot(size_t i)
+{
+    //backward shift: pull later members of the probe chain into the hole
+    size_t j = i;
+    for (;;)
+    {
+        j = (j + 1) & m_mask;
+        if (m_slots[j].id == 0)
+            break;
+
+        size_t k = hash(m_slots[j].key) & m_mask;
+        bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (stays)
+            continue;
+
+        m_slots[i] = m_slots[j];
+        i = j;
+    }
+    m_slots[i].id = 0;
+    m_size--;
+}
+
+void session_table::grow()
+{
+    size_t slots = (m_mask + 1) * 2;
+    session* fresh = new session[slots];
+    memset(fresh, 0, sizeof(session) * slots);
+
+    session* old = m_slots;
+    size_t old_slots = m_mask + 1;
+
+    m_slots = fresh;
+    m_mask = slots - 1;
+
+    for (size_t n = 0; n < old_slots; n++)
+    {
+        if (old[n].id == 0)
+            continue;
+
+        bool found;
+        size_t i = probe(old[n].key, found);
+        m_slots[i] = old[n];
+    }
+
+    delete [] old;
+}
+
+} //namespace vodeox
@@ -0,0 +1,109 @@
+#ifndef __NET_SESSION_TABLE_H
+#define __NET_SESSION_TABLE_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stddef.h>
+
+#include "base/types.h"
+
+namespace vodeox
+{
+
+static const size_t DEFAULT_SESSION_CAPACITY = 4096;
+static const size_t DEFAULT_MAX_SESSIONS = 1 << 22;
+static const uint64 DEFAULT_SESSION_IDLE_USEC = 60 * 1000000ULL;
+
+//table session ids count up from 1 and wrap below this, ids from here up
+//are left to sessions kept elsewhere (TCP connections)
+static const uint32 SESSION_ID_LIMIT = 0x80000000U;
+
+/*
+ * Peer address packed into a fixed 20 byte key, IPv4 addresses are stored
+ * in the first 4 bytes of addr and the rest is zeroed so keys compare bytewise.
+ */
+struct peer_key
+{
+    uint8   addr[16];
+    uint16  port;           //network byte order
+    uint8   family;
+    uint8   pad;
+
+    /*
+     * Returns false for anything but AF_INET/AF_INET6 peers
+     */
+    static bool from_sockaddr(const struct sockaddr* sa, socklen_t len, peer_key& key);
+    socklen_t to_sockaddr(struct sockaddr_storage& ss) const;
+
+    bool operator==(const peer_key& k) const;
+
+    /*
+     * Arbitrary but consistent order, for sorted containers
+     */
+    bool operator<(const peer_key& k) const;
+};
+
+/*
+ * Per-peer record kept inline in the table slots, keep it small: the table
+ * is probed linearly so every byte here is a byte less per cache line.
+ */
+struct session
+{
+    peer_key    key;
+    uint32      id;         //0 marks an empty slot
+    uint64      last_seen;  //usec
+    uint64      packets;
+    uint32      group;      //fan-out group the peer joined, 0 for none
+};
+
+/*
+ * Open addressing hash table of sessions keyed by peer address. Linear probing
+ * over a power of two slot array with backward shift deletion, so there are no
+ * tombstones and lookups never degrade after churn. The table only allocates
+ * when it grows; a lookup or an update of a known peer never touches the heap.
+ * Pointers returned by find/insert stay valid until the next insert or erase.
+ */
+class session_table
+{
+ public:
+    session_table(size_t capacity = DEFAULT_SESSION_CAPACITY,
+                  size_t max_sessions = DEFAULT_MAX_SESSIONS,
+                  uint64 idle_usec = DEFAULT_SESSION_IDLE_USEC);
+    virtual ~session_table();
+
+    session* find(const peer_key& key);
+
+    /*
+     * Returns the session for key, creating it if needed. Returns NULL when
+     * the table is already holding max_sessions peers.
+     */
+    session* find_or_insert(const peer_key& key, uint64 now, bool& inserted);
+
+    bool erase(const peer_key& key);
+
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_mask + 1; }
+    uint64 idle_usec() const { return m_idle_usec; }
+
+ private:
+    static uint64 hash(const peer_key& key);
+
+    size_t probe(const peer_key& key, bool& found) const;
+    void erase_slot(size_t i);
+    void grow();
+
+    session_table(const session_table&);
+    session_table& operator=(const session_table&);
+
+ private:
+    session*    m_slots;
+    size_t      m_mask;
+    size_t      m_size;
+    size_t      m_max_sessions;
+    uint64      m_idle_usec;
+    uint32      m_next_id;
+};
+
+} //namespace vodeox
+
+#endif
@@ -0,0 +1,172 @@
+#include "config.h"
+
+#include "net/stream.h"
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace vodeox
+{
+
+stream_reader::stream_reader() :
+    m_max_frame(STREAM_MAX_FRAME),
+    m_start(0),
+    m_end(0)
+{
+}
+
+bool stream_reader::make_room()
+{
+    //nobody holds on to a frame of this chunk, start over at the front
+    if (m_chunk.unique() && m_start == m_end)
+        m_start = m_end = 0;
+
+    size_t need = m_max_frame + STREAM_FRAME_HEADER;
+    if (!m_chunk.empty() && m_chunk.size() - m_start >= need)
+        return true;
+
+    if (m_chunk.unique())
+    {
+        memmove(m_chunk.mutable_data(), m_chunk.data() + m_start, m_end - m_start);
+    }
+    else
+    {
+        //frames handed out earlier still point into the old chunk
+        buffer fresh = buffer::allocate(need > STREAM_CHUNK_SIZE ? need : STREAM_CHUNK_SIZE);
+        if (fresh.empty())
+            return false;
+        if (m_end > m_start)
+            memcpy(fresh.mutable_data(), m_chunk.data() + m_start, m_end - m_start);
+        m_chunk = fresh;
+    }
+    m_end -= m_start;
+    m_start = 0;
+    return true;
+}
+
+ssize_t stream_reader::fill(int fd)
+{
+    if (!make_room())
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    //past m_end the chunk isn't shared with anyone yet
+    ssize_t n = read(fd, m_chunk.mutable_data() + m_end, m_chunk.size() - m_end);
+    if (n > 0)
+        m_end += n;
+    return n;
+}
+
+int stream_reader::next(buffer& frame)
+{
+    if (m_end - m_start < STREAM_FRAME_HEADER)
+        return 0;
+
+    const uint8* p = (const uint8*)m_chunk.data() + m_start;
+    size_t len = ((size_t)p[0] << 8) | p[1];
+    if (len > m_max_frame)
+        return -1;
+    if (m_end - m_start < STREAM_FRAME_HEADER + len)
+        return 0;
+
+    frame = m_chunk.slice(m_start + STREAM_FRAME_HEADER, len);
+    m_start += STREAM_FRAME_HEADER + len;
+    return 1;
+}
+
+bool stream_writer::append(const char* data, size_t len)
+{
+    if (len == 0)
+        return true;
+
+    if (m_pieces.empty() || !m_pieces.back().append(data, len))
+    {
+        buffer b = buffer::allocate(len > STREAM_COALESCE_SIZE ? len : STREAM_COALESCE_SIZE);
+        if (b.empty())
+        {
+            m_failed = true;
+            return false;
+        }
+        b.truncate(0);
+        b.append(data, len);
+        m_pieces.push_back(b);
+    }
+    m_pending += len;
+    return true;
+}
+
+bool stream_writer::push_frame(const char* head, size_t head_len, const buffer& body)
+{
+    size_t len = head_len + body.size();
+    if (m_failed || len > STREAM_MAX_FRAME)
+        return false;
+
+    char prefix[STREAM_FRAME_HEADER] = { (char)(len >> 8), (char)(len & 0xff) };
+    if (!append(prefix, sizeof(prefix)) || !append(head, head_len))
+        return false;
+
+    if (body.size() <= STREAM_COPY_THRESHOLD)
+        return append(body.data(), body.size());
+    else
+    {
+        m_pieces.push_back(body);
+        m_pending += body.size();
+    }
+    return true;
+}
+
+void stream_writer::consume(size_t n)
+{
+    while (n > 0)
+    {
+        buffer& b = m_pieces.front();
+        if (n < b.size())
+        {
+            b.trim_front(n);
+            m_pending -= n;
+            return;
+        }
+        n -= b.size();
+        m_pending -= b.size();
+        m_pieces.pop_front();
+    }
+}
+
+int stream_writer::flush(int fd)
+{
+    //what is queued ends in a partial frame, don't send it
+    if (m_failed)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while (m_pending > 0)
+    {
+        struct iovec iov[STREAM_MAX_IOVECS];
+        unsigned int n = 0;
+        for (size_t i = 0; i < m_pieces.size() && n < STREAM_MAX_IOVECS; i++, n++)
+        {
+            iov[n].iov_base = (void*)m_pieces[i].data();
+            iov[n].iov_len = m_pieces[i].size();
+        }
+
+        ssize_t written = writev(fd, iov, n);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        consume(written);
+    }
+    return 1;
+}
+
+} //namespace vodeox
@@ -0,0 +1,127 @@
+#ifndef __NET_STREAM_H
+#define __NET_STREAM_H
+
+#include <sys/types.h>
+#include <stddef.h>
+
+#include <deque>
+
+#include "base/types.h"
+#include "base/slab.h"
+#include "base/buffer.h"
+
+namespace vodeox
+{
+
+/*
+ * Stream framing: every frame is a 16 bit big endian length followed by that
+ * many bytes, which carry exactly what one datagram would (protocol messages
+ * or a raw payload), so both transports share the message handling.
+ */
+static const size_t STREAM_FRAME_HEADER = 2;
+static const size_t STREAM_MAX_FRAME = 0xffff;
+
+//receive chunks, frames are sliced out of them
+static const size_t STREAM_CHUNK_SIZE = 64 * 1024;
+
+//pieces gathered per writev
+static const unsigned int STREAM_MAX_IOVECS = 64;
+
+//chunk size for coalescing small writes
+static const size_t STREAM_COALESCE_SIZE = 4096;
+
+//bodies up to this size are copied next to their header instead of referenced
+static const size_t STREAM_COPY_THRESHOLD = 256;
+
+//queued reply bytes before a connection stops reading
+static const size_t DEFAULT_STREAM_OUTBOUND_LIMIT = 1024 * 1024;
+
+/*
+ * Inbound side of a connection. Bytes are read into a buffer chunk and whole
+ * frames handed out as slices of it, so a frame stays where it was received.
+ * A partial frame at the end of a chunk is carried over to a fresh one.
+ */
+class stream_reader
+{
+ public:
+    stream_reader();
+
+    /*
+     * Longer frames are a protocol error, at most STREAM_MAX_FRAME
+     */
+    void set_max_frame(size_t n) { m_max_frame = n < STREAM_MAX_FRAME ? n : STREAM_MAX_FRAME; }
+
+    /*
+     * One read from fd, returns what read() returns. Call next() until it runs
+     * dry first, there is always room for a whole frame then.
+     */
+    ssize_t fill(int fd);
+
+    /*
+     * 1 and the next frame, 0 if it isn't complete yet or -1 when it is
+     * longer than the limit
+     */
+    int next(buffer& frame);
+
+    size_t buffered() const { return m_end - m_start; }
+
+ private:
+    bool make_room();
+
+    stream_reader(const stream_reader&);
+    stream_reader& operator=(const stream_reader&);
+
+ private:
+    size_t      m_max_frame;
+
+    //unparsed bytes are [m_start, m_end) of the chunk
+    buffer      m_chunk;
+    size_t      m_start;
+    size_t      m_end;
+};
+
+/*
+ * Outbound side of a connection, a queue of buffers sent with one writev per
+ * STREAM_MAX_IOVECS pieces. Headers and small bodies are appended to the last
+ * piece while nobody else references it, so a burst of small replies leaves
+ * in a handful of iovecs; larger bodies are queued by reference.
+ */
+class stream_writer
+{
+ public:
+    stream_writer() : m_pending(0), m_failed(false) {}
+
+    /*
+     * Queues one frame made of head (copied) followed by body. False if it
+     * would exceed STREAM_MAX_FRAME, nothing is queued then, or if there was
+     * no memory for it, which leaves the stream with a partial frame and
+     * failed() set: the connection has to go.
+     */
+    bool push_frame(const char* head, size_t head_len, const buffer& body);
+
+    /*
+     * Writes as much as the socket takes. 1 once everything is out, 0 if
+     * the socket would block, -1 on errors (errno is set).
+     */
+    int flush(int fd);
+
+    size_t pending() const { return m_pending; }
+    bool empty() const { return m_pending == 0; }
+    bool failed() const { return m_failed; }
+
+ private:
+    bool append(const char* data, size_t len);
+    void consume(size_t n);
+
+    stream_writer(const stream_writer&);
+    stream_writer& operator=(const stream_writer&);
+
+ private:
+    std::deque<buffer, slab_allocator<buffer> >     m_pieces;
+    size_t                                          m_pending;
+    bool                                            m_failed;
+};
+
+} //namespace vodeox
+
+#endif
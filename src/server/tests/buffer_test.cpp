@@ -0,0 +1,89 @@
+#include "config.h"
+
+#include "base/buffer.h"
+#include "base/slab.h"
+#include "net/recv_batch.h"
+#include "tests/check.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <vector>
+
+/*
+ * Buffer and receive chunk checks, run by "make check"
+ */
+
+static void test_slices()
+{
+    vodeox::buffer b = vodeox::buffer::copy("hello world", 11);
+    CHECK(b.size() == 11);
+    CHECK(b.unique());
+    CHECK(b.pooled());
+
+    vodeox::buffer s = b.slice(6, 100);
+    CHECK(s.size() == 5);
+    CHECK(memcmp(s.data(), "world", 5) == 0);
+    CHECK(!b.unique());
+
+    vodeox::buffer front = b.split(5);
+    CHECK(front.size() == 5 && b.size() == 6);
+    CHECK(memcmp(front.data(), "hello", 5) == 0);
+
+    s.reset();
+    front.reset();
+    CHECK(b.unique());
+
+    vodeox::buffer big = vodeox::buffer::allocate(vodeox::BUFFER_MAX_POOLED);
+    CHECK(big.pooled());
+    vodeox::buffer huge = vodeox::buffer::allocate(vodeox::BUFFER_MAX_POOLED + 1);
+    CHECK(!huge.empty() && !huge.pooled());
+}
+
+static void test_receive_chunks()
+{
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == 0);
+    //like the reactor sockets, a short batch comes back instead of blocking
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    //the defaults, 4 rounds of 32 x 2048 bytes would be one header too many
+    vodeox::recv_batch rx;
+    std::vector<vodeox::buffer> held;
+
+    for (int round = 0; round < 10; round++)
+    {
+        char msg[32];
+        int len = snprintf(msg, sizeof(msg), "round %d", round);
+        CHECK(send(fds[1], msg, len, 0) == len);
+
+        CHECK(rx.receive(fds[0]) == 1);
+        vodeox::buffer d = rx.datagram(0);
+        CHECK(d.size() == (size_t)len && memcmp(d.data(), msg, len) == 0);
+        CHECK(d.pooled());
+
+        //keep every slice, later rounds must not overwrite them
+        held.push_back(d);
+    }
+
+    for (size_t i = 0; i < held.size(); i++)
+    {
+        char msg[32];
+        int len = snprintf(msg, sizeof(msg), "round %d", (int)i);
+        CHECK(held[i].size() == (size_t)len && memcmp(held[i].data(), msg, len) == 0);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main()
+{
+    test_slices();
+    test_receive_chunks();
+
+    return check_report("buffer_test");
+}
@@ -0,0 +1,32 @@
+#ifndef __TESTS_CHECK_H
+#define __TESTS_CHECK_H
+
+#include <stdio.h>
+
+/*
+ * Minimal checks for the "make check" programs: CHECK records a failure and
+ * keeps going, check_report() prints the outcome and gives main's result.
+ * Each test is a single translation unit, so the counter is per program.
+ */
+static int s_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            s_failures++; \
+        } \
+    } while (0)
+
+static inline int check_report(const char* name)
+{
+    if (s_failures)
+    {
+        fprintf(stderr, "%s: %d checks failed\n", name, s_failures);
+        return 1;
+    }
+    printf("%s ok\n", name);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include "config.h"
+
+#include "base/future.h"
+#include "base/threadpool.h"
+#include "base/atomic.h"
+#include "tests/check.h"
+
+#include <stdio.h>
+
+#include <vector>
+
+/*
+ * Future and continuation checks, run by "make check"
+ */
+
+//live continuation objects, parked ones included
+static volatile int s_live = 0;
+
+struct add_one
+{
+    typedef int result_type;
+
+    add_one() { vodeox::atomic_fetch_add(&s_live, 1); }
+    add_one(const add_one&) { vodeox::atomic_fetch_add(&s_live, 1); }
+    ~add_one() { vodeox::atomic_fetch_sub(&s_live, 1); }
+
+    int operator()(const int& v) const { return v + 1; }
+};
+
+struct answer
+{
+    typedef int result_type;
+    int operator()() const { return 42; }
+};
+
+static void test_then()
+{
+    vodeox::promise<int> p;
+    vodeox::future<int> f = p.get_future().then(add_one()).then(add_one());
+    CHECK(!f.ready());
+    p.set_value(1);
+    CHECK(f.ready() && f.get() == 3);
+
+    //attached after the value, runs inline
+    CHECK(vodeox::make_ready_future(5).then(add_one()).get() == 6);
+}
+
+static void test_pool(vodeox::Threadpool& pool)
+{
+    vodeox::promise<int> p;
+    vodeox::future<int> f = p.get_future().then(pool, add_one());
+    p.set_value(10);
+    CHECK(f.get() == 11);
+
+    CHECK(vodeox::async(pool, answer()).then(pool, add_one()).get() == 43);
+
+    std::vector<vodeox::future<int> > inputs;
+    for (int i = 0; i < 8; i++)
+        inputs.push_back(vodeox::async(pool, answer()).then(add_one()));
+    std::vector<int> all = vodeox::when_all(inputs).get();
+    CHECK(all.size() == 8);
+    for (size_t i = 0; i < all.size(); i++)
+        CHECK(all[i] == 43);
+
+    CHECK(vodeox::when_all(std::vector<vodeox::future<int> >()).get().empty());
+}
+
+static void test_abandoned()
+{
+    {
+        vodeox::future<int> f;
+        vodeox::future<std::vector<int> > joined;
+        {
+            vodeox::promise<int> p;
+            f = p.get_future().then(add_one());
+            std::vector<vodeox::future<int> > inputs(1, p.get_future());
+            joined = vodeox::when_all(inputs);
+            CHECK(s_live > 0);
+        }
+        //the promise is gone, its parked continuation with it
+        CHECK(s_live == 0);
+        CHECK(!f.ready() && !joined.ready());
+
+        //attaching to an abandoned future doesn't park anything either
+        f.then(add_one());
+        CHECK(s_live == 0);
+    }
+    CHECK(s_live == 0);
+}
+
+int main()
+{
+    test_then();
+
+    vodeox::Threadpool pool(2);
+    pool.start();
+    test_pool(pool);
+    pool.stop();
+
+    test_abandoned();
+
+    return check_report("future_test");
+}
@@ -0,0 +1,242 @@
+#include "config.h"
+
+#include "base/lz.h"
+#include "base/types.h"
+#include "tests/check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using namespace vodeox;
+
+/*
+ * LZ block and file codec checks, run by "make check"
+ */
+
+static const size_t CORRUPT = (size_t)-1;
+
+//log like text, compresses well and has matches of every length
+static std::string text(size_t len)
+{
+    std::string s;
+    char line[128];
+    for (unsigned i = 0; s.size() < len; i++)
+    {
+        snprintf(line, sizeof(line), "2024-01-01 00:00:%02u.%06u INFO Reactor session %u joined group %u\n",
+                 i % 60, i * 7919 % 1000000, i % 97, i % 13);
+        s += line;
+        if (i % 50 == 0)
+            s.append(300 + i % 40, 'x');
+    }
+    s.resize(len);
+    return s;
+}
+
+static std::string noise(size_t len)
+{
+    std::string s(len, 0);
+    for (size_t i = 0; i < len; i++)
+        s[i] = (char)rand();
+    return s;
+}
+
+static bool round_trip(const std::string& in)
+{
+    std::vector<char> packed(lz_bound(in.size()));
+    size_t n = lz_compress(in.data(), in.size(), &packed[0], packed.size());
+    if (n == 0 || n > packed.size())
+        return false;
+
+    std::vector<char> out(in.size() + 1);
+    size_t m = lz_decompress(&packed[0], n, &out[0], out.size());
+    return m == in.size() && memcmp(&out[0], in.data(), m) == 0;
+}
+
+static void test_blocks()
+{
+    //every short length, then sizes around the 15 and 255 length escapes
+    for (size_t len = 0; len <= 300; len++)
+    {
+        CHECK(round_trip(text(len)));
+        CHECK(round_trip(noise(len)));
+        CHECK(round_trip(std::string(len, 'a')));
+    }
+    CHECK(round_trip(text(LZ_FILE_BLOCK)));
+    CHECK(round_trip(noise(LZ_FILE_BLOCK)));
+    CHECK(round_trip(std::string(LZ_FILE_BLOCK, 0)));
+
+    //compressible input does shrink
+    std::string t = text(64 * 1024);
+    std::vector<char> packed(lz_bound(t.size()));
+    size_t n = lz_compress(t.data(), t.size(), &packed[0], packed.size());
+    CHECK(n > 0 && n < t.size() / 2);
+
+    //not enough room on either side
+    CHECK(lz_compress(t.data(), t.size(), &packed[0], n - 1) == 0);
+    std::vector<char> out(t.size());
+    CHECK(lz_decompress(&packed[0], n, &out[0], t.size() - 1) == CORRUPT);
+    CHECK(lz_decompress(&packed[0], n, &out[0], t.size()) == t.size());
+}
+
+static void test_corrupt_blocks()
+{
+    char out[64];
+
+    //zero offset, offset behind the start of the output
+    const char zero_offset[] = { 0x10, 'a', 0x00, 0x00, 0x00 };
+    CHECK(lz_decompress(zero_offset, sizeof(zero_offset), out, sizeof(out)) == CORRUPT);
+    const char far_offset[] = { 0x10, 'a', 0x02, 0x00, 0x00 };
+    CHECK(lz_decompress(far_offset, sizeof(far_offset), out, sizeof(out)) == CORRUPT);
+
+    //literal count past the end of the input, missing length bytes
+    const char long_literals[] = { 0x50, 'a', 'b' };
+    CHECK(lz_decompress(long_literals, sizeof(long_literals), out, sizeof(out)) == CORRUPT);
+    const char no_length[] = { (char)0xf0 };
+    CHECK(lz_decompress(no_length, sizeof(no_length), out, sizeof(out)) == CORRUPT);
+
+    //half an offset
+    const char half_offset[] = { 0x10, 'a', 0x01 };
+    CHECK(lz_decompress(half_offset, sizeof(half_offset), out, sizeof(out)) == CORRUPT);
+
+    //a valid overlapping match
+    const char run[] = { 0x13, 'a', 0x01, 0x00, 0x00 };
+    CHECK(lz_decompress(run, sizeof(run), out, sizeof(out)) == 8 && memcmp(out, "aaaaaaaa", 8) == 0);
+
+    //random damage never writes past room
+    std::string t = text(4096);
+    std::vector<char> packed(lz_bound(t.size()));
+    size_t n = lz_compress(t.data(), t.size(), &packed[0], packed.size());
+    std::vector<char> buf(t.size() + 64, 0x5a);
+    for (int i = 0; i < 2000; i++)
+    {
+        std::vector<char> damaged(packed.begin(), packed.begin() + n);
+        damaged[rand() % n] ^= (char)(1 + rand() % 255);
+        size_t len = rand() % 4 ? n : rand() % n;
+        size_t m = lz_decompress(&damaged[0], len, &buf[0], t.size());
+        CHECK(m == CORRUPT || m <= t.size());
+        CHECK(buf[t.size()] == 0x5a);
+    }
+}
+
+//fresh unlinked temporary file
+static int temp_fd()
+{
+    char path[] = "/tmp/lz_test.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    return fd;
+}
+
+static std::string read_all(int fd)
+{
+    std::string s;
+    char buf[65536];
+    lseek(fd, 0, SEEK_SET);
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        s.append(buf, n);
+    return s;
+}
+
+static void write_all(int fd, const std::string& s)
+{
+    lseek(fd, 0, SEEK_SET);
+    CHECK(ftruncate(fd, 0) == 0);
+    CHECK(write(fd, s.data(), s.size()) == (ssize_t)s.size());
+    lseek(fd, 0, SEEK_SET);
+}
+
+static std::string pack_file(const std::string& in)
+{
+    int src = temp_fd(), dst = temp_fd();
+    write_all(src, in);
+    CHECK(lz_compress_file(src, dst));
+    std::string packed = read_all(dst);
+    close(src);
+    close(dst);
+    return packed;
+}
+
+//true and the output if the archive unpacks
+static bool unpack_file(const std::string& packed, std::string& out)
+{
+    int src = temp_fd(), dst = temp_fd();
+    write_all(src, packed);
+    bool ok = lz_decompress_file(src, dst);
+    out = read_all(dst);
+    close(src);
+    close(dst);
+    return ok;
+}
+
+static uint32 get32(const std::string& s, size_t at)
+{
+    const unsigned char* u = (const unsigned char*)s.data() + at;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32)u[3] << 24);
+}
+
+static void test_files()
+{
+    //empty input is just the magic
+    std::string packed = pack_file("");
+    CHECK(packed == "VLZ1");
+    std::string out;
+    CHECK(unpack_file(packed, out) && out.empty());
+
+    //compressed, stored and a short last block
+    std::string in = text(LZ_FILE_BLOCK) + noise(LZ_FILE_BLOCK) + text(LZ_FILE_BLOCK / 3 + 17);
+    packed = pack_file(in);
+    CHECK(packed.size() < in.size());
+    CHECK(unpack_file(packed, out) && out == in);
+
+    //walk the block headers
+    size_t at = 4;
+    std::vector<uint32> raw, stored;
+    while (at + 8 <= packed.size())
+    {
+        raw.push_back(get32(packed, at));
+        stored.push_back(get32(packed, at + 4));
+        at += 8 + (stored.back() & 0x7fffffffU);
+    }
+    CHECK(at == packed.size() && raw.size() == 3);
+    if (raw.size() == 3)
+    {
+        CHECK(raw[0] == LZ_FILE_BLOCK && (stored[0] & 0x80000000U) == 0);
+        CHECK(raw[1] == LZ_FILE_BLOCK && stored[1] == (LZ_FILE_BLOCK | 0x80000000U));
+        CHECK(raw[2] == LZ_FILE_BLOCK / 3 + 17 && (stored[2] & 0x80000000U) == 0);
+    }
+
+    //truncated anywhere but at a block boundary
+    size_t first = 4 + 8 + (stored[0] & 0x7fffffffU);
+    size_t cuts[] = { 0, 2, 5, 11, 12, 100, first - 1, first + 3, first + 9, packed.size() - 1 };
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++)
+        CHECK(!unpack_file(packed.substr(0, cuts[i]), out));
+    CHECK(unpack_file(packed.substr(0, first), out) && out == in.substr(0, LZ_FILE_BLOCK));
+
+    //bad magic, oversized block, stored size that disagrees with the raw one
+    std::string bad = packed;
+    bad[3] = '2';
+    CHECK(!unpack_file(bad, out));
+    bad = packed;
+    bad[4 + 2] = 0x7f;
+    CHECK(!unpack_file(bad, out));
+    bad = packed;
+    bad[first + 2] = 0x03;
+    CHECK(!unpack_file(bad, out));
+}
+
+int main()
+{
+    srand(3);
+    test_blocks();
+    test_corrupt_blocks();
+    test_files();
+
+    return check_report("lz_test");
+}
@@ -0,0 +1,244 @@
+#include "config.h"
+
+#include "base/timer_wheel.h"
+#include "tests/check.h"
+
+#include <stdlib.h>
+
+#include <vector>
+
+using vodeox::timer_wheel;
+using vodeox::timer_node;
+
+/*
+ * Timer wheel checks, run by "make check"
+ */
+
+static const uint64 TICK = 10;
+
+//tick handed to the running advance call
+static uint64 s_now = 0;
+
+//expiry of the last timer fired, they have to come in order
+static uint64 s_last = 0;
+
+struct probe
+{
+    timer_node  node;
+    int         fired;
+    uint64      fired_at;
+
+    probe() : fired(0), fired_at(0) {}
+};
+
+static void on_fire(timer_node* node, void* arg)
+{
+    probe* p = (probe*)arg;
+    CHECK(node == &p->node);
+    CHECK(!node->pending());
+    CHECK(node->expires >= s_last);
+    s_last = node->expires;
+    p->fired++;
+    p->fired_at = s_now;
+}
+
+static size_t advance_to(timer_wheel& w, uint64 tick)
+{
+    s_now = tick;
+    return w.advance(tick * TICK);
+}
+
+//one tick at a time, so every timer has to fire exactly at its expiry
+static void test_boundaries()
+{
+    //not aligned to any level, the first cascades come within a few ticks
+    const uint64 start = 65536 * 3 - 200;
+    timer_wheel w(start * TICK, TICK);
+    s_last = 0;
+
+    static const uint64 delays[] = {
+        1, 2, 199, 200, 201, 255, 256, 257, 456, 457,
+        65335, 65336, 65337, 65535, 65536, 65537, 65736, 65737,
+        131072, 200000, 16777216 - 1, 16777216
+    };
+    const size_t n = sizeof(delays) / sizeof(delays[0]);
+
+    std::vector<probe> probes(n);
+    for (size_t i = 0; i < n; i++)
+        w.schedule(&probes[i].node, delays[i] * TICK, on_fire, &probes[i]);
+    CHECK(w.size() == n);
+
+    //the last two are only checked with a jump, stepping to them takes long
+    size_t fired = 0;
+    for (uint64 t = start; t <= start + 200000; t++)
+    {
+        fired += advance_to(w, t);
+        CHECK(w.size() == n - fired);
+    }
+    for (size_t i = 0; i < n - 2; i++)
+    {
+        CHECK(probes[i].fired == 1);
+        CHECK(probes[i].fired_at == start + delays[i]);
+        CHECK(probes[i].node.expires == start + delays[i]);
+    }
+
+    fired += advance_to(w, start + 16777216 - 2);
+    CHECK(probes[n - 2].fired == 0 && probes[n - 1].fired == 0);
+    fired += advance_to(w, start + 16777216 - 1);
+    CHECK(probes[n - 2].fired == 1 && probes[n - 1].fired == 0);
+    fired += advance_to(w, start + 16777216);
+    CHECK(probes[n - 1].fired == 1);
+    CHECK(fired == n && w.size() == 0);
+}
+
+//random delays across three levels, advanced in random jumps
+static void test_random()
+{
+    const uint64 start = 12345;
+    timer_wheel w(start * TICK, TICK);
+    s_last = 0;
+    srand(7);
+
+    const size_t n = 5000;
+    std::vector<probe> probes(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64 delay = ((uint64)rand() << 16 | (rand() & 0xffff)) % (1 << 18);
+        w.schedule(&probes[i].node, delay * TICK, on_fire, &probes[i]);
+    }
+
+    //cancel every tenth, they must never fire
+    size_t live = n;
+    for (size_t i = 0; i < n; i += 10)
+    {
+        w.cancel(&probes[i].node);
+        live--;
+    }
+    CHECK(w.size() == live);
+
+    uint64 t = start;
+    uint64 prev = start - 1;
+    size_t fired = 0;
+    while (t < start + (1 << 18) + 1000)
+    {
+        fired += advance_to(w, t);
+        CHECK(w.size() == live - fired);
+        for (size_t i = 0; i < n; i++)
+        {
+            if (probes[i].fired_at != t || !probes[i].fired)
+                continue;
+            //in the call that first reached its tick
+            CHECK(probes[i].node.expires > prev && probes[i].node.expires <= t);
+        }
+        prev = t;
+        t += 1 + rand() % 700;
+    }
+
+    CHECK(fired == live && w.size() == 0);
+    for (size_t i = 0; i < n; i++)
+        CHECK(probes[i].fired == (i % 10 ? 1 : 0));
+}
+
+//zero delays, rounding up to ticks
+static void test_overdue()
+{
+    const uint64 start = 1000;
+    timer_wheel w(start * TICK, TICK);
+    s_last = 0;
+
+    probe now, partial;
+    w.schedule(&now.node, 0, on_fire, &now);
+    w.schedule(&partial.node, TICK / 2, on_fire, &partial);
+    CHECK(now.node.expires == start);
+    CHECK(partial.node.expires == start + 1);
+
+    CHECK(advance_to(w, start) == 1);
+    CHECK(now.fired == 1 && now.fired_at == start);
+    CHECK(partial.fired == 0 && w.size() == 1);
+
+    //the wheel has moved on, a zero delay is due with the next tick
+    w.schedule(&now.node, 0);
+    CHECK(now.node.expires == start + 1);
+    CHECK(advance_to(w, start + 1) == 2);
+    CHECK(now.fired == 2 && partial.fired == 1 && w.size() == 0);
+}
+
+/*
+ * First of three timers due in the same tick: cancels the second, pushes
+ * the third back, adds a zero delay timer and rearms itself once
+ */
+struct same_tick
+{
+    timer_wheel*    wheel;
+    probe           first;
+    probe           second;
+    probe           third;
+    probe           added;
+};
+
+static void on_first(timer_node* node, void* arg)
+{
+    same_tick* s = (same_tick*)arg;
+    timer_wheel& w = *s->wheel;
+    s->first.fired++;
+    s->first.fired_at = s_now;
+    if (s->first.fired > 1)
+        return;
+    CHECK(w.size() == 2);
+
+    w.cancel(&s->second.node);
+    CHECK(!s->second.node.pending() && w.size() == 1);
+
+    w.schedule(&s->third.node, 5 * TICK);
+    CHECK(s->third.node.expires == s_now + 1 + 5 && w.size() == 1);
+
+    w.schedule(&s->added.node, 0, on_fire, &s->added);
+    CHECK(s->added.node.expires == s_now + 1 && w.size() == 2);
+
+    w.schedule(node, 256 * TICK);
+    CHECK(w.size() == 3);
+}
+
+static void test_callbacks()
+{
+    const uint64 start = 250;
+    timer_wheel w(start * TICK, TICK);
+    s_last = 0;
+
+    same_tick s;
+    s.wheel = &w;
+    w.schedule(&s.first.node, 10 * TICK, on_first, &s);
+    w.schedule(&s.second.node, 10 * TICK, on_fire, &s.second);
+    w.schedule(&s.third.node, 10 * TICK, on_fire, &s.third);
+    CHECK(w.size() == 3);
+
+    //only the first fires, the others were taken out of the expired list
+    CHECK(advance_to(w, start + 10) == 1);
+    CHECK(s.first.fired == 1 && s.second.fired == 0 && s.third.fired == 0);
+    CHECK(w.size() == 3);
+
+    CHECK(advance_to(w, start + 11) == 1);
+    CHECK(s.added.fired == 1 && s.added.fired_at == start + 11);
+
+    CHECK(advance_to(w, start + 15) == 0);
+    CHECK(advance_to(w, start + 16) == 1);
+    CHECK(s.third.fired == 1 && s.third.fired_at == start + 16);
+
+    //rearmed across the level 0 wrap
+    s_last = 0;
+    CHECK(s.first.node.expires == start + 11 + 256);
+    CHECK(advance_to(w, start + 11 + 255) == 0);
+    CHECK(advance_to(w, start + 11 + 256) == 1);
+    CHECK(s.first.fired == 2 && s.first.fired_at == start + 11 + 256);
+    CHECK(s.second.fired == 0 && s.added.fired == 1 && w.size() == 0);
+}
+
+int main()
+{
+    test_boundaries();
+    test_random();
+    test_overdue();
+    test_callbacks();
+
+    return check_report("timer_wheel_test");
+}
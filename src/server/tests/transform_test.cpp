@@ -0,0 +1,152 @@
+#include "config.h"
+
+#include "base/transform.h"
+#include "tests/check.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace vodeox;
+
+/*
+ * Payload kernel checks, run by "make check". Every kernel set this CPU has
+ * is compared byte for byte with the scalar one, over all lengths up to
+ * MAX_LEN and start offsets that hit every alignment of the widest vector.
+ */
+
+static const size_t MAX_LEN = 300;
+static const size_t OFFSETS = 33;
+static const size_t BUFFER_SIZE = MAX_LEN + OFFSETS + 64;
+
+static const char* s_isas[] = { "sse2", "avx2" };
+
+static const size_t s_key_lens[] = { 1, 3, 16, 31, 32, 33, MAX_XOR_KEY };
+
+static char s_src[BUFFER_SIZE];
+static uint8 s_key[MAX_XOR_KEY];
+
+//outputs of one kernel set, each op at its own place in the buffer
+struct results
+{
+    char    rot13[BUFFER_SIZE];
+    char    lower[BUFFER_SIZE];
+    char    rot13_in_place[BUFFER_SIZE];
+    char    xor_out[sizeof(s_key_lens) / sizeof(s_key_lens[0])][BUFFER_SIZE];
+    uint16  checksum;
+
+    void run(const char* src, size_t len, size_t offset)
+    {
+        //destinations misaligned differently from the source
+        size_t d = (offset * 7 + 5) % OFFSETS;
+        memset(this, 0, sizeof(*this));
+
+        rot13_bytes(rot13 + d, src, len);
+        fold_case_bytes(lower + d, src, len);
+
+        memcpy(rot13_in_place + offset, src, len);
+        rot13_bytes(rot13_in_place + offset, rot13_in_place + offset, len);
+
+        for (size_t k = 0; k < sizeof(s_key_lens) / sizeof(s_key_lens[0]); k++)
+            xor_bytes(xor_out[k] + d, src, len, s_key, s_key_lens[k]);
+
+        checksum = internet_checksum(src, len);
+    }
+};
+
+static results s_expected;
+static results s_actual;
+
+//RFC 1071 checksum straight from the definition, in network byte order
+static uint16 reference_checksum(const char* data, size_t len)
+{
+    uint32 sum = 0;
+    for (size_t i = 0; i < len; i += 2)
+    {
+        uint32 hi = (uint8)data[i];
+        uint32 lo = i + 1 < len ? (uint8)data[i + 1] : 0;
+        sum += (hi << 8) | lo;
+    }
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    sum = ~sum & 0xffff;
+
+    uint8 bytes[2] = { (uint8)(sum >> 8), (uint8)sum };
+    uint16 out;
+    memcpy(&out, bytes, 2);
+    return out;
+}
+
+//spot checks of the scalar kernels themselves
+static void test_scalar()
+{
+    CHECK(set_transform_isa("scalar"));
+    CHECK(strcmp(transform_isa(), "scalar") == 0);
+
+    char out[64];
+    const char* text = "Hello, World! az AZ mn MN [`{@";
+    size_t len = strlen(text);
+
+    rot13_bytes(out, text, len);
+    CHECK(memcmp(out, "Uryyb, Jbeyq! nm NM za ZA [`{@", len) == 0);
+    fold_case_bytes(out, text, len);
+    CHECK(memcmp(out, "hello, world! az az mn mn [`{@", len) == 0);
+
+    for (size_t n = 0; n <= MAX_LEN; n++)
+        CHECK(internet_checksum(s_src, n) == reference_checksum(s_src, n));
+
+    const uint8 key[] = { 0x01, 0x80, 0xff };
+    xor_bytes(out, text, len, key, sizeof(key));
+    for (size_t i = 0; i < len; i++)
+        CHECK((uint8)out[i] == ((uint8)text[i] ^ key[i % sizeof(key)]));
+}
+
+static void test_isa(const char* isa)
+{
+    if (!set_transform_isa(isa))
+    {
+        printf("transform_test: no %s on this cpu, skipped\n", isa);
+        return;
+    }
+
+    size_t mismatches = 0;
+    for (size_t offset = 0; offset < OFFSETS; offset++)
+    {
+        for (size_t len = 0; len <= MAX_LEN; len++)
+        {
+            const char* src = s_src + offset;
+
+            CHECK(set_transform_isa("scalar"));
+            s_expected.run(src, len, offset);
+            CHECK(set_transform_isa(isa));
+            s_actual.run(src, len, offset);
+
+            if (memcmp(&s_expected, &s_actual, sizeof(results)) != 0)
+            {
+                if (mismatches++ < 10)
+                    fprintf(stderr, "%s differs from scalar, offset %zu length %zu\n", isa, offset, len);
+                CHECK(memcmp(s_expected.rot13, s_actual.rot13, BUFFER_SIZE) == 0);
+                CHECK(memcmp(s_expected.lower, s_actual.lower, BUFFER_SIZE) == 0);
+                CHECK(memcmp(s_expected.rot13_in_place, s_actual.rot13_in_place, BUFFER_SIZE) == 0);
+                CHECK(memcmp(s_expected.xor_out, s_actual.xor_out, sizeof(s_actual.xor_out)) == 0);
+                CHECK(s_expected.checksum == s_actual.checksum);
+            }
+        }
+    }
+}
+
+int main()
+{
+    //every byte value, letters and their neighbours more often
+    srand(11);
+    static const char edges[] = "@AMNZ[`amnz{";
+    for (size_t i = 0; i < BUFFER_SIZE; i++)
+        s_src[i] = (i % 3) ? (char)rand() : edges[rand() % (sizeof(edges) - 1)];
+    for (size_t i = 0; i < MAX_XOR_KEY; i++)
+        s_key[i] = (uint8)rand();
+
+    test_scalar();
+    for (size_t i = 0; i < sizeof(s_isas) / sizeof(s_isas[0]); i++)
+        test_isa(s_isas[i]);
+
+    return check_report("transform_test");
+}
@@ -0,0 +1,94 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <string>
+
+#include "base/lz.h"
+
+/*
+ * Unpacks log archives written with the built-in LZ codec (builds without
+ * zlib). Every name.lz argument is unpacked to name and kept; without
+ * arguments stdin is unpacked to stdout.
+ */
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [file.lz ...]\n"
+            "          unpacks each file.lz to file, or stdin to stdout\n", prog);
+}
+
+static bool
+unpack(const char *path)
+{
+    std::string name(path);
+    size_t n = name.size();
+    if (n <= 3 || name.compare(n - 3, 3, ".lz") != 0)
+    {
+        fprintf(stderr, "%s: no .lz suffix, skipped\n", path);
+        return false;
+    }
+    std::string target = name.substr(0, n - 3);
+
+    int in = open(path, O_RDONLY);
+    if (in < 0)
+    {
+        perror(path);
+        return false;
+    }
+    //refuse to clobber anything that's already there
+    int out = open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out < 0)
+    {
+        perror(target.c_str());
+        close(in);
+        return false;
+    }
+
+    bool ok = vodeox::lz_decompress_file(in, out);
+    if (close(out) != 0)
+        ok = false;
+    close(in);
+
+    if (!ok)
+    {
+        fprintf(stderr, "%s: corrupt or unreadable archive\n", path);
+        unlink(target.c_str());
+    }
+    return ok;
+}
+
+int
+main(int c, char **v)
+{
+    if (c > 1 && v[1][0] == '-')
+    {
+        usage(v[0]);
+        return 1;
+    }
+
+    if (c == 1)
+    {
+        if (isatty(STDIN_FILENO))
+        {
+            usage(v[0]);
+            return 1;
+        }
+        if (!vodeox::lz_decompress_file(STDIN_FILENO, STDOUT_FILENO))
+        {
+            fprintf(stderr, "%s: corrupt or unreadable input\n", v[0]);
+            return 1;
+        }
+        return 0;
+    }
+
+    int failed = 0;
+    for (int i = 1; i < c; i++)
+        if (!unpack(v[i]))
+            failed++;
+    return failed ? 1 : 0;
+}